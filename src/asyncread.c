@@ -0,0 +1,550 @@
+// Scalpel Copyright (C) 2005-11 by Golden G. Richard III and
+// 2007-11 by Vico Marziale.
+// Written by Golden G. Richard III and Vico Marziale.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+//
+// Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+// on Foremost.  Foremost 0.69 was used as the starting point for
+// Scalpel, in 2005.
+
+
+// Asynchronous positioned reads.  See asyncread.h.
+
+// for O_DIRECT
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "asyncread.h"
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// io_uring is used through its system calls, so it needs only the
+// kernel headers, not liburing
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#define USE_IO_URING
+#endif
+#endif
+
+// one outstanding read
+typedef struct AsyncSlot {
+  char *dest;
+  long long offset;
+  size_t length;
+  struct iovec iov;		// io_uring reads into this
+  long long result;		// bytes read, or -errno
+  int done;
+} AsyncSlot;
+
+struct AsyncReader {
+  int fd;
+  int depth;
+  AsyncSlot *slots;		// ring of 'depth' slots, in submission order
+  unsigned long long submitted;	// reads submitted, ever
+  unsigned long long completed;	// reads handed back by asyncread_wait()
+
+  int uring;			// io_uring file descriptor, or -1 for threads
+#ifdef USE_IO_URING
+  void *sqmap, *cqmap;		// the mapped rings
+  size_t sqmaplength, cqmaplength;
+  struct io_uring_sqe *sqes;
+  size_t sqeslength;
+  unsigned *sqtail, *sqmask, *sqarray;
+  unsigned *cqhead, *cqtail, *cqmask;
+  struct io_uring_cqe *cqes;
+#endif
+
+  // pread threads
+  pthread_t *threads;
+  int numthreads;
+  unsigned long long taken;	// reads taken by a thread, ever
+  int closing;
+  pthread_mutex_t lock;
+  pthread_cond_t work, finished;
+};
+
+#ifdef USE_IO_URING
+static int uringInit(AsyncReader * reader);
+static int uringSubmit(AsyncReader * reader, unsigned slot);
+static int uringReap(AsyncReader * reader);
+static void uringDestroy(AsyncReader * reader);
+#endif
+static int threadsInit(AsyncReader * reader);
+static void *readerThread(void *arg);
+static void threadsDestroy(AsyncReader * reader);
+
+
+AsyncReader *asyncread_init(int fd, int depth) {
+
+  AsyncReader *reader;
+
+  if(depth < 1 || depth > ASYNCREAD_MAX_DEPTH) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if((reader = (AsyncReader *)calloc(1, sizeof(AsyncReader))) == NULL) {
+    return NULL;
+  }
+  if((reader->slots =
+      (AsyncSlot *)calloc(depth, sizeof(AsyncSlot))) == NULL) {
+    free(reader);
+    return NULL;
+  }
+  reader->fd = fd;
+  reader->depth = depth;
+  reader->uring = -1;
+
+#ifdef USE_IO_URING
+  if(uringInit(reader) == 0) {
+    return reader;
+  }
+#endif
+  if(threadsInit(reader) == 0) {
+    return reader;
+  }
+  free(reader->slots);
+  free(reader);
+  return NULL;
+}
+
+
+int asyncread_submit(AsyncReader * reader, char *dest, long long offset,
+		     size_t length) {
+
+  unsigned slot = reader->submitted % reader->depth;
+  AsyncSlot *s = &(reader->slots[slot]);
+
+  if(reader->submitted - reader->completed >= (unsigned)reader->depth) {
+    errno = EBUSY;
+    return -1;
+  }
+  s->dest = dest;
+  s->offset = offset;
+  s->length = length;
+  s->iov.iov_base = dest;
+  s->iov.iov_len = length;
+  s->result = 0;
+  s->done = 0;
+
+#ifdef USE_IO_URING
+  if(reader->uring >= 0) {
+    if(uringSubmit(reader, slot)) {
+      return -1;
+    }
+    reader->submitted++;
+    return 0;
+  }
+#endif
+  pthread_mutex_lock(&(reader->lock));
+  reader->submitted++;
+  pthread_cond_signal(&(reader->work));
+  pthread_mutex_unlock(&(reader->lock));
+  return 0;
+}
+
+
+long long asyncread_wait(AsyncReader * reader) {
+
+  AsyncSlot *s;
+  long long result;
+  ssize_t n;
+
+  if(reader->completed == reader->submitted) {
+    errno = EINVAL;
+    return -1;
+  }
+  s = &(reader->slots[reader->completed % reader->depth]);
+
+#ifdef USE_IO_URING
+  if(reader->uring >= 0) {
+    while (!s->done) {
+      if(uringReap(reader)) {
+	return -1;
+      }
+    }
+  }
+  else
+#endif
+  {
+    pthread_mutex_lock(&(reader->lock));
+    while (!s->done) {
+      pthread_cond_wait(&(reader->finished), &(reader->lock));
+    }
+    pthread_mutex_unlock(&(reader->lock));
+  }
+
+  reader->completed++;
+  result = s->result;
+
+  // io_uring may return short reads before the end of the file; finish
+  // them here, as the pread threads do
+  while (result > 0 && (size_t)result < s->length) {
+    n = pread(reader->fd, s->dest + result, s->length - result,
+	      s->offset + result);
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      break;
+    }
+    result += n;
+  }
+  if(result < 0) {
+    errno = (int)-result;
+    return -1;
+  }
+  return result;
+}
+
+
+void asyncread_destroy(AsyncReader * reader) {
+
+  unsigned long long completed;
+
+  if(reader == NULL) {
+    return;
+  }
+
+  // the reads still own their buffers until they finish
+  while (reader->completed < reader->submitted) {
+    completed = reader->completed;
+    asyncread_wait(reader);
+    if(reader->completed == completed) {
+      break;
+    }
+  }
+
+#ifdef USE_IO_URING
+  if(reader->uring >= 0) {
+    uringDestroy(reader);
+  }
+  else
+#endif
+  {
+    threadsDestroy(reader);
+  }
+  free(reader->slots);
+  free(reader);
+}
+
+
+const char *asyncread_method(AsyncReader * reader) {
+
+  return reader->uring >= 0 ? "io_uring" : "pread threads";
+}
+
+
+int asyncread_open_direct(const char *path) {
+
+#ifdef O_DIRECT
+  return open(path, O_RDONLY | O_DIRECT);
+#else
+  (void)path;
+  errno = EINVAL;
+  return -1;
+#endif
+}
+
+
+#ifdef USE_IO_URING
+
+// set up an io_uring with room for 'depth' reads and map its rings
+static int uringInit(AsyncReader * reader) {
+
+  struct io_uring_params params;
+  int fd;
+
+  memset(&params, 0, sizeof(params));
+  if((fd = (int)syscall(__NR_io_uring_setup, reader->depth, &params)) < 0) {
+    return -1;
+  }
+  reader->uring = fd;
+
+  reader->sqmaplength = params.sq_off.array +
+    params.sq_entries * sizeof(unsigned);
+  reader->cqmaplength = params.cq_off.cqes +
+    params.cq_entries * sizeof(struct io_uring_cqe);
+  reader->sqmap = mmap(0, reader->sqmaplength, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if(reader->sqmap == MAP_FAILED) {
+    reader->sqmap = 0;
+    uringDestroy(reader);
+    return -1;
+  }
+  reader->cqmap = mmap(0, reader->cqmaplength, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  if(reader->cqmap == MAP_FAILED) {
+    reader->cqmap = 0;
+    uringDestroy(reader);
+    return -1;
+  }
+  reader->sqeslength = params.sq_entries * sizeof(struct io_uring_sqe);
+  reader->sqes = (struct io_uring_sqe *)mmap(0, reader->sqeslength,
+					     PROT_READ | PROT_WRITE,
+					     MAP_SHARED | MAP_POPULATE, fd,
+					     IORING_OFF_SQES);
+  if(reader->sqes == MAP_FAILED) {
+    reader->sqes = 0;
+    uringDestroy(reader);
+    return -1;
+  }
+
+  reader->sqtail = (unsigned *)((char *)reader->sqmap + params.sq_off.tail);
+  reader->sqmask =
+    (unsigned *)((char *)reader->sqmap + params.sq_off.ring_mask);
+  reader->sqarray = (unsigned *)((char *)reader->sqmap + params.sq_off.array);
+  reader->cqhead = (unsigned *)((char *)reader->cqmap + params.cq_off.head);
+  reader->cqtail = (unsigned *)((char *)reader->cqmap + params.cq_off.tail);
+  reader->cqmask =
+    (unsigned *)((char *)reader->cqmap + params.cq_off.ring_mask);
+  reader->cqes =
+    (struct io_uring_cqe *)((char *)reader->cqmap + params.cq_off.cqes);
+  return 0;
+}
+
+
+// queue a vectored read of the slot's buffer and hand it to the kernel
+static int uringSubmit(AsyncReader * reader, unsigned slot) {
+
+  AsyncSlot *s = &(reader->slots[slot]);
+  unsigned tail = *(reader->sqtail);
+  unsigned index = tail & *(reader->sqmask);
+  struct io_uring_sqe *sqe = &(reader->sqes[index]);
+  long submitted;
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = reader->fd;
+  sqe->off = (unsigned long long)s->offset;
+  sqe->addr = (unsigned long long)(size_t)&(s->iov);
+  sqe->len = 1;
+  sqe->user_data = slot;
+  reader->sqarray[index] = index;
+
+  // the kernel mustn't see the new tail before the entry it covers
+  __atomic_store_n(reader->sqtail, tail + 1, __ATOMIC_RELEASE);
+
+  do {
+    submitted = syscall(__NR_io_uring_enter, reader->uring, 1, 0, 0, NULL, 0);
+  } while (submitted < 0 && errno == EINTR);
+  return submitted == 1 ? 0 : -1;
+}
+
+
+// wait for at least one read to finish and record the results of all
+// of the reads that have
+static int uringReap(AsyncReader * reader) {
+
+  unsigned head = *(reader->cqhead);
+  struct io_uring_cqe *cqe;
+
+  while (head == __atomic_load_n(reader->cqtail, __ATOMIC_ACQUIRE)) {
+    if(syscall(__NR_io_uring_enter, reader->uring, 0, 1,
+	       IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+      return -1;
+    }
+  }
+  while (head != __atomic_load_n(reader->cqtail, __ATOMIC_ACQUIRE)) {
+    cqe = &(reader->cqes[head & *(reader->cqmask)]);
+    reader->slots[cqe->user_data].result = cqe->res;
+    reader->slots[cqe->user_data].done = 1;
+    head++;
+  }
+  __atomic_store_n(reader->cqhead, head, __ATOMIC_RELEASE);
+  return 0;
+}
+
+
+static void uringDestroy(AsyncReader * reader) {
+
+  if(reader->sqes) {
+    munmap(reader->sqes, reader->sqeslength);
+  }
+  if(reader->cqmap) {
+    munmap(reader->cqmap, reader->cqmaplength);
+  }
+  if(reader->sqmap) {
+    munmap(reader->sqmap, reader->sqmaplength);
+  }
+  close(reader->uring);
+  reader->uring = -1;
+}
+
+#endif // USE_IO_URING
+
+
+// start one pread thread per outstanding read
+static int threadsInit(AsyncReader * reader) {
+
+  int t;
+
+  if((reader->threads =
+      (pthread_t *)malloc(reader->depth * sizeof(pthread_t))) == NULL) {
+    return -1;
+  }
+  pthread_mutex_init(&(reader->lock), NULL);
+  pthread_cond_init(&(reader->work), NULL);
+  pthread_cond_init(&(reader->finished), NULL);
+  for(t = 0; t < reader->depth; t++) {
+    if(pthread_create(&(reader->threads[t]), NULL, readerThread,
+		      (void *)reader)) {
+      break;
+    }
+  }
+  reader->numthreads = t;
+  if(t == 0) {
+    threadsDestroy(reader);
+    return -1;
+  }
+  return 0;
+}
+
+
+// take the oldest read no other thread has taken and read it with
+// pread(), until the end of the file or an error
+static void *readerThread(void *arg) {
+
+  AsyncReader *reader = (AsyncReader *)arg;
+  AsyncSlot *s;
+  long long got;
+  ssize_t n;
+
+  pthread_mutex_lock(&(reader->lock));
+  for(;;) {
+    while (!reader->closing && reader->taken == reader->submitted) {
+      pthread_cond_wait(&(reader->work), &(reader->lock));
+    }
+    if(reader->taken == reader->submitted) {
+      break;
+    }
+    s = &(reader->slots[reader->taken % reader->depth]);
+    reader->taken++;
+    pthread_mutex_unlock(&(reader->lock));
+
+    got = 0;
+    while ((size_t)got < s->length) {
+      n = pread(reader->fd, s->dest + got, s->length - got, s->offset + got);
+      if(n < 0 && errno == EINTR) {
+	continue;
+      }
+      if(n < 0) {
+	// a failure after a short read, such as a misaligned direct read
+	// past the end of the file, just leaves the read short
+	if(got == 0) {
+	  got = -errno;
+	}
+	break;
+      }
+      if(n == 0) {
+	break;
+      }
+      got += n;
+    }
+
+    pthread_mutex_lock(&(reader->lock));
+    s->result = got;
+    s->done = 1;
+    pthread_cond_broadcast(&(reader->finished));
+  }
+  pthread_mutex_unlock(&(reader->lock));
+  return NULL;
+}
+
+
+static void threadsDestroy(AsyncReader * reader) {
+
+  int t;
+
+  pthread_mutex_lock(&(reader->lock));
+  reader->closing = 1;
+  pthread_cond_broadcast(&(reader->work));
+  pthread_mutex_unlock(&(reader->lock));
+  for(t = 0; t < reader->numthreads; t++) {
+    pthread_join(reader->threads[t], NULL);
+  }
+  pthread_mutex_destroy(&(reader->lock));
+  pthread_cond_destroy(&(reader->work));
+  pthread_cond_destroy(&(reader->finished));
+  free(reader->threads);
+}
+
+
+#else // _WIN32
+
+AsyncReader *asyncread_init(int fd, int depth) {
+
+  (void)fd;
+  (void)depth;
+  errno = ENOSYS;
+  return NULL;
+}
+
+
+int asyncread_submit(AsyncReader * reader, char *dest, long long offset,
+		     size_t length) {
+
+  (void)reader;
+  (void)dest;
+  (void)offset;
+  (void)length;
+  errno = ENOSYS;
+  return -1;
+}
+
+
+long long asyncread_wait(AsyncReader * reader) {
+
+  (void)reader;
+  errno = ENOSYS;
+  return -1;
+}
+
+
+void asyncread_destroy(AsyncReader * reader) {
+
+  (void)reader;
+}
+
+
+const char *asyncread_method(AsyncReader * reader) {
+
+  (void)reader;
+  return "none";
+}
+
+
+int asyncread_open_direct(const char *path) {
+
+  (void)path;
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif // _WIN32
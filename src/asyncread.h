@@ -0,0 +1,83 @@
+// Scalpel Copyright (C) 2005-11 by Golden G. Richard III and
+// 2007-11 by Vico Marziale.
+// Written by Golden G. Richard III and Vico Marziale.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+//
+// Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+// on Foremost.  Foremost 0.69 was used as the starting point for
+// Scalpel, in 2005.
+
+
+// Asynchronous positioned reads, so that several reads of an image can
+// be outstanding at once and the device sees a deeper queue than one
+// blocking fread() gives it.  Reads are submitted with
+// asyncread_submit() and collected with asyncread_wait(), which always
+// returns the result of the oldest outstanding read, so completions are
+// handed back in submission order no matter what order the device
+// finishes them in.
+//
+// On Linux, reads are issued through an io_uring.  Where io_uring isn't
+// available (older kernels, or a sandbox that forbids it), a pool of
+// threads issues blocking pread() calls instead.  Neither kind of
+// reader is available on Windows.
+//
+// A file opened with asyncread_open_direct() bypasses the page cache
+// (O_DIRECT).  Reads of it must start at offsets, and into addresses,
+// that are multiples of ASYNCREAD_ALIGNMENT, and must be a multiple of
+// ASYNCREAD_ALIGNMENT bytes long.
+
+#ifndef ASYNCREAD_H
+#define ASYNCREAD_H
+
+#include <stddef.h>
+
+// alignment for direct reads, which covers 512-byte and 4K-sector
+// devices
+#define ASYNCREAD_ALIGNMENT         4096
+
+// largest number of outstanding reads
+#define ASYNCREAD_MAX_DEPTH         256
+
+typedef struct AsyncReader AsyncReader;
+
+// Create a reader that keeps up to 'depth' reads of the open file
+// descriptor 'fd' outstanding.  Returns NULL if no reader could be
+// created.
+AsyncReader *asyncread_init(int fd, int depth);
+
+// Start reading 'length' bytes at 'offset' into 'dest'.  At most
+// 'depth' reads may be outstanding.  Returns 0, or -1 on error.
+int asyncread_submit(AsyncReader * reader, char *dest, long long offset,
+		     size_t length);
+
+// Wait for the oldest outstanding read to finish.  Returns the number of
+// bytes it read, which is short only at the end of the file, or -1 on
+// error, with errno set.
+long long asyncread_wait(AsyncReader * reader);
+
+// Wait for any outstanding reads and free the reader.  Doesn't close
+// the file.
+void asyncread_destroy(AsyncReader * reader);
+
+// "io_uring" or "pread threads", for messages
+const char *asyncread_method(AsyncReader * reader);
+
+// Open 'path' for reading with O_DIRECT.  Returns a file descriptor, or
+// -1 if the file can't be opened that way.
+int asyncread_open_direct(const char *path);
+
+#endif // ASYNCREAD_H
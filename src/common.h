@@ -18,10 +18,11 @@
 #define PETABYTE                  (1024 * TERABYTE)
 #define EXABYTE                   (1024 * PETABYTE)
 
-// SIZE_OF_BUFFER indicates how much data to read from an image file
-// at a time. This size should be a multiple of the maximum cluster size
-// that Scalpel will encounter if "quick" mode is ever used.
-#define SIZE_OF_BUFFER            (10 * MEGABYTE)
+// DEFAULT_SIZE_OF_BUFFER indicates how much data to read from an image
+// file at a time, unless --buffer-size or --auto-tune is given. This
+// size should be a multiple of the maximum cluster size that Scalpel
+// will encounter if "quick" mode is ever used.
+#define DEFAULT_SIZE_OF_BUFFER    (10 * MEGABYTE)
 
 // The maximum number of patterns of the maximal length the GPU will currently
 // support. Requires statically allocated structures.
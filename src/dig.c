@@ -28,15 +28,32 @@
 /////////// GLOBALS ////////////
 
 static char *readbuffer;	// Read buffer--process image files in 
-                                // SIZE_OF_BUFFER-size chunks.
+                                // buffer-sized chunks.
 
-// Info needed for each of above SIZE_OF_BUFFER chunks.
+// Info needed for each of above buffer-sized chunks.
 typedef struct readbuf_info {
   long long bytesread;		// number of bytes in this buf
   long long beginreadpos;	// position in the image
-  char *readbuf;		// pointer SIZE_OF_BUFFER array
+  long long carried;		// bytes at the start copied from the end
+				// of the previous buffer
+  char *readbuf;		// pointer to buffer-sized array
+  char *store;			// the buffer's own array; readbuf points
+				// into 'window' instead while it's mapped
+  MappedWindow window;		// for a mapped image, the mapped window
+  int hole;			// does the whole buffer lie in a hole of a
+				// sparse image?
 } readbuf_info;
 
+static readbuf_info *readbuf_store;	// all of the read buffers
+static int mapinput;		// is the current image mapped (--mmap)?
+static int streaminput;		// is the current image a stream, such as
+				// standard input, that can be read once?
+static long long streamsize;	// with streaminput, the bytes read from the
+				// image, once it has ended
+static ImageHoles imageholes;	// holes in the current image, if it's
+				// sparse, which aren't read
+static int zeroneedles;		// can a fixed-string needle match zeroes?
+
 
 // queues to facilitiate async reads, concurrent cpu, gpu work
 syncqueue_t *full_readbuf;	// que of full buffers read from image
@@ -61,48 +78,137 @@ char locallookup_footers[LOOKUP_ROWS][LOOKUP_COLUMNS];	// footer lookup table
 #ifdef MULTICORE_THREADING
 // Multi-core only threading globals
 
-// Parameters to threads under the MULTICORE_THREADING model, to allow
-// efficient header/footer searches.
-typedef struct ThreadFindAllParams {
-  int id;
-  char *str;
-  size_t length;
-  char *startpos;
-  long offset;
-  char **foundat;
-  size_t *foundatlens;
-  int strisRE;
-  union {
-    size_t *table;
-    regex_t *regex;
-  };
-  int casesensitive;
-  int nosearchoverlap;
+// Pass 1 searches are divided into tasks for the search thread pool.
+// Each buffer is split into slices, and each slice is searched by one
+// task for all fixed-string needles (using the multi-pattern search)
+// and by one task per regular expression needle, so that the thread
+// pool stays busy no matter how many file types are being carved.
+typedef struct SearchTask {
   struct scalpelState *state;
-} ThreadFindAllParams;
+  char *buf;			// buffer being searched
+  regex_t *regex;		// regular expression needle, or 0 for the
+				// multi-pattern fixed-string search
+  MultiSearch *search;		// multi-pattern search for fixed strings
+  int aligned;			// test aligned fixed-string headers instead
+				// of the multi-pattern search?
+  RegexLiteral *literal;	// literal required by the regular expression
+  int rule;			// file type of the regular expression needle
+  int kind;			// MULTISEARCH_HEADER or MULTISEARCH_FOOTER
+  size_t from, to;		// matches must begin in [from, to)
+  size_t buflen;		// length of the buffer
+  RegexStream *stream;		// streaming DFA search for the regular
+				// expression, covering the whole buffer, or 0
+  unsigned long long origin;	// image position hit offsets are relative to
+  MultiSearchHits hits;		// matches discovered by the task
+} SearchTask;
+
+// A buffer of the image being searched by the thread pool.  Several
+// buffers are searched at once, but their matches are digested in the
+// order the buffers were read, so the offsets database stays sorted.
+typedef struct SearchBuffer {
+  readbuf_info *rinfo;
+  workpool_group_t group;	// search tasks for the buffer
+  SearchTask *tasks;
+  int numtasks;
+  int taskstorage;
+} SearchBuffer;
+
+// Ranges of image positions where footers for a file type can be used
+// by the carve planner: the union of the windows [header, header +
+// maximum carve size] of the type's live headers, clipped to the part
+// of the image being digested.  Footers outside them are neither
+// searched for by Tre nor recorded.
+typedef struct FooterWindow {
+  unsigned long long begin, end;	// inclusive
+} FooterWindow;
+
+// windows of the image being searched for a file type's footers while
+// carving, with --defer-footers
+typedef struct FooterBatch {
+  SearchBuffer sb;		// search tasks for the windows
+  MultiSearch search;		// the type's footer, if it's a fixed string
+  FILE *infile;
+  int needlenum;
+  size_t tail;			// bytes read past the end of each window
+  size_t used;			// bytes of the read buffer holding windows
+} FooterBatch;
+
+typedef struct FooterWindows {
+  FooterWindow *windows;	// in ascending order
+  size_t numwindows;
+  size_t storage;
+  size_t next;			// first window that may hold the next footer
+} FooterWindows;
 
 // TODO:  These structures could be released after the dig phase; they aren't needed in the carving phase since it's not
 // threaded.  Look into this in the future.
 
-static pthread_t *searchthreads;	// thread pool for header/footer searches
-static ThreadFindAllParams *threadargs;	// argument structures for threads
-static char ***foundat;		// locations of headers/footers discovered by threads    
-static size_t **foundatlens;	// lengths of discovered headers/footers
-//static sem_t *workavailable;	// semaphores that block threads until 
-// header/footer searches are required
-static pthread_mutex_t *workavailable;
-//static sem_t *workcomplete;	// semaphores that allow main thread to wait
-// for all search threads to complete current job
-static pthread_mutex_t *workcomplete;
+static workpool_t *searchpool;	// thread pool for header/footer searches
+static SearchBuffer *searchbuffers;	// ring of buffers being searched
+static SearchBuffer *digestbuffer;	// searched buffer to be digested by
+					// digBuffer()
+// for "-r", image position where the next match for each file type may
+// begin
+static unsigned long long *nextsearchpos;
+// live footer windows for each file type
+static FooterWindows *footerwindows;
+// streaming DFA searches for regular expression needles, indexed by
+// 2 * file type + MULTISEARCH_HEADER or MULTISEARCH_FOOTER.  A stream's
+// state is carried from one buffer to the next, so a buffer's stream
+// tasks are only submitted once the previous buffer has been searched.
+static RegexStream *regexstreams;
+
+// In single-pass mode, carves are decided during pass 1, as soon as
+// every header and footer they depend on has been digested, and
+// written from a ring of recently read buffers.  Parts of carves still
+// undecided when their data leaves the ring are written early.  File
+// numbers depend on the carves of all file types, so carved files get
+// temporary names until carveImageFile() has planned every carve.
+typedef struct RetainedBuffer {
+  char *data;
+  unsigned long long begin;	// image position of data[0]
+  size_t length;
+} RetainedBuffer;
+
+// carve decided during pass 1 in single-pass mode
+typedef struct CapturedCarve {
+  unsigned long long header;	// index of the carve's header
+  unsigned long long start, stop;
+  int placed;			// matched by carveImageFile()?
+} CapturedCarve;
+
+// single-pass carving progress for a file type
+typedef struct CaptureState {
+  unsigned long long nextheader;	// first header without a decision
+  unsigned long long prevstopindex;	// carve planner state at nextheader
+  CapturedCarve *carves;	// in ascending header order
+  size_t numcarves;
+  size_t storage;
+  size_t next;			// first carve carveImageFile() hasn't
+				// looked at
+} CaptureState;
+
+static RetainedBuffer *retained;	// ring of buffers kept for carving
+static int numretained, maxretained, oldestretained;
+// image data before this position has left the ring
+static unsigned long long evicted;
+static CaptureState *captures;	// indexed by file type, or 0
+static long long captureimagesize;
 
 #endif
 
+// temporary file for runs of the header/footer database spilled under
+// --hfd-memory-limit.  It's created when the limit is first reached.
+static OffsetSpill hfdspill;
+
 // prototypes for private dig.c functions
 static unsigned long long adjustForEmbedding(struct SearchSpecLine
 					     *currentneedle,
 					     unsigned long long headerindex,
 					     unsigned long long *prevstopindex);
 static int writeHeaderFooterDatabase(struct scalpelState *state);
+static int limitHeaderFooterDatabase(struct scalpelState *state);
+static void removeHeaderFooterSpill(void);
 static int setupCoverageMaps(struct scalpelState *state,
 			     unsigned long long filesize);
 static int auditUpdateCoverageBlockmap(struct scalpelState *state,
@@ -121,18 +227,89 @@ static int fseeko_use_coverage_map(struct scalpelState *state, FILE * fp,
 static off64_t ftello_use_coverage_map(struct scalpelState *state, FILE * fp);
 static size_t fread_use_coverage_map(struct scalpelState *state, void *ptr,
 				     size_t size, size_t nmemb, FILE * stream);
+static long long fillReadBuffer(struct scalpelState *state,
+				readbuf_info * rinfo, char *carry,
+				long long carried, long long imageend);
+static void unmapReadBuffers(struct scalpelState *state);
+static int readImageAsync(struct scalpelState *state, long long filebegin,
+			  long long filesize, int longestneedle,
+			  char *carry);
 static void printhex(char *s, int len);
 static void clean_up(struct scalpelState *state, int signum);
-static int displayPosition(int *units,
+static int displayPosition(struct scalpelState *state, int *units,
 			   unsigned long long pos,
 			   unsigned long long size, char *fn);
 static int setupAuditFile(struct scalpelState *state);
 static int digBuffer(struct scalpelState *state,
 		     unsigned long long lengthofbuf,
 		     unsigned long long offset);
+static void recordHeader(struct scalpelState *state,
+			 struct SearchSpecLine *currentneedle,
+			 unsigned long long location, size_t length);
+static void recordFooter(struct scalpelState *state,
+			 struct SearchSpecLine *currentneedle,
+			 unsigned long long location, size_t length);
+static long long planCarve(struct scalpelState *state,
+			   struct SearchSpecLine *currentneedle,
+			   unsigned long long i,
+			   unsigned long long *prevstopindex,
+			   long long filesize, char *chopped);
+static int headerIsAligned(struct SearchSpecLine *currentneedle,
+			   unsigned long long location);
+static int needleMatchesZeroes(char *needle, int length);
 #ifdef MULTICORE_THREADING
-static void *threadedFindAll(void *args);
+static size_t searchSliceSize(size_t lengthofbuf);
+static SearchTask *newSearchTask(struct scalpelState *state,
+				 SearchBuffer * sb, regex_t * regex,
+				 int rule, int kind, size_t from, size_t to);
+static void searchBuffer(struct scalpelState *state, SearchBuffer * sb,
+			 readbuf_info * rinfo);
+static void submitStreamTasks(SearchBuffer * sb);
+static void findFooterWindows(struct scalpelState *state, int needlenum,
+			      unsigned long long first,
+			      unsigned long long last);
+static void addFooterWindow(struct scalpelState *state, FooterWindows * fw,
+			    unsigned long long begin, unsigned long long end);
+static int footerIsLive(FooterWindows * fw, unsigned long long location);
+static int searchFooterWindows(struct scalpelState *state,
+			       SearchBuffer * sb);
+static int resolveDeferredFooters(struct scalpelState *state, FILE * infile,
+				  int needlenum);
+static int readFooterWindow(struct scalpelState *state, FooterBatch * batch,
+			    unsigned long long begin, unsigned long long end);
+static void searchFooterBatch(struct scalpelState *state,
+			      FooterBatch * batch);
+static void flushRegexStreams(struct scalpelState *state);
+static void runSearchTask(void *arg, int worker);
+static void searchAlignedHeaders(SearchTask * task);
+static void addSearchHit(SearchTask * task, size_t pos, size_t length);
+static int findRegexMatch(SearchTask * task, size_t pos, size_t end,
+			  regmatch_t * match);
+static void digestSearchHits(struct scalpelState *state, SearchBuffer * sb,
+			     int kind);
+static void initCapture(struct scalpelState *state, long long filesize);
+static int retainBuffer(struct scalpelState *state, char *buf,
+			unsigned long long length, unsigned long long offset);
+static int spillRetainedBuffer(struct scalpelState *state);
+static int decideCarves(struct scalpelState *state,
+			unsigned long long frontier, int endofimage);
+static int writeCapturedCarve(struct scalpelState *state, int needlenum,
+			      unsigned long long start, long long stop);
+static int writeRetained(FILE * fp, unsigned long long from,
+			 unsigned long long to);
+static void captureFileName(struct scalpelState *state, char *fn,
+			    int needlenum, unsigned long long header);
+static int finishCapture(struct scalpelState *state);
+static char *capturedCarveFile(struct scalpelState *state, int needlenum,
+			       unsigned long long header,
+			       unsigned long long start,
+			       unsigned long long stop);
+static void removeCapturedCarves(struct scalpelState *state);
 #endif
+static int placeCarvedFiles(struct scalpelState *state, FILE * infile,
+			    Queue * carvelists, unsigned long long numlists);
+static int extractCarve(struct scalpelState *state, FILE * infile,
+			struct CarveInfo *carve);
 
 
 // force header/footer matching to deal with embedded headers/footers
@@ -141,19 +318,22 @@ adjustForEmbedding(struct SearchSpecLine *currentneedle,
 		   unsigned long long headerindex,
 		   unsigned long long *prevstopindex) {
 
+  OffsetList *headers = &(currentneedle->offsets.headers);
+  OffsetList *footers = &(currentneedle->offsets.footers);
   unsigned long long h = headerindex + 1;
   unsigned long long f = 0;
   int header = 0;
   int footer = 0;
   long long headerstack = 0;
-  unsigned long long start = currentneedle->offsets.headers[headerindex] + 1;
+  unsigned long long start = offsets_position(headers, headerindex) + 1;
   unsigned long long candidatefooter;
+  unsigned long long candidate;
   int morecandidates = 1;
   int moretests = 1;
 
   // skip footers which precede header
-  while (*prevstopindex < currentneedle->offsets.numfooters &&
-	 currentneedle->offsets.footers[*prevstopindex] < start) {
+  while (*prevstopindex < footers->count &&
+	 offsets_position(footers, *prevstopindex) < start) {
     (*prevstopindex)++;
   }
 
@@ -161,33 +341,31 @@ adjustForEmbedding(struct SearchSpecLine *currentneedle,
   candidatefooter = *prevstopindex;
 
   // skip footers until header/footer count balances
-  while (candidatefooter < currentneedle->offsets.numfooters && morecandidates) {
+  while (candidatefooter < footers->count && morecandidates) {
     // see if this footer is viable
     morecandidates = 0;		// assumption is yes, viable
     moretests = 1;
-    while (moretests && start < currentneedle->offsets.footers[candidatefooter]) {
+    candidate = offsets_position(footers, candidatefooter);
+    while (moretests && start < candidate) {
       header = 0;
       footer = 0;
-      if(h < currentneedle->offsets.numheaders
-	 && currentneedle->offsets.headers[h] >= start
-	 && currentneedle->offsets.headers[h] <
-	 currentneedle->offsets.footers[candidatefooter]) {
+      if(h < headers->count
+	 && offsets_position(headers, h) >= start
+	 && offsets_position(headers, h) < candidate) {
 	header = 1;
       }
-      if(f < currentneedle->offsets.numfooters
-	 && currentneedle->offsets.footers[f] >= start
-	 && currentneedle->offsets.footers[f] <
-	 currentneedle->offsets.footers[candidatefooter]) {
+      if(f < footers->count
+	 && offsets_position(footers, f) >= start
+	 && offsets_position(footers, f) < candidate) {
 	footer = 1;
       }
 
       if(header && (!footer ||
-		    currentneedle->offsets.headers[h] <
-		    currentneedle->offsets.footers[f])) {
+		    offsets_position(headers, h) <
+		    offsets_position(footers, f))) {
 	h++;
 	headerstack++;
-	start = (h < currentneedle->offsets.numheaders)
-	  ? currentneedle->offsets.headers[h] : start + 1;
+	start = (h < headers->count) ? offsets_position(headers, h) : start + 1;
       }
       else if(footer) {
 	f++;
@@ -195,8 +373,7 @@ adjustForEmbedding(struct SearchSpecLine *currentneedle,
 	if(headerstack < 0) {
 	  headerstack = 0;
 	}
-	start = (f < currentneedle->offsets.numfooters)
-	  ? currentneedle->offsets.footers[f] : start + 1;
+	start = (f < footers->count) ? offsets_position(footers, f) : start + 1;
       }
       else {
 	moretests = 0;
@@ -238,9 +415,10 @@ static void clean_up(struct scalpelState *state, int signum) {
 
 
 
-// display progress bar
+// display progress bar.  A 'size' of 0 means the size of the image
+// isn't known.
 static int
-displayPosition(int *units,
+displayPosition(struct scalpelState *state, int *units,
 		unsigned long long pos, unsigned long long size, char *fn) {
 
   double percentDone = (((double)pos) / (double)(size) * 100);
@@ -266,7 +444,7 @@ displayPosition(int *units,
   // get current time and remember start time when first chunk of 
   // an image file is read
 
-  if(pos <= SIZE_OF_BUFFER) {
+  if(pos <= state->bufferSize) {
     gettimeofday(&start, (struct timezone *)0);
   }
   gettimeofday(&now, (struct timezone *)0);
@@ -311,6 +489,25 @@ displayPosition(int *units,
     return SCALPEL_OK;
   }
 
+#ifdef _WIN32
+  elapsed =
+    ((double)now.QuadPart - (double)start.QuadPart) / ((double)freq.QuadPart);
+  //printf("elapsed: %f\n",elapsed);
+#else
+  timersub(&now, &start, &td);
+  elapsed = td.tv_sec + (td.tv_usec / 1000000.0);
+#endif
+
+  // the size of a stream isn't known until it ends, so there's no bar or
+  // ETA, just how much has been read and how quickly
+  if(size == 0) {
+    snprintf(line, sizeof(line), "\r%s: %6.1f %s read, %6.1f MB/s", fn,
+	     position, buf, elapsed > 0 ? pos / elapsed / MEGABYTE : 0.0);
+    fprintf(stdout, "%s", line);
+    fflush(stdout);
+    return SCALPEL_OK;
+  }
+
   len = 0;
   len +=
     snprintf(line + len, sizeof(line) - len, "\r%s: %5.1f%% ", fn, percentDone);
@@ -325,14 +522,6 @@ displayPosition(int *units,
 
   len += snprintf(line + len, sizeof(line) - len, " %6.1f %s", position, buf);
 
-#ifdef _WIN32
-  elapsed =
-    ((double)now.QuadPart - (double)start.QuadPart) / ((double)freq.QuadPart);
-  //printf("elapsed: %f\n",elapsed);
-#else
-  timersub(&now, &start, &td);
-  elapsed = td.tv_sec + (td.tv_usec / 1000000.0);
-#endif
   remaining = (long)((100 - percentDone) / percentDone * elapsed);
   //printf("Ratio remaining: %f\n",(100-percentDone)/percentDone);
   //printf("Elapsed time: %f\n",elapsed);
@@ -363,13 +552,42 @@ static int setupAuditFile(struct scalpelState *state) {
 
   char imageFile[MAX_STRING_LENGTH];
 
-  if(realpath(state->imagefile, imageFile)) {
+  if(strcmp(state->imagefile, SCALPEL_STDIN_IMAGE) == 0) {
+    scalpelLog(state, "\nOpening target \"standard input\"\n\n");
+  }
+  else if(realpath(state->imagefile, imageFile)) {
     scalpelLog(state, "\nOpening target \"%s\"\n\n", imageFile);
   }
   else {
     //handleError(state, SCALPEL_ERROR_FILE_OPEN);
     return SCALPEL_ERROR_FILE_OPEN;
   }
+
+  // list the segments of a split image, so that the offsets of carved
+  // files can be traced back to them
+  if(state->imageSegments > 0) {
+    struct stat info;
+    unsigned long long start = 0;
+    int i;
+
+    fprintf(state->auditFile, "Split image of %d segments:\n",
+	    state->imageSegments);
+    for(i = 0; i < state->imageSegments; i++) {
+      if(segments_name(state->imagefile, i, imageFile, MAX_STRING_LENGTH) ||
+	 stat(imageFile, &info)) {
+	return SCALPEL_ERROR_FILE_OPEN;
+      }
+#ifdef _WIN32
+      fprintf(state->auditFile, "%s\tstarts at %I64u\n",
+	      base_name(imageFile), start);
+#else
+      fprintf(state->auditFile, "%s\tstarts at %llu\n",
+	      base_name(imageFile), start);
+#endif
+      start += info.st_size;
+    }
+    fprintf(state->auditFile, "\n");
+  }
   
 #ifdef _WIN32
   if(state->skip) {
@@ -400,457 +618,1443 @@ static int setupAuditFile(struct scalpelState *state) {
 
 
 
-static int
-digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
-	  unsigned long long offset) {
-
-  unsigned long long startLocation = 0;
-  int needlenum, i = 0;
-  struct SearchSpecLine *currentneedle = 0;
-//  gettimeofday_t srchnow, srchthen;
-
-  // for each file type, find all headers and some (or all) footers
-
-  // signal check
-  if(signal_caught == SIGTERM || signal_caught == SIGINT) {
-    clean_up(state, signal_caught);
-  }
-
-
-  ///////////////////////////////////////////////////
-  ///////////////////////////////////////////////////
-  ////////////////GPU-based SEARCH///////////////////
-  ///////////////////////////////////////////////////
-  ///////////////////////////////////////////////////
-#ifdef GPU_THREADING		// code for searches on GPUs
-
-
-  // BUG (GGRIII): GPU MODEL DOES NOT SUPPORT REGULAR EXPRESSIONS
-  // (LMIII): NOR WILL IT EVER.  
-  // GGRIII: let's not be hasty.  :)
-
-  // In GPU mode, the needle search has already been done. readbuffer now holds
-  // the encoded results, which must be decoded into scalpel structures.         
-
-  // Each needle found is encoded in 2 bytes, one for the <type and one for position in buffer?>
-
-    int longestneedle = findLongestNeedle(state->SearchSpec);
-  
-  // Compute the size of the results buffer.      
-  int result_chunks = (lengthofbuf / (THREADS_PER_BLOCK - longestneedle)) + 1;
-  int result_length = result_chunks * RESULTS_SIZE_PER_BLOCK;
-
-  // Decode the results from the gpu.
-  int d = 0;
-  for(d = 0; d < result_length; d += 2) {
-    i = (d / RESULTS_SIZE_PER_BLOCK) * (THREADS_PER_BLOCK - longestneedle) +
-      (unsigned char)(readbuffer[d + 1]);
-    if(readbuffer[d] > 0) {
-
-      needlenum = readbuffer[d] - 1;
-      currentneedle = &(state->SearchSpec[needlenum]);
-      startLocation = offset + i;
+// record location of a header in the header offsets database
+static void
+recordHeader(struct scalpelState *state, struct SearchSpecLine *currentneedle,
+	     unsigned long long location, size_t length) {
 
-      // found a header--record location in header offsets database
-      if(state->modeVerbose) {
+  if(state->modeVerbose) {
 #ifdef _WIN32
-	fprintf(stdout, "A %s header was found at : %I64u\n",
-		currentneedle->suffix,
-		positionUseCoverageBlockmap(state, startLocation));
+    fprintf(stdout, "A %s header was found at : %I64u\n",
+	    currentneedle->suffix,
+	    positionUseCoverageBlockmap(state, location));
 #else
-	fprintf(stdout, "A %s header was found at : %llu\n",
-		currentneedle->suffix,
-		positionUseCoverageBlockmap(state, startLocation));
+    fprintf(stdout, "A %s header was found at : %llu\n",
+	    currentneedle->suffix,
+	    positionUseCoverageBlockmap(state, location));
 #endif
-      }
+  }
 
-      currentneedle->offsets.numheaders++;
-      if(currentneedle->offsets.headerstorage <=
-	 currentneedle->offsets.numheaders) {
-	// need more memory for header offset storage--add an
-	// additional 100 elements              
-	currentneedle->offsets.headers = (unsigned long long *)
-	  realloc(currentneedle->offsets.headers,
-		  sizeof(unsigned long long) *
-		  (currentneedle->offsets.numheaders + 100));
-
-
-	checkMemoryAllocation(state, currentneedle->offsets.headers,
-			      __LINE__, __FILE__, "header array");
-	// inserted
-	currentneedle->offsets.headerlens = (size_t *)
-	  realloc(currentneedle->offsets.headerlens, sizeof(size_t) *
-		  (currentneedle->offsets.numheaders + 100));
-	checkMemoryAllocation(state, currentneedle->offsets.headerlens,
-			      __LINE__, __FILE__, "header array");
-	currentneedle->offsets.headerstorage =
-	  currentneedle->offsets.numheaders + 100;
-
-	if(state->modeVerbose) {
+  if(offsets_append(state, &(currentneedle->offsets.headers), location,
+		     length) && state->modeVerbose) {
 #ifdef _WIN32
-	  fprintf(stdout,
-		  "Memory reallocation performed, total header storage = %I64u\n",
-		  currentneedle->offsets.headerstorage);
+    fprintf(stdout,
+	    "Memory reallocation performed, total header storage = %I64u bytes\n",
+	    currentneedle->offsets.headers.storage);
 #else
-	  fprintf(stdout,
-		  "-->>Memory reallocation performed, total header storage = %llu\n",
-		  currentneedle->offsets.headerstorage);
+    fprintf(stdout,
+	    "Memory reallocation performed, total header storage = %llu bytes\n",
+	    currentneedle->offsets.headers.storage);
 #endif
-	}
-      }
-      currentneedle->offsets.headers[currentneedle->offsets.numheaders -
-				     1] = startLocation;
+  }
+}
 
-    }
-    else if(readbuffer[d] < 0) {	// footer
 
-      needlenum = -1 * readbuffer[d] - 1;
-      currentneedle = &(state->SearchSpec[needlenum]);
-      startLocation = offset + i;
-      // found a footer--record location in footer offsets database
-      if(state->modeVerbose) {
+// record location of a footer in the footer offsets database
+static void
+recordFooter(struct scalpelState *state, struct SearchSpecLine *currentneedle,
+	     unsigned long long location, size_t length) {
+
+  if(state->modeVerbose) {
 #ifdef _WIN32
-	fprintf(stdout, "A %s footer was found at : %I64u\n",
-		currentneedle->suffix,
-		positionUseCoverageBlockmap(state, startLocation));
+    fprintf(stdout, "A %s footer was found at : %I64u\n",
+	    currentneedle->suffix,
+	    positionUseCoverageBlockmap(state, location));
 #else
-	fprintf(stdout, "A %s footer was found at : %llu\n",
-		currentneedle->suffix,
-		positionUseCoverageBlockmap(state, startLocation));
+    fprintf(stdout, "A %s footer was found at : %llu\n",
+	    currentneedle->suffix,
+	    positionUseCoverageBlockmap(state, location));
 #endif
-      }
+  }
 
-      currentneedle->offsets.numfooters++;
-      if(currentneedle->offsets.footerstorage <=
-	 currentneedle->offsets.numfooters) {
-	// need more memory for footer offset storage--add an
-	// additional 100 elements
-	currentneedle->offsets.footers = (unsigned long long *)
-	  realloc(currentneedle->offsets.footers,
-		  sizeof(unsigned long long) *
-		  (currentneedle->offsets.numfooters + 100));
-
-	checkMemoryAllocation(state, currentneedle->offsets.footers,
-			      __LINE__, __FILE__, "footer array");
-	currentneedle->offsets.footerlens =
-	  (size_t *) realloc(currentneedle->offsets.footerlens,
-			     sizeof(size_t) *
-			     (currentneedle->offsets.numfooters + 100));
-	checkMemoryAllocation(state, currentneedle->offsets.footerlens,
-			      __LINE__, __FILE__, "footer array");
-	currentneedle->offsets.footerstorage =
-	  currentneedle->offsets.numfooters + 100;
-
-	if(state->modeVerbose) {
+  if(offsets_append(state, &(currentneedle->offsets.footers), location,
+		     length) && state->modeVerbose) {
 #ifdef _WIN32
-	  fprintf(stdout,
-		  "Memory reallocation performed, total footer storage = %I64u\n",
-		  currentneedle->offsets.footerstorage);
+    fprintf(stdout,
+	    "Memory reallocation performed, total footer storage = %I64u bytes\n",
+	    currentneedle->offsets.footers.storage);
 #else
-	  fprintf(stdout,
-		  "Memory reallocation performed, total footer storage = %llu\n",
-		  currentneedle->offsets.footerstorage);
+    fprintf(stdout,
+	    "Memory reallocation performed, total footer storage = %llu bytes\n",
+	    currentneedle->offsets.footers.storage);
 #endif
-	}
-      }
-      currentneedle->offsets.footers[currentneedle->offsets.numfooters -
-				     1] = startLocation;
-
-    }
   }
+}
 
-#endif
-  ///////////////////////////////////////////////////
-  ///////////////////////////////////////////////////
-  ////////////////END GPU-BASED SEARCH///////////////
-  ///////////////////////////////////////////////////
-  ///////////////////////////////////////////////////
 
+// headers are only kept at multiples of the file type's alignment, if it
+// has one ("-q" or ALIGN= in the configuration file).  Fixed-string
+// headers are only searched for there; matches for regular expressions
+// are filtered.
+static int
+headerIsAligned(struct SearchSpecLine *currentneedle,
+		unsigned long long location) {
+
+  return !currentneedle->alignment ||
+    location % currentneedle->alignment == 0;
+}
 
 
-  ///////////////////////////////////////////////////
-  ///////////////////////////////////////////////////
-  ///////////////MULTI-THREADED SEARCH //////////////
-  ///////////////////////////////////////////////////
-  ///////////////////////////////////////////////////
 #ifdef MULTICORE_THREADING
 
-  // as of v1.9, this is now the lowest common denominator mode
-  
-  // ---------------- threaded header search ------------------ //
-  // ---------------- threaded header search ------------------ //
-  
-  //  gettimeofday(&srchthen, 0);
-  if(state->modeVerbose) {
-    printf("Waking up threads for header searches.\n");
-  }
-  for(needlenum = 0; needlenum < state->specLines; needlenum++) {
-    currentneedle = &(state->SearchSpec[needlenum]);
-    // # of matches in last element of foundat array
-    foundat[needlenum][MAX_MATCHES_PER_BUFFER] = 0;
-    threadargs[needlenum].id = needlenum;
-    threadargs[needlenum].str = currentneedle->begin;
-    threadargs[needlenum].length = currentneedle->beginlength;
-    threadargs[needlenum].startpos = readbuffer;
-    threadargs[needlenum].offset = (long)readbuffer + lengthofbuf;
-    threadargs[needlenum].foundat = foundat[needlenum];
-    threadargs[needlenum].foundatlens = foundatlens[needlenum];
-    threadargs[needlenum].strisRE = currentneedle->beginisRE;
-    if(currentneedle->beginisRE) {
-      threadargs[needlenum].regex = &(currentneedle->beginstate.re);
-    }
-    else {
-      threadargs[needlenum].table = currentneedle->beginstate.bm_table;
-    }
-    threadargs[needlenum].casesensitive = currentneedle->casesensitive;
-    threadargs[needlenum].nosearchoverlap = state->noSearchOverlap;
-    threadargs[needlenum].state = state;
+// add a task to the search tasks for a buffer.  Hit storage from
+// previous buffers is reused.
+static SearchTask *
+newSearchTask(struct scalpelState *state, SearchBuffer * sb, regex_t * regex,
+	      int rule, int kind, size_t from, size_t to) {
 
-    // unblock thread
-    //    sem_post(&workavailable[needlenum]);
+  SearchTask *task;
+  int i;
 
-    pthread_mutex_unlock(&workavailable[needlenum]);
+  if(sb->numtasks == sb->taskstorage) {
+    sb->tasks = (SearchTask *)
+      realloc(sb->tasks, (sb->taskstorage + 64) * sizeof(SearchTask));
+    checkMemoryAllocation(state, sb->tasks, __LINE__, __FILE__,
+			  "search tasks");
+    for(i = sb->taskstorage; i < sb->taskstorage + 64; i++) {
+      multisearch_hits_init(&(sb->tasks[i].hits));
+    }
+    sb->taskstorage += 64;
+  }
 
+  task = &(sb->tasks[sb->numtasks++]);
+  task->state = state;
+  task->buf = sb->rinfo->readbuf;
+  task->regex = regex;
+  task->search = &(state->literalsearch);
+  task->aligned = FALSE;
+  task->literal = 0;
+  if(regex) {
+    task->literal = kind == MULTISEARCH_HEADER ?
+      state->SearchSpec[rule].beginliteral :
+      state->SearchSpec[rule].endliteral;
   }
+  task->rule = rule;
+  task->kind = kind;
+  task->from = from;
+  task->to = to;
+  task->buflen = sb->rinfo->bytesread;
+  task->stream = 0;
+  task->origin = sb->rinfo->beginreadpos;
+  multisearch_hits_reset(&(task->hits));
+  return task;
+}
 
-  // ---------- thread group synchronization point ----------- //
-  // ---------- thread group synchronization point ----------- //
 
-  if(state->modeVerbose) {
-    printf("Waiting for thread group synchronization.\n");
+// size of the slices buffers are split into for searching, so that
+// every search thread gets a few slices
+static size_t searchSliceSize(size_t lengthofbuf) {
+
+  size_t slicesize;
+
+  slicesize =
+    lengthofbuf / (searchpool->numworkers * SEARCH_SLICES_PER_THREAD) + 1;
+  if(slicesize < MIN_SEARCH_SLICE_SIZE) {
+    slicesize = MIN_SEARCH_SLICE_SIZE;
   }
+  return slicesize;
+}
 
-  // wait for all threads to complete header search before proceeding
-  for(needlenum = 0; needlenum < state->specLines; needlenum++) {
-    //    sem_wait(&workcomplete[needlenum]);
 
-    pthread_mutex_lock(&workcomplete[needlenum]);
+// Split a newly read buffer into slices and hand the searches for
+// the slices to the thread pool.  For each slice, one task finds
+// fixed-string headers and footers for all file types together, using
+// the multi-pattern search, and one task per file type searches for each
+// regular expression header.  Fixed-string headers that must
+// be aligned are tested at the aligned offsets of the slice by one more
+// task.  Headers and footers are found in
+// a single sweep over the buffer.  Regular expressions with streaming
+// DFAs are searched for by one task for the whole buffer, submitted by
+// submitStreamTasks().  Regular expression footers without streaming
+// DFAs are only searched for near live headers, once the buffer's
+// headers are known, by searchFooterWindows().  The matches are
+// digested by digBuffer().
+static void
+searchBuffer(struct scalpelState *state, SearchBuffer * sb,
+	     readbuf_info * rinfo) {
 
-  }
+  struct SearchSpecLine *currentneedle;
+  size_t lengthofbuf = rinfo->bytesread;
+  size_t slicesize, from, to;
+  int needlenum, i, alignedheaders = FALSE, literals;
 
   if(state->modeVerbose) {
-    printf("Thread group synchronization complete.\n");
+    printf("Waking up threads for header and footer searches.\n");
   }
 
-  // digest header locations discovered by the thread group
-
   for(needlenum = 0; needlenum < state->specLines; needlenum++) {
     currentneedle = &(state->SearchSpec[needlenum]);
+    if(currentneedle->alignment && !currentneedle->beginisRE &&
+       currentneedle->beginlength > 0) {
+      alignedheaders = TRUE;
+    }
+  }
 
-    // number of matches stored in last element of vector
-    for(i = 0; i < (long)foundat[needlenum][MAX_MATCHES_PER_BUFFER]; i++) {
-      startLocation = offset + (foundat[needlenum][i] - readbuffer);
-      // found a header--record location in header offsets database
-      if(state->modeVerbose) {
-#ifdef _WIN32
-	fprintf(stdout, "A %s header was found at : %I64u\n",
-		currentneedle->suffix,
-		positionUseCoverageBlockmap(state, startLocation));
-#else
-	fprintf(stdout, "A %s header was found at : %llu\n",
-		currentneedle->suffix,
-		positionUseCoverageBlockmap(state, startLocation));
-#endif
-      }
+  sb->rinfo = rinfo;
+  sb->numtasks = 0;
+  workpool_group_init(&(sb->group));
 
-      currentneedle->offsets.numheaders++;
-      if(currentneedle->offsets.headerstorage <=
-	 currentneedle->offsets.numheaders) {
-	// need more memory for header offset storage--add an
-	// additional 100 elements
-	currentneedle->offsets.headers = (unsigned long long *)
-	  realloc(currentneedle->offsets.headers,
-		  sizeof(unsigned long long) *
-		  (currentneedle->offsets.numheaders + 100));
-	checkMemoryAllocation(state, currentneedle->offsets.headers,
-			      __LINE__, __FILE__, "header array");
-	currentneedle->offsets.headerlens =
-	  (size_t *) realloc(currentneedle->offsets.headerlens,
-			     sizeof(size_t) *
-			     (currentneedle->offsets.numheaders + 100));
-	checkMemoryAllocation(state, currentneedle->offsets.headerlens,
-			      __LINE__, __FILE__, "header array");
-
-	currentneedle->offsets.headerstorage =
-	  currentneedle->offsets.numheaders + 100;
-
-	if(state->modeVerbose) {
-#ifdef _WIN32
-	  fprintf(stdout,
-		  "Memory reallocation performed, total header storage = %I64u\n",
-		  currentneedle->offsets.headerstorage);
-#else
-	  fprintf(stdout,
-		  "Memory reallocation performed, total header storage = %llu\n",
-		  currentneedle->offsets.headerstorage);
-#endif
-	}
+  // a buffer of zeroes from a hole can't hold fixed-string headers or
+  // footers, unless some are made of zeroes and wildcards
+  literals = !rinfo->hole || zeroneedles;
+
+  slicesize = searchSliceSize(lengthofbuf);
+  for(from = 0; from < lengthofbuf; from += slicesize) {
+    to = from + slicesize < lengthofbuf ? from + slicesize : lengthofbuf;
+    if(literals && state->literalsearch.numpatterns > 0) {
+      newSearchTask(state, sb, 0, -1, MULTISEARCH_HEADER, from, to);
+    }
+    if(literals && alignedheaders) {
+      newSearchTask(state, sb, 0, -1, MULTISEARCH_HEADER, from,
+		    to)->aligned = TRUE;
+    }
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+      currentneedle = &(state->SearchSpec[needlenum]);
+      if(currentneedle->beginisRE && !currentneedle->begindfa) {
+	newSearchTask(state, sb, &(currentneedle->beginstate.re), needlenum,
+		      MULTISEARCH_HEADER, from, to);
       }
-      currentneedle->offsets.headers[currentneedle->offsets.numheaders -
-				     1] = startLocation;
-      currentneedle->offsets.headerlens[currentneedle->offsets.
-					numheaders - 1] =
-	foundatlens[needlenum][i];
     }
   }
 
+  for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+    currentneedle = &(state->SearchSpec[needlenum]);
+    if(currentneedle->begindfa) {
+      newSearchTask(state, sb, &(currentneedle->beginstate.re), needlenum,
+		    MULTISEARCH_HEADER, 0, lengthofbuf)->stream =
+	&(regexstreams[2 * needlenum + MULTISEARCH_HEADER]);
+    }
+    if(currentneedle->enddfa && !state->deferFooters) {
+      newSearchTask(state, sb, &(currentneedle->endstate.re), needlenum,
+		    MULTISEARCH_FOOTER, 0, lengthofbuf)->stream =
+	&(regexstreams[2 * needlenum + MULTISEARCH_FOOTER]);
+    }
+  }
+
+  // tasks can't be submitted until they're all created, since creating
+  // a task may move the task array
+  for(i = 0; i < sb->numtasks; i++) {
+    if(!sb->tasks[i].stream) {
+      workpool_submit(searchpool, &(sb->group), runSearchTask,
+		      &(sb->tasks[i]));
+    }
+  }
+}
 
-  // ---------------- threaded footer search ------------------ //
-  // ---------------- threaded footer search ------------------ //
 
-  // now footer search, if:
-  //
-  // there's a footer for the file type AND
-  //
-  // (at least one header for that type has been previously seen and 
-  // at least one header is viable--that is, it was found in the current
-  // buffer, or it's less than the max carve distance behind the current
-  // file offset
-  //
-  // OR
-  // 
-  // a header/footer database is being created.  In this case, ALL headers and
-  // footers must be discovered)
+// hand a buffer's streaming DFA searches to the thread pool.  Called
+// once all earlier buffers have been searched.
+static void submitStreamTasks(SearchBuffer * sb) {
 
-  if(state->modeVerbose) {
-    printf("Waking up threads for footer searches.\n");
+  int i;
+
+  for(i = 0; i < sb->numtasks; i++) {
+    if(sb->tasks[i].stream) {
+      workpool_submit(searchpool, &(sb->group), runSearchTask,
+		      &(sb->tasks[i]));
+    }
   }
+}
 
-  for(needlenum = 0; needlenum < state->specLines; needlenum++) {
-    currentneedle = &(state->SearchSpec[needlenum]);
-    if(
-       // regular case--want to search for only "viable" (in the sense that they are
-       // useful for carving unfragmented files) footers, to save time
-       (currentneedle->offsets.numheaders > 0 &&
-	currentneedle->endlength &&
-	(currentneedle->offsets.
-	 headers[currentneedle->offsets.numheaders - 1] > offset
-	 || (offset -
-	     currentneedle->offsets.headers[currentneedle->offsets.
-					    numheaders - 1] <
-	     currentneedle->length))) ||
-       // generating header/footer database, need to find all footers
-       // BUG:  ALSO need to do this for discovery of fragmented files--document this
-       (currentneedle->endlength && state->generateHeaderFooterDatabase)) {
-      // # of matches in last element of foundat array
-      foundat[needlenum][MAX_MATCHES_PER_BUFFER] = 0;
-      threadargs[needlenum].id = needlenum;
-      threadargs[needlenum].str = currentneedle->end;
-      threadargs[needlenum].length = currentneedle->endlength;
-      threadargs[needlenum].startpos = readbuffer;
-      threadargs[needlenum].offset = (long)readbuffer + lengthofbuf;
-      threadargs[needlenum].foundat = foundat[needlenum];
-      threadargs[needlenum].foundatlens = foundatlens[needlenum];
-      threadargs[needlenum].strisRE = currentneedle->endisRE;
-      if(currentneedle->endisRE) {
-	threadargs[needlenum].regex = &(currentneedle->endstate.re);
-      }
-      else {
-	threadargs[needlenum].table = currentneedle->endstate.bm_table;
-      }
-      threadargs[needlenum].casesensitive = currentneedle->casesensitive;
-      threadargs[needlenum].nosearchoverlap = state->noSearchOverlap;
-      threadargs[needlenum].state = state;
 
-      // unblock thread
-      //      sem_post(&workavailable[needlenum]);
-      pthread_mutex_unlock(&workavailable[needlenum]);
+// Find the live footer windows of a file type within image positions
+// [first, last].  Headers are visited from the newest back, and the
+// visit stops as soon as a window reaches first, since the windows of
+// earlier headers end earlier.  A match still pending in the type's
+// streaming DFA header search will be reported as a header later, so
+// the earliest position it may start at counts as a live header.  All
+// footers are live when a header/footer database is being created, and
+// none are when footers are searched for while carving.
+static void
+findFooterWindows(struct scalpelState *state, int needlenum,
+		  unsigned long long first, unsigned long long last) {
+
+  struct SearchSpecLine *currentneedle = &(state->SearchSpec[needlenum]);
+  FooterWindows *fw = &(footerwindows[needlenum]);
+  OffsetList *headers = &(currentneedle->offsets.headers);
+  RegexStream *stream = &(regexstreams[2 * needlenum + MULTISEARCH_HEADER]);
+  unsigned long long i = headers->count;
+  unsigned long long header, begin = 0, end = 0, wbegin, wend;
+  FooterWindow swap;
+  size_t w;
+  int pending, open = FALSE;
+
+  fw->numwindows = 0;
+  fw->next = 0;
+  if(!currentneedle->endlength || state->deferFooters) {
+    return;
+  }
+  if(state->generateHeaderFooterDatabase) {
+    addFooterWindow(state, fw, first, last);
+    return;
+  }
 
+  pending = stream->dfa && stream->numpending > 0;
+  while (pending || i > 0) {
+    if(pending) {
+      header = stream->sweep;
+      pending = FALSE;
+    }
+    else {
+      header = offsets_position(headers, --i);
+    }
+    if(header > last) {
+      continue;
+    }
+    if(last - header > currentneedle->length &&
+       header + currentneedle->length < first) {
+      break;
+    }
+    wbegin = header > first ? header : first;
+    wend = last - header > currentneedle->length ?
+      header + currentneedle->length : last;
+    if(open && wend + 1 >= begin) {
+      begin = wbegin < begin ? wbegin : begin;
+      end = wend > end ? wend : end;
     }
     else {
-      threadargs[needlenum].length = 0;
+      if(open) {
+	addFooterWindow(state, fw, begin, end);
+      }
+      begin = wbegin;
+      end = wend;
+      open = TRUE;
     }
+    if(begin == first) {
+      break;
+    }
+  }
+  if(open) {
+    addFooterWindow(state, fw, begin, end);
   }
 
-  if(state->modeVerbose) {
-    printf("Waiting for thread group synchronization.\n");
+  // windows were found newest first
+  for(w = 0; w < fw->numwindows / 2; w++) {
+    swap = fw->windows[w];
+    fw->windows[w] = fw->windows[fw->numwindows - 1 - w];
+    fw->windows[fw->numwindows - 1 - w] = swap;
   }
+}
 
-  // ---------- thread group synchronization point ----------- //
-  // ---------- thread group synchronization point ----------- //
 
-  // wait for all threads to complete footer search before proceeding
-  for(needlenum = 0; needlenum < state->specLines; needlenum++) {
-    if(threadargs[needlenum].length > 0) {
-      //      sem_wait(&workcomplete[needlenum]);
-      pthread_mutex_lock(&workcomplete[needlenum]);
-    }
+// add a window to a file type's live footer windows
+static void
+addFooterWindow(struct scalpelState *state, FooterWindows * fw,
+		unsigned long long begin, unsigned long long end) {
+
+  if(fw->numwindows == fw->storage) {
+    fw->storage = fw->storage ? fw->storage * 2 : 64;
+    fw->windows = (FooterWindow *)
+      realloc(fw->windows, fw->storage * sizeof(FooterWindow));
+    checkMemoryAllocation(state, fw->windows, __LINE__, __FILE__,
+			  "footer windows");
   }
+  fw->windows[fw->numwindows].begin = begin;
+  fw->windows[fw->numwindows].end = end;
+  fw->numwindows++;
+}
 
-  if(state->modeVerbose) {
-    printf("Thread group synchronization complete.\n");
+
+// is a footer at location within one of its file type's live windows?
+// Footers for a file type must be tested in ascending order.
+static int footerIsLive(FooterWindows * fw, unsigned long long location) {
+
+  while (fw->next < fw->numwindows && fw->windows[fw->next].end < location) {
+    fw->next++;
   }
+  return fw->next < fw->numwindows && fw->windows[fw->next].begin <= location;
+}
+
+
+// hand the searches for regular expression footers without streaming
+// DFAs in a buffer's live footer windows to the thread pool, in slices.
+// Returns TRUE if any searches were submitted.
+static int
+searchFooterWindows(struct scalpelState *state, SearchBuffer * sb) {
 
-  // digest footer locations discovered by the thread group
+  struct SearchSpecLine *currentneedle;
+  FooterWindows *fw;
+  unsigned long long origin = sb->rinfo->beginreadpos;
+  size_t lengthofbuf = sb->rinfo->bytesread;
+  size_t slicesize = searchSliceSize(lengthofbuf);
+  size_t from, to, limit, w;
+  int needlenum, i, firsttask = sb->numtasks;
 
   for(needlenum = 0; needlenum < state->specLines; needlenum++) {
     currentneedle = &(state->SearchSpec[needlenum]);
-    // number of matches stored in last element of vector
-    for(i = 0; i < (long)foundat[needlenum][MAX_MATCHES_PER_BUFFER]; i++) {
-      startLocation = offset + (foundat[needlenum][i] - readbuffer);
-      if(state->modeVerbose) {
-#ifdef _WIN32
-	fprintf(stdout, "A %s footer was found at : %I64u\n",
-		currentneedle->suffix,
-		positionUseCoverageBlockmap(state, startLocation));
-#else
-	fprintf(stdout, "A %s footer was found at : %llu\n",
-		currentneedle->suffix,
-		positionUseCoverageBlockmap(state, startLocation));
-#endif
+    if(!currentneedle->endisRE || currentneedle->enddfa) {
+      continue;
+    }
+    fw = &(footerwindows[needlenum]);
+    for(w = 0; w < fw->numwindows; w++) {
+      if(fw->windows[w].end < origin ||
+	 fw->windows[w].begin >= origin + lengthofbuf) {
+	continue;
       }
-
-      currentneedle->offsets.numfooters++;
-      if(currentneedle->offsets.footerstorage <=
-	 currentneedle->offsets.numfooters) {
-	// need more memory for footer offset storage--add an
-	// additional 100 elements
-	currentneedle->offsets.footers = (unsigned long long *)
-	  realloc(currentneedle->offsets.footers,
-		  sizeof(unsigned long long) *
-		  (currentneedle->offsets.numfooters + 100));
-	checkMemoryAllocation(state, currentneedle->offsets.footers,
-			      __LINE__, __FILE__, "footer array");
-	currentneedle->offsets.footerlens =
-	  (size_t *) realloc(currentneedle->offsets.footerlens,
-			     sizeof(size_t) *
-			     (currentneedle->offsets.numfooters + 100));
-	checkMemoryAllocation(state, currentneedle->offsets.footerlens,
-			      __LINE__, __FILE__, "footer array");
-	currentneedle->offsets.footerstorage =
-	  currentneedle->offsets.numfooters + 100;
-
-	if(state->modeVerbose) {
-#ifdef _WIN32
-	  fprintf(stdout,
-		  "Memory reallocation performed, total footer storage = %I64u\n",
-		  currentneedle->offsets.footerstorage);
-#else
-	  fprintf(stdout,
-		  "Memory reallocation performed, total footer storage = %llu\n",
-		  currentneedle->offsets.footerstorage);
-#endif
-	}
+      from = fw->windows[w].begin > origin ?
+	fw->windows[w].begin - origin : 0;
+      limit = fw->windows[w].end - origin < lengthofbuf ?
+	fw->windows[w].end - origin + 1 : lengthofbuf;
+      for(; from < limit; from = to) {
+	to = limit - from > slicesize ? from + slicesize : limit;
+	newSearchTask(state, sb, &(currentneedle->endstate.re), needlenum,
+		      MULTISEARCH_FOOTER, from, to);
       }
-      currentneedle->offsets.footers[currentneedle->offsets.numfooters -
-				     1] = startLocation;
-      currentneedle->offsets.footerlens[currentneedle->offsets.
-					numfooters - 1] =
-	foundatlens[needlenum][i];
     }
   }
 
-#endif // multi-core CPU code
-  ///////////////////////////////////////////////////
-  ///////////////////////////////////////////////////
-  ///////////END MULTI-THREADED SEARCH///////////////
-  ///////////////////////////////////////////////////
-  ///////////////////////////////////////////////////
-
-  return SCALPEL_OK;
+  for(i = firsttask; i < sb->numtasks; i++) {
+    workpool_submit(searchpool, &(sb->group), runSearchTask,
+		    &(sb->tasks[i]));
+  }
+  return sb->numtasks > firsttask;
 }
 
 
+// With --defer-footers, the footers of a file type are searched for
+// while carving, only in the windows [header + 1, header + maximum carve
+// size] of its headers.  Windows close together are merged, and the
+// parts of the image they cover are read into the read buffer in
+// batches, each of which is searched by the thread pool.  Footers are
+// recorded in ascending order, as in pass 1, so carve planning doesn't
+// change.
+static int
+resolveDeferredFooters(struct scalpelState *state, FILE * infile,
+		       int needlenum) {
+
+  struct SearchSpecLine *currentneedle = &(state->SearchSpec[needlenum]);
+  OffsetList *headers = &(currentneedle->offsets.headers);
+  FooterBatch batch;
+  readbuf_info rinfo;
+  unsigned long long i, header = 0, begin = 0, end = 0;
+  int open = FALSE, err = SCALPEL_OK;
+
+  if(!currentneedle->endlength || headers->count == 0) {
+    return SCALPEL_OK;
+  }
+
+  memset(&batch, 0, sizeof(FooterBatch));
+  batch.infile = infile;
+  batch.needlenum = needlenum;
+  // matches are found if they begin in a window, so bytes are read
+  // this far past its end
+  batch.tail = currentneedle->endisRE ?
+    LARGEST_REGEXP_OVERLAP : currentneedle->endlength - 1;
+  multisearch_init(&(batch.search));
+  if(!currentneedle->endisRE) {
+    multisearch_add(state, &(batch.search), currentneedle->end,
+		    currentneedle->endlength, currentneedle->endstate.bm_table,
+		    currentneedle->casesensitive, needlenum,
+		    MULTISEARCH_FOOTER);
+    multisearch_compile(state, &(batch.search));
+  }
+  rinfo.readbuf = readbuffer;
+  rinfo.bytesread = 0;
+  rinfo.beginreadpos = 0;
+  rinfo.carried = 0;
+  batch.sb.rinfo = &rinfo;
+  workpool_group_init(&(batch.sb.group));
+  nextsearchpos[needlenum] = 0;
+
+  for(i = 0; i <= headers->count && err == SCALPEL_OK; i++) {
+    if(i < headers->count) {
+      header = offsets_position(headers, i);
+      if(open && header + 1 >= begin &&
+	 header + 1 <= end + MAX_DEFERRED_FOOTER_GAP) {
+	if(header + currentneedle->length > end) {
+	  end = header + currentneedle->length;
+	}
+	continue;
+      }
+    }
+    if(open) {
+      err = readFooterWindow(state, &batch, begin, end);
+    }
+    begin = header + 1;
+    end = header + currentneedle->length;
+    open = TRUE;
+  }
+  if(err == SCALPEL_OK) {
+    searchFooterBatch(state, &batch);
+  }
+
+  for(i = 0; i < (unsigned long long)batch.sb.taskstorage; i++) {
+    multisearch_hits_destroy(&(batch.sb.tasks[i].hits));
+  }
+  free(batch.sb.tasks);
+  multisearch_destroy(&(batch.search));
+  return err;
+}
+
+
+// read the part of the image where footers beginning in [begin, end]
+// may be found into a batch, searching the batch whenever it fills
+static int
+readFooterWindow(struct scalpelState *state, FooterBatch * batch,
+		 unsigned long long begin, unsigned long long end) {
+
+  struct SearchSpecLine *currentneedle =
+    &(state->SearchSpec[batch->needlenum]);
+  SearchTask *task;
+  size_t span, bytesread, slicesize, from, to, limit;
+  off64_t position;
+
+  while (begin <= end) {
+    if(state->bufferSize - batch->used <= batch->tail) {
+      searchFooterBatch(state, batch);
+    }
+    span = state->bufferSize - batch->used - batch->tail;
+    if(end - begin < span) {
+      span = end - begin + 1;
+    }
+
+    position = ftello_use_coverage_map(state, batch->infile);
+    if(fseeko_use_coverage_map(state, batch->infile,
+			       (off64_t)(begin + state->skip) - position)) {
+      return SCALPEL_ERROR_FILE_READ;
+    }
+    bytesread = fread_use_coverage_map(state, readbuffer + batch->used, 1,
+				       span + batch->tail, batch->infile);
+    if(ferror(batch->infile)) {
+      return SCALPEL_ERROR_FILE_READ;
+    }
+
+    limit = span < bytesread ? span : bytesread;
+    slicesize = searchSliceSize(limit);
+    for(from = 0; from < limit; from = to) {
+      to = limit - from > slicesize ? from + slicesize : limit;
+      task = newSearchTask(state, &(batch->sb), currentneedle->endisRE ?
+			   &(currentneedle->endstate.re) : 0,
+			   batch->needlenum, MULTISEARCH_FOOTER, from, to);
+      task->search = &(batch->search);
+      task->buf = readbuffer + batch->used;
+      task->buflen = bytesread;
+      task->origin = begin;
+    }
+    batch->used += bytesread;
+
+    if(bytesread < span) {
+      // end of the image
+      break;
+    }
+    begin += span;
+  }
+  return SCALPEL_OK;
+}
+
+
+// search a batch of windows read by readFooterWindow() and record the
+// footers found
+static void searchFooterBatch(struct scalpelState *state, FooterBatch * batch) {
+
+  struct SearchSpecLine *currentneedle =
+    &(state->SearchSpec[batch->needlenum]);
+  SearchTask *task;
+  MultiSearchHitChunk *chunk;
+  MultiSearchHit *hit;
+  unsigned long long location;
+  size_t k;
+  int t;
+
+  for(t = 0; t < batch->sb.numtasks; t++) {
+    workpool_submit(searchpool, &(batch->sb.group), runSearchTask,
+		    &(batch->sb.tasks[t]));
+  }
+  workpool_wait(searchpool, &(batch->sb.group));
+
+  for(t = 0; t < batch->sb.numtasks; t++) {
+    task = &(batch->sb.tasks[t]);
+    for(chunk = task->hits.first; chunk; chunk = chunk->next) {
+      for(k = 0; k < chunk->numhits; k++) {
+	hit = &(chunk->hits[k]);
+	location = task->origin + hit->pos;
+	if(state->noSearchOverlap) {
+	  if(location < nextsearchpos[batch->needlenum]) {
+	    continue;
+	  }
+	  nextsearchpos[batch->needlenum] = location + hit->length;
+	}
+	recordFooter(state, currentneedle, location, hit->length);
+      }
+    }
+  }
+  batch->sb.numtasks = 0;
+  batch->used = 0;
+}
+
+
+// record the matches still pending in the streaming DFA searches at the
+// end of an image, and release the streams
+static void flushRegexStreams(struct scalpelState *state) {
+
+  struct SearchSpecLine *currentneedle;
+  RegexStream *stream;
+  MultiSearchHits hits;
+  MultiSearchHitChunk *chunk;
+  MultiSearchHit *hit;
+  unsigned long long location;
+  size_t k;
+  int needlenum, kind;
+
+  multisearch_hits_init(&hits);
+  // headers first, since footer viability depends on them
+  for(kind = MULTISEARCH_HEADER; kind <= MULTISEARCH_FOOTER; kind++) {
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+      nextsearchpos[needlenum] = 0;
+    }
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+      stream = &(regexstreams[2 * needlenum + kind]);
+      if(!stream->dfa) {
+	continue;
+      }
+      currentneedle = &(state->SearchSpec[needlenum]);
+      if(kind == MULTISEARCH_FOOTER) {
+	findFooterWindows(state, needlenum, stream->sweep,
+			  (unsigned long long)-1);
+      }
+      multisearch_hits_reset(&hits);
+      regexdfa_flush(state, stream, &hits);
+      for(chunk = hits.first; chunk; chunk = chunk->next) {
+	for(k = 0; k < chunk->numhits; k++) {
+	  hit = &(chunk->hits[k]);
+	  location = stream->origin + hit->pos;
+	  if(kind == MULTISEARCH_HEADER && !headerIsAligned(currentneedle,
+							    location)) {
+	    continue;
+	  }
+	  if(state->noSearchOverlap) {
+	    if(location < nextsearchpos[needlenum]) {
+	      continue;
+	    }
+	    nextsearchpos[needlenum] = location + hit->length;
+	  }
+	  if(kind == MULTISEARCH_HEADER) {
+	    recordHeader(state, currentneedle, location, hit->length);
+	  }
+	  else if(footerIsLive(&(footerwindows[needlenum]), location)) {
+	    recordFooter(state, currentneedle, location, hit->length);
+	  }
+	}
+      }
+      regexdfa_stream_destroy(stream);
+    }
+  }
+  multisearch_hits_destroy(&hits);
+
+  free(regexstreams);
+  regexstreams = 0;
+}
+
+
+// search one slice of a buffer.  Runs in the search thread pool.
+static void runSearchTask(void *arg, int worker) {
+
+  SearchTask *task = (SearchTask *) arg;
+  struct scalpelState *state = task->state;
+  regmatch_t match;
+  size_t pos, end;
+
+  if(state->modeVerbose) {
+    printf("needle search thread # %d searching [%lu, %lu).\n", worker,
+	   (unsigned long)task->from, (unsigned long)task->to);
+  }
+
+  if(task->stream) {
+    regexdfa_scan(state, task->stream, task->buf, task->buflen,
+		  task->origin, &(task->hits));
+    task->origin = task->stream->origin;
+    return;
+  }
+
+  if(task->aligned) {
+    searchAlignedHeaders(task);
+    return;
+  }
+
+  if(!task->regex) {
+    multisearch_scan(state, task->search, task->buf,
+		     task->buflen, task->from, task->to, &(task->hits));
+    return;
+  }
+
+  // regular expression matches are limited to LARGEST_REGEXP_OVERLAP
+  // bytes, so the search can stop that far past the end of the slice
+  end = task->to + LARGEST_REGEXP_OVERLAP;
+  if(end > task->buflen) {
+    end = task->buflen;
+  }
+
+  // all matches are recorded, including overlapping ones; "-r" is
+  // applied when the matches are digested
+  pos = task->from;
+  while (pos < task->to && findRegexMatch(task, pos, end, &match)) {
+    pos = match.rm_so;
+    if(pos >= task->to) {
+      break;
+    }
+    addSearchHit(task, pos, match.rm_eo - match.rm_so);
+    pos++;
+  }
+}
+
+
+// test the fixed-string headers that must be aligned at each aligned
+// offset of a slice.  The alignment is relative to the start of the
+// image, not the buffer.
+static void searchAlignedHeaders(SearchTask * task) {
+
+  struct scalpelState *state = task->state;
+  struct SearchSpecLine *currentneedle;
+  size_t pos, length;
+  unsigned int alignment;
+  int needlenum;
+
+  for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+    currentneedle = &(state->SearchSpec[needlenum]);
+    alignment = currentneedle->alignment;
+    if(!alignment || currentneedle->beginisRE ||
+       currentneedle->beginlength <= 0) {
+      continue;
+    }
+    length = currentneedle->beginlength;
+    task->rule = needlenum;
+    pos = task->from + (alignment - (task->origin + task->from) % alignment) %
+      alignment;
+    for(; pos < task->to && pos + length <= task->buflen; pos += alignment) {
+      if(currentneedle->beginverifier.verify(&(currentneedle->beginverifier),
+					     task->buf + pos)) {
+	addSearchHit(task, pos, length);
+      }
+    }
+  }
+}
+
+
+// record a match for the task's file type and kind
+static void addSearchHit(SearchTask * task, size_t pos, size_t length) {
+
+  multisearch_hits_add(task->state, &(task->hits), task->rule, task->kind,
+		       pos, length);
+}
+
+
+// find the first regular expression match starting in [pos, end) of the
+// task's buffer, as a search of the whole range would.  The offsets of
+// the match, relative to the buffer, are stored in match.
+//
+// If the regular expression has a required literal, occurrences of the
+// literal are located with the fast string search, and the regular
+// expression is only run on the window around each occurrence where a
+// match containing it could lie.  Every match contains an occurrence of
+// the literal no more than literal->before bytes from its start, and
+// once earlier occurrences have been ruled out, the first match can't
+// begin before the window.  If the first match in the window begins at
+// or before the occurrence, the whole match is inside the window, so
+// the result is the same as for a search of the whole range.
+static int
+findRegexMatch(SearchTask * task, size_t pos, size_t end,
+	       regmatch_t * match) {
+
+  RegexLiteral *literal = task->literal;
+  size_t candidate, from, to;
+  char *found;
+
+  if(!literal) {
+    if(!re_needleinhaystack(task->regex, task->buf + pos, end - pos, match)) {
+      return FALSE;
+    }
+    match->rm_so += pos;
+    match->rm_eo += pos;
+    return TRUE;
+  }
+
+  candidate = pos;
+  while (candidate + literal->length <= end &&
+	 (found = bm_needleinhaystack(&(literal->verifier),
+				      task->buf + candidate, end - candidate,
+				      literal->table))) {
+    candidate = found - task->buf;
+
+    from = pos;
+    if(literal->before != REGEX_UNBOUNDED &&
+       candidate - pos > literal->before) {
+      from = candidate - literal->before;
+    }
+    to = end;
+    if(literal->width != REGEX_UNBOUNDED && end - candidate > literal->width) {
+      to = candidate + literal->width;
+    }
+
+    if(re_needleinhaystack(task->regex, task->buf + from, to - from, match)) {
+      match->rm_so += from;
+      match->rm_eo += from;
+      // a window reaching the end of the range gives an exact answer
+      if(to == end || (size_t)match->rm_so <= candidate) {
+	return TRUE;
+      }
+    }
+    else if(to == end) {
+      return FALSE;
+    }
+
+    // no match begins at or before this occurrence of the literal
+    candidate++;
+  }
+
+  return FALSE;
+}
+
+
+// record the headers (kind == MULTISEARCH_HEADER) or live footers
+// (MULTISEARCH_FOOTER) discovered by the search tasks for a buffer.
+// Tasks for each file type cover the buffer's slices in order, so
+// matches for each file type are appended to the offsets database in
+// ascending order.  Matches found by streaming DFA searches may begin in
+// earlier buffers.
+static void
+digestSearchHits(struct scalpelState *state, SearchBuffer * sb, int kind) {
+
+  struct SearchSpecLine *currentneedle;
+  MultiSearchHitChunk *chunk;
+  MultiSearchHit *hit;
+  unsigned long long location, carriedend;
+  size_t k;
+  int needlenum, t;
+
+  for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+    nextsearchpos[needlenum] = 0;
+  }
+  carriedend = sb->rinfo->beginreadpos + sb->rinfo->carried;
+
+  for(t = 0; t < sb->numtasks; t++) {
+    for(chunk = sb->tasks[t].hits.first; chunk; chunk = chunk->next) {
+      for(k = 0; k < chunk->numhits; k++) {
+	hit = &(chunk->hits[k]);
+	if(hit->kind != kind) {
+	  continue;
+	}
+	currentneedle = &(state->SearchSpec[hit->rule]);
+	location = sb->tasks[t].origin + hit->pos;
+	if(kind == MULTISEARCH_HEADER && !headerIsAligned(currentneedle,
+							  location)) {
+	  continue;
+	}
+
+	// a match lying within the bytes carried over from the previous
+	// buffer was found there, too.  Streaming DFAs never rescan them.
+	if(!sb->tasks[t].stream && location + hit->length <= carriedend) {
+	  continue;
+	}
+
+	// Foremost 0.69 didn't find overlapping headers/footers.  If you need
+	// that behavior, specify "-r" on the command line.  Scalpel's default
+	// behavior is to find overlapping headers/footers.
+	if(state->noSearchOverlap) {
+	  if(location < nextsearchpos[hit->rule]) {
+	    continue;
+	  }
+	  nextsearchpos[hit->rule] = location + hit->length;
+	}
+
+	if(kind == MULTISEARCH_HEADER) {
+	  recordHeader(state, currentneedle, location, hit->length);
+	}
+	else if(footerIsLive(&(footerwindows[hit->rule]), location)) {
+	  recordFooter(state, currentneedle, location, hit->length);
+	}
+      }
+    }
+  }
+}
+
+#endif
+
+
+static int
+digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
+	  unsigned long long offset) {
+
+#ifdef GPU_THREADING
+  unsigned long long startLocation = 0;
+  int needlenum, i = 0;
+  struct SearchSpecLine *currentneedle = 0;
+#endif
+#ifdef MULTICORE_THREADING
+  unsigned long long first;
+  int needlenum, err;
+#endif
+//  gettimeofday_t srchnow, srchthen;
+
+  // for each file type, find all headers and some (or all) footers
+
+  // signal check
+  if(signal_caught == SIGTERM || signal_caught == SIGINT) {
+    clean_up(state, signal_caught);
+  }
+
+
+  ///////////////////////////////////////////////////
+  ///////////////////////////////////////////////////
+  ////////////////GPU-based SEARCH///////////////////
+  ///////////////////////////////////////////////////
+  ///////////////////////////////////////////////////
+#ifdef GPU_THREADING		// code for searches on GPUs
+
+
+  // BUG (GGRIII): GPU MODEL DOES NOT SUPPORT REGULAR EXPRESSIONS
+  // (LMIII): NOR WILL IT EVER.  
+  // GGRIII: let's not be hasty.  :)
+
+  // In GPU mode, the needle search has already been done. readbuffer now holds
+  // the encoded results, which must be decoded into scalpel structures.         
+
+  // Each needle found is encoded in 2 bytes, one for the <type and one for position in buffer?>
+
+    int longestneedle = findLongestNeedle(state->SearchSpec);
+  
+  // Compute the size of the results buffer.      
+  int result_chunks = (lengthofbuf / (THREADS_PER_BLOCK - longestneedle)) + 1;
+  int result_length = result_chunks * RESULTS_SIZE_PER_BLOCK;
+
+  // Decode the results from the gpu.
+  int d = 0;
+  for(d = 0; d < result_length; d += 2) {
+    i = (d / RESULTS_SIZE_PER_BLOCK) * (THREADS_PER_BLOCK - longestneedle) +
+      (unsigned char)(readbuffer[d + 1]);
+    if(readbuffer[d] > 0) {
+
+      needlenum = readbuffer[d] - 1;
+      currentneedle = &(state->SearchSpec[needlenum]);
+      startLocation = offset + i;
+
+      // found a header--record location in header offsets database
+      recordHeader(state, currentneedle, startLocation,
+		   currentneedle->beginlength);
+
+    }
+    else if(readbuffer[d] < 0) {	// footer
+
+      needlenum = -1 * readbuffer[d] - 1;
+      currentneedle = &(state->SearchSpec[needlenum]);
+      startLocation = offset + i;
+      // found a footer--record location in footer offsets database
+      recordFooter(state, currentneedle, startLocation,
+		   currentneedle->endlength);
+
+    }
+  }
+
+#endif
+  ///////////////////////////////////////////////////
+  ///////////////////////////////////////////////////
+  ////////////////END GPU-BASED SEARCH///////////////
+  ///////////////////////////////////////////////////
+  ///////////////////////////////////////////////////
+
+
+
+  ///////////////////////////////////////////////////
+  ///////////////////////////////////////////////////
+  ///////////////MULTI-THREADED SEARCH //////////////
+  ///////////////////////////////////////////////////
+  ///////////////////////////////////////////////////
+#ifdef MULTICORE_THREADING
+
+  // as of v1.9, this is now the lowest common denominator mode
+
+  // The buffer was handed to the thread pool by searchBuffer(), possibly
+  // while earlier buffers were still being searched.  Buffers are
+  // digested in the order they were read.
+
+  // ---------- thread group synchronization point ----------- //
+  // ---------- thread group synchronization point ----------- //
+
+  if(state->modeVerbose) {
+    printf("Waiting for thread group synchronization.\n");
+  }
+
+  // wait for all of the buffer's tasks to complete before proceeding
+  workpool_wait(searchpool, &(digestbuffer->group));
+
+  if(state->modeVerbose) {
+    printf("Thread group synchronization complete.\n");
+  }
+
+  // digest header locations discovered by the thread group
+  digestSearchHits(state, digestbuffer, MULTISEARCH_HEADER);
+
+  // ...and then footer locations.  Footers are kept only if:
+  //
+  // there's a footer for the file type AND
+  //
+  // (the footer is live--that is, it's within the max carve distance
+  // after a header for that type, so the carve planner may use it
+  //
+  // OR
+  // 
+  // a header/footer database is being created.  In this case, ALL headers and
+  // footers must be discovered)
+  //
+  // Liveness depends on the headers in the current buffer, so it's
+  // decided here, after the headers have been digested.  Matches of
+  // streaming DFAs may begin before the buffer.  Regular expression
+  // footers that aren't found by streaming DFAs are only searched for
+  // in the live windows.
+  first = offset > LARGEST_REGEXP_OVERLAP ? offset - LARGEST_REGEXP_OVERLAP : 0;
+  for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+    findFooterWindows(state, needlenum, first, offset + lengthofbuf - 1);
+  }
+  if(searchFooterWindows(state, digestbuffer)) {
+    workpool_wait(searchpool, &(digestbuffer->group));
+  }
+  digestSearchHits(state, digestbuffer, MULTISEARCH_FOOTER);
+
+  // in single-pass mode, keep the buffer for carving
+  if(captures) {
+    if((err = retainBuffer(state, readbuffer, lengthofbuf, offset))
+       != SCALPEL_OK) {
+      return err;
+    }
+  }
+
+#endif // multi-core CPU code
+  ///////////////////////////////////////////////////
+  ///////////////////////////////////////////////////
+  ///////////END MULTI-THREADED SEARCH///////////////
+  ///////////////////////////////////////////////////
+  ///////////////////////////////////////////////////
+
+  if(state->hfdMemoryLimit) {
+    return limitHeaderFooterDatabase(state);
+  }
+  return SCALPEL_OK;
+}
+
+
+// spill the header/footer database to a temporary file in the output
+// directory when it has grown past --hfd-memory-limit.  Entries not yet
+// encoded into blocks stay in memory.
+static int limitHeaderFooterDatabase(struct scalpelState *state) {
+
+  struct SearchSpecLine *currentneedle;
+  unsigned long long used = 0;
+  int needlenum, err;
+
+  for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+    currentneedle = &(state->SearchSpec[needlenum]);
+    used += currentneedle->offsets.headers.storage +
+      currentneedle->offsets.footers.storage;
+  }
+  if(used <= state->hfdMemoryLimit) {
+    return SCALPEL_OK;
+  }
+
+  if(hfdspill.file == 0) {
+    hfdspill.state = state;
+    hfdspill.filename = (char *)malloc(MAX_STRING_LENGTH * sizeof(char));
+    checkMemoryAllocation(state, hfdspill.filename, __LINE__, __FILE__,
+			  "hfdspill.filename");
+    snprintf(hfdspill.filename, MAX_STRING_LENGTH, "%s/%s.hfd-spill",
+	     state->outputdirectory, base_name(state->imagefile));
+    if((hfdspill.file = fopen(hfdspill.filename, "w+b")) == NULL) {
+      fprintf(stderr, "Error creating header/footer spill file: %s\n",
+	      hfdspill.filename);
+      fprintf(state->auditFile,
+	      "Error creating header/footer spill file: %s\n",
+	      hfdspill.filename);
+      free(hfdspill.filename);
+      hfdspill.filename = 0;
+      return SCALPEL_ERROR_FILE_WRITE;
+    }
+#ifdef __linux
+    fcntl(fileno(hfdspill.file), F_SETFL, O_LARGEFILE);
+#endif
+  }
+
+  if(state->modeVerbose) {
+#ifdef _WIN32
+    fprintf(stdout,
+	    "Header/footer database uses %I64u bytes, spilling to %s\n",
+	    used, hfdspill.filename);
+#else
+    fprintf(stdout,
+	    "Header/footer database uses %llu bytes, spilling to %s\n",
+	    used, hfdspill.filename);
+#endif
+  }
+
+  for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+    currentneedle = &(state->SearchSpec[needlenum]);
+    if((err = offsets_spill(&hfdspill, &(currentneedle->offsets.headers)))
+       != SCALPEL_OK ||
+       (err = offsets_spill(&hfdspill, &(currentneedle->offsets.footers)))
+       != SCALPEL_OK) {
+      fprintf(stderr, "Error writing to header/footer spill file: %s\n",
+	      hfdspill.filename);
+      fprintf(state->auditFile,
+	      "Error writing to header/footer spill file: %s\n",
+	      hfdspill.filename);
+      return err;
+    }
+  }
+  return SCALPEL_OK;
+}
+
+
+// remove the header/footer spill file, if one was created for the image
+static void removeHeaderFooterSpill(void) {
+
+  if(hfdspill.file) {
+    fclose(hfdspill.file);
+    remove(hfdspill.filename);
+    free(hfdspill.filename);
+  }
+  hfdspill.file = 0;
+  hfdspill.filename = 0;
+}
+
+
+#ifdef MULTICORE_THREADING
+
+// set up single-pass carving for an image of 'filesize' bytes.  Ring
+// buffers are allocated when they're first used.
+static void initCapture(struct scalpelState *state, long long filesize) {
+
+  maxretained = state->retentionWindow / state->bufferSize;
+  retained = (RetainedBuffer *)calloc(maxretained, sizeof(RetainedBuffer));
+  checkMemoryAllocation(state, retained, __LINE__, __FILE__, "retained");
+  numretained = 0;
+  oldestretained = 0;
+  evicted = 0;
+  captures = (CaptureState *)calloc(state->specLines, sizeof(CaptureState));
+  checkMemoryAllocation(state, captures, __LINE__, __FILE__, "captures");
+  captureimagesize = filesize;
+}
+
+
+// keep a digested buffer of 'length' bytes beginning at image position
+// 'offset' in the ring, then write the carves that can now be decided
+static int
+retainBuffer(struct scalpelState *state, char *buf,
+	     unsigned long long length, unsigned long long offset) {
+
+  RetainedBuffer *rb;
+  unsigned long long lag =
+    LARGEST_REGEXP_OVERLAP + findLongestNeedle(state->SearchSpec);
+  int err;
+
+  if(numretained == maxretained) {
+    if((err = spillRetainedBuffer(state)) != SCALPEL_OK) {
+      return err;
+    }
+    oldestretained = (oldestretained + 1) % maxretained;
+    numretained--;
+  }
+  rb = &(retained[(oldestretained + numretained) % maxretained]);
+  if(rb->data == 0) {
+    rb->data = (char *)malloc(state->bufferSize);
+    checkMemoryAllocation(state, rb->data, __LINE__, __FILE__,
+			  "retained buffer");
+  }
+  memcpy(rb->data, buf, length);
+  rb->begin = offset;
+  rb->length = length;
+  numretained++;
+
+  // matches beginning near the end of the buffer may only be found in
+  // the next one, so carves are decided when the whole window [header,
+  // header + maximum carve size] is at least 'lag' bytes behind
+  if(offset + length <= lag) {
+    return SCALPEL_OK;
+  }
+  return decideCarves(state, offset + length - lag, FALSE);
+}
+
+
+// the oldest buffer in the ring is about to be reused: write the parts
+// of undecided carves that only it holds to their files
+static int spillRetainedBuffer(struct scalpelState *state) {
+
+  RetainedBuffer *rb = &(retained[oldestretained]);
+  unsigned long long end =
+    retained[(oldestretained + 1) % maxretained].begin;
+  struct SearchSpecLine *currentneedle;
+  OffsetList *headers;
+  unsigned long long h, start, from, to;
+  char fn[MAX_STRING_LENGTH];
+  FILE *fp;
+  int needlenum;
+
+  for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+    currentneedle = &(state->SearchSpec[needlenum]);
+    headers = &(currentneedle->offsets.headers);
+    for(h = captures[needlenum].nextheader; h < headers->count; h++) {
+      start = offsets_position(headers, h);
+      if(start >= end) {
+	break;
+      }
+      from = start > evicted ? start : evicted;
+      to = end - start > currentneedle->length ?
+	start + currentneedle->length : end;
+      if(from >= to) {
+	continue;
+      }
+      captureFileName(state, fn, needlenum, h);
+      if((fp = fopen(fn, from == start ? "wb" : "ab")) == NULL) {
+	fprintf(stderr, "Error opening file: %s -- %s\n",
+		fn, strerror(errno));
+	fprintf(state->auditFile, "Error opening file: %s -- %s\n",
+		fn, strerror(errno));
+	return SCALPEL_ERROR_FILE_WRITE;
+      }
+      if(fwrite(rb->data + (from - rb->begin), 1, to - from, fp) !=
+	 to - from || fclose(fp)) {
+	fprintf(stderr, "Error writing to file: %s -- %s\n",
+		fn, strerror(errno));
+	fprintf(state->auditFile, "Error writing to file: %s -- %s\n",
+		fn, strerror(errno));
+	return SCALPEL_ERROR_FILE_WRITE;
+      }
+    }
+  }
+  evicted = end;
+  return SCALPEL_OK;
+}
+
+
+// decide and write the carves of headers whose windows [header, header
+// + maximum carve size] end before 'frontier', or of all remaining
+// headers at the end of the image.  The decisions are made by the
+// carve planner, on a header/footer database that holds every match
+// within the windows, so they're the ones carveImageFile() will make.
+static int
+decideCarves(struct scalpelState *state, unsigned long long frontier,
+	     int endofimage) {
+
+  struct SearchSpecLine *currentneedle;
+  OffsetList *headers;
+  CaptureState *cs;
+  unsigned long long start;
+  long long stop;
+  char chopped;
+  int needlenum, err;
+
+  for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+    currentneedle = &(state->SearchSpec[needlenum]);
+    headers = &(currentneedle->offsets.headers);
+    cs = &(captures[needlenum]);
+    while (cs->nextheader < headers->count) {
+      start = offsets_position(headers, cs->nextheader);
+      if(!endofimage && (start >= frontier ||
+			 frontier - start < currentneedle->length)) {
+	break;
+      }
+      stop = planCarve(state, currentneedle, cs->nextheader,
+		       &(cs->prevstopindex), captureimagesize, &chopped);
+      if((err = writeCapturedCarve(state, needlenum, start, stop))
+	 != SCALPEL_OK) {
+	return err;
+      }
+      cs->nextheader++;
+    }
+  }
+  return SCALPEL_OK;
+}
+
+
+// write the file carved for the next undecided header of a file type,
+// which begins at 'start' and ends at 'stop' (0 if there's no carve)
+static int
+writeCapturedCarve(struct scalpelState *state, int needlenum,
+		   unsigned long long start, long long stop) {
+
+  CaptureState *cs = &(captures[needlenum]);
+  unsigned long long length = state->SearchSpec[needlenum].length;
+  unsigned long long written;	// end of the part written early
+  CapturedCarve *carve;
+  char fn[MAX_STRING_LENGTH];
+  FILE *fp;
+  int err = SCALPEL_OK;
+
+  written = start;
+  if(start < evicted) {
+    written = evicted - start > length ? start + length : evicted;
+  }
+  captureFileName(state, fn, needlenum, cs->nextheader);
+
+  if(!stop) {
+    if(written > start) {
+      remove(fn);
+    }
+    return SCALPEL_OK;
+  }
+
+  if((fp = fopen(fn, written > start ? "r+b" : "wb")) == NULL) {
+    fprintf(stderr, "Error opening file: %s -- %s\n", fn, strerror(errno));
+    fprintf(state->auditFile, "Error opening file: %s -- %s\n",
+	    fn, strerror(errno));
+    if(written > start) {
+      remove(fn);
+    }
+    // carveImageFile() will extract the file from the image instead,
+    // unless the image is a stream, which can't be read again
+    return streaminput ? SCALPEL_ERROR_FILE_OPEN : SCALPEL_OK;
+  }
+  if(written > (unsigned long long)stop + 1) {
+    // the file ends before the part written early does
+    if(ftruncate(fileno(fp), stop - start + 1)) {
+      err = SCALPEL_ERROR_FILE_WRITE;
+    }
+  }
+  else if(fseeko(fp, 0, SEEK_END)) {
+    err = SCALPEL_ERROR_FILE_WRITE;
+  }
+  else {
+    err = writeRetained(fp, written, stop);
+  }
+  if(fclose(fp)) {
+    err = SCALPEL_ERROR_FILE_WRITE;
+  }
+  if(err != SCALPEL_OK) {
+    fprintf(stderr, "Error writing to file: %s -- %s\n", fn, strerror(errno));
+    fprintf(state->auditFile, "Error writing to file: %s -- %s\n",
+	    fn, strerror(errno));
+    return err;
+  }
+
+  if(cs->numcarves == cs->storage) {
+    cs->storage = cs->storage ? 2 * cs->storage : 64;
+    cs->carves = (CapturedCarve *)
+      realloc(cs->carves, cs->storage * sizeof(CapturedCarve));
+    checkMemoryAllocation(state, cs->carves, __LINE__, __FILE__,
+			  "cs->carves");
+  }
+  carve = &(cs->carves[cs->numcarves++]);
+  carve->header = cs->nextheader;
+  carve->start = start;
+  carve->stop = stop;
+  carve->placed = FALSE;
+  return SCALPEL_OK;
+}
+
+
+// write image bytes [from, to] held by the ring to 'fp'.  Bytes past
+// the end of the image are left out.
+static int
+writeRetained(FILE * fp, unsigned long long from, unsigned long long to) {
+
+  RetainedBuffer *rb;
+  unsigned long long last;
+  int k;
+
+  for(k = 0; k < numretained && from <= to; k++) {
+    rb = &(retained[(oldestretained + k) % maxretained]);
+    if(from < rb->begin || from >= rb->begin + rb->length) {
+      continue;
+    }
+    last = rb->begin + rb->length - 1 < to ? rb->begin + rb->length - 1 : to;
+    if(fwrite(rb->data + (from - rb->begin), 1, last - from + 1, fp) !=
+       last - from + 1) {
+      return SCALPEL_ERROR_FILE_WRITE;
+    }
+    from = last + 1;
+  }
+  return SCALPEL_OK;
+}
+
+
+// temporary name of the file carved for a header in single-pass mode
+static void
+captureFileName(struct scalpelState *state, char *fn, int needlenum,
+		unsigned long long header) {
+
+#ifdef _WIN32
+  snprintf(fn, MAX_STRING_LENGTH, "%s/%s.%d-%I64u.part",
+	   state->outputdirectory, base_name(state->imagefile),
+	   needlenum, header);
+#else
+  snprintf(fn, MAX_STRING_LENGTH, "%s/%s.%d-%llu.part",
+	   state->outputdirectory, base_name(state->imagefile),
+	   needlenum, header);
+#endif
+}
+
+
+// at the end of pass 1, write the remaining carves and release the ring
+static int finishCapture(struct scalpelState *state) {
+
+  int k, err;
+
+  err = decideCarves(state, 0, TRUE);
+  for(k = 0; k < maxretained; k++) {
+    free(retained[k].data);
+  }
+  free(retained);
+  retained = 0;
+  numretained = 0;
+  return err;
+}
+
+
+// if the carve planned by carveImageFile() for a header was written in
+// pass 1, return a copy of the name of its file
+static char *
+capturedCarveFile(struct scalpelState *state, int needlenum,
+		  unsigned long long header, unsigned long long start,
+		  unsigned long long stop) {
+
+  CaptureState *cs = &(captures[needlenum]);
+  CapturedCarve *carve;
+  char fn[MAX_STRING_LENGTH], *name;
+
+  while (cs->next < cs->numcarves && cs->carves[cs->next].header < header) {
+    cs->next++;
+  }
+  if(cs->next == cs->numcarves) {
+    return 0;
+  }
+  carve = &(cs->carves[cs->next]);
+  if(carve->header != header || carve->start != start ||
+     carve->stop != stop) {
+    return 0;
+  }
+  carve->placed = TRUE;
+  captureFileName(state, fn, needlenum, header);
+  name = (char *)malloc(strlen(fn) + 1);
+  checkMemoryAllocation(state, name, __LINE__, __FILE__, "name");
+  strcpy(name, fn);
+  return name;
+}
+
+
+// remove files written in pass 1 that carveImageFile() didn't use, and
+// release the single-pass carving state
+static void removeCapturedCarves(struct scalpelState *state) {
+
+  char fn[MAX_STRING_LENGTH];
+  size_t k;
+  int needlenum;
+
+  if(captures == 0) {
+    return;
+  }
+  for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+    for(k = 0; k < captures[needlenum].numcarves; k++) {
+      if(!captures[needlenum].carves[k].placed) {
+	captureFileName(state, fn, needlenum,
+			captures[needlenum].carves[k].header);
+	remove(fn);
+      }
+    }
+    free(captures[needlenum].carves);
+  }
+  free(captures);
+  captures = 0;
+}
+
+#endif
+
+
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -858,10 +2062,10 @@ digBuffer(struct scalpelState *state, unsigned long long lengthofbuf,
 ////////////////////////////////////////////////////////////////////////////////
 
 /* In order to facilitate asynchronous reads, we will set up a reader
-   pthread, whose only job is to read the image in SIZE_OF_BUFFER
+   pthread, whose only job is to read the image in state->bufferSize
    chunks using the coverage map functions.
 
-   This thread will buffer QUEUELEN reads.
+   This thread will buffer state->queueLength reads.
 */
 
 
@@ -1008,23 +2212,273 @@ void *gpu_handler(void *sss) {
 
 
 
+// Fill a read buffer with the next chunk of the image: the 'carried'
+// bytes saved from the end of the previous buffer in 'carry', then new
+// bytes read from the image.  For a mapped image, the buffer becomes a
+// mapped window instead, beginning 'carried' bytes back, so nothing is
+// copied.  A buffer that last held a hole of a sparse image still holds
+// zeroes, so if the chunk lies in a hole, too, nothing is copied into it.
+// Returns the length of the buffer, or -1 if the image couldn't be
+// mapped.
+static long long
+fillReadBuffer(struct scalpelState *state, readbuf_info * rinfo,
+	       char *carry, long long carried, long long imageend) {
+
+  long long fresh;
+  off64_t position;
+
+#ifndef GPU_THREADING
+  if(rinfo->hole && !mapinput && !state->useCoverageBlockmap) {
+    position = ftello(state->infile);
+    fresh = imageend - position;
+    if(fresh > (long long)state->bufferSize - carried) {
+      fresh = state->bufferSize - carried;
+    }
+    if(fresh > 0 && carried + fresh <= rinfo->bytesread &&
+       isImageHole(&imageholes, position - carried, carried + fresh) &&
+       fseeko(state->infile, fresh, SEEK_CUR) == 0) {
+      return carried + fresh;
+    }
+  }
+#endif
+
+  if(!mapinput) {
+    if(carried > 0) {
+      memcpy(rinfo->readbuf, carry, carried);
+    }
+    return carried +
+      fread_use_coverage_map(state, rinfo->readbuf + carried, 1,
+			     state->bufferSize - carried, state->infile);
+  }
+
+  // the window this buffer held last time has been searched
+  unmapImageWindow(&(rinfo->window));
+  rinfo->readbuf = rinfo->store;
+
+  position = ftello(state->infile);
+  fresh = imageend - position;
+  if(fresh > (long long)state->bufferSize - carried) {
+    fresh = state->bufferSize - carried;
+  }
+  if(fresh <= 0) {
+    return carried;
+  }
+  if(mapImageWindow(state->infile, position - carried, carried + fresh,
+		    &(rinfo->window)) == NULL) {
+    return -1;
+  }
+  rinfo->readbuf = rinfo->window.data;
+
+  // keep the file position where a read would have left it
+  if(fseeko(state->infile, fresh, SEEK_CUR)) {
+    return -1;
+  }
+  return carried + fresh;
+}
+
+
+// unmap the windows still held by the read buffers once an image has
+// been searched, so 'readbuffer' is a buffer of its own again
+static void unmapReadBuffers(struct scalpelState *state) {
+
+  int g;
+
+  for(g = 0; g < state->queueLength; g++) {
+    unmapImageWindow(&(readbuf_store[g].window));
+    readbuf_store[g].readbuf = readbuf_store[g].store;
+  }
+  readbuffer = readbuf_store[0].readbuf;
+}
+
+
+// With --async-reads, read the image into buffers with up to
+// state->asyncReads reads in flight, and put the buffers into the
+// full_readbuf queue in image order, overlapping as streaming_reader()'s
+// do.  Each read fills a buffer after the bytes to be carried over from
+// the previous one, and the carried bytes are copied in once the previous
+// buffer has been handed on.  Direct reads must begin and end at aligned
+// image offsets and land at aligned addresses, so they start a little
+// early, and the buffer is shifted into its (oversized) store so that the
+// fresh bytes follow the carried ones.
+static int readImageAsync(struct scalpelState *state, long long filebegin,
+			  long long filesize, int longestneedle,
+			  char *carry) {
+
+  AsyncReader *reader;
+  readbuf_info **pending;	// buffers being read, in image order
+  long long *pendingpos;	// image offsets of their fresh bytes
+  int head = 0, count = 0, slot;
+  int fd = fileno(state->infile), directfd = -1;
+  long long align = 1, position = filebegin, fileend = filebegin + filesize;
+  long long start, carried, fresh, skew, bytesread;
+  int displayUnits = UNITS_BYTES;
+  int err = SCALPEL_OK;
+  readbuf_info *rinfo;
+
+  if(state->directIO) {
+    if((directfd = asyncread_open_direct(state->imagefile)) >= 0) {
+      fd = directfd;
+      align = ASYNCREAD_ALIGNMENT;
+    }
+    else {
+      fprintf(stdout,
+	      "%s can't be read with direct I/O, so it will be read through "
+	      "the page cache.\n", state->imagefile);
+    }
+  }
+  if((reader = asyncread_init(fd, state->asyncReads)) == NULL) {
+    fprintf(stderr, "ERROR: Couldn't start asynchronous reads -- %s\n",
+	    strerror(errno));
+    if(directfd >= 0) {
+      close(directfd);
+    }
+    return SCALPEL_ERROR_FILE_READ;
+  }
+  if(state->modeVerbose) {
+    fprintf(stdout, "Reading with %s, %d reads in flight.\n",
+	    asyncread_method(reader), state->asyncReads);
+  }
+
+  pending = (readbuf_info **)malloc(state->asyncReads *
+				     sizeof(readbuf_info *));
+  checkMemoryAllocation(state, pending, __LINE__, __FILE__, "pending");
+  pendingpos = (long long *)malloc(state->asyncReads * sizeof(long long));
+  checkMemoryAllocation(state, pendingpos, __LINE__, __FILE__, "pendingpos");
+
+  while (position < fileend || count > 0) {
+
+    // Start more reads.  Only wait for an empty buffer when no read is
+    // outstanding, since the buffers in flight may be the ones the
+    // searchers are waiting for.
+    while (err == SCALPEL_OK && count < state->asyncReads &&
+	   position < fileend) {
+      rinfo = (readbuf_info *)(count == 0 ? get(empty_readbuf) :
+			       tryget(empty_readbuf));
+      if(rinfo == NULL) {
+	break;
+      }
+      carried = position == filebegin ? 0 : longestneedle - 1;
+      fresh = fileend - position;
+      if(fresh > (long long)state->bufferSize - carried) {
+	fresh = state->bufferSize - carried;
+      }
+      skew = position % align;
+      rinfo->readbuf = rinfo->store +
+	(carried + align - 1) / align * align + skew - carried;
+      rinfo->carried = carried;
+      if(asyncread_submit(reader, rinfo->readbuf + carried - skew,
+			  position - skew,
+			  (skew + fresh + align - 1) / align * align)) {
+	fprintf(stderr, "ERROR: Couldn't read image file %s -- %s\n",
+		state->imagefile, strerror(errno));
+	put(empty_readbuf, (void *)rinfo);
+	err = SCALPEL_ERROR_FILE_READ;
+	break;
+      }
+      slot = (head + count) % state->asyncReads;
+      pending[slot] = rinfo;
+      pendingpos[slot] = position;
+      count++;
+      position += fresh;
+    }
+    if(count == 0) {
+      break;
+    }
+
+    // hand on the oldest buffer once its read is done
+    rinfo = pending[head];
+    start = pendingpos[head];
+    head = (head + 1) % state->asyncReads;
+    count--;
+    carried = rinfo->carried;
+    fresh = fileend - start;
+    if(fresh > (long long)state->bufferSize - carried) {
+      fresh = state->bufferSize - carried;
+    }
+    skew = start % align;
+    bytesread = asyncread_wait(reader);
+    if(err == SCALPEL_OK && bytesread - skew < fresh) {
+      fprintf(stderr, "ERROR: Couldn't read image file %s -- %s\n",
+	      state->imagefile,
+	      bytesread < 0 ? strerror(errno) : "unexpected end of file");
+      err = SCALPEL_ERROR_FILE_READ;
+    }
+    if(err != SCALPEL_OK) {
+      put(empty_readbuf, (void *)rinfo);
+      continue;
+    }
+
+    if(state->modeVerbose) {
+#ifdef _WIN32
+      fprintf(stdout, "Read %I64u bytes from image file.\n", fresh);
+#else
+      fprintf(stdout, "Read %llu bytes from image file.\n", fresh);
+#endif
+    }
+    displayPosition(state, &displayUnits, start + fresh - filebegin,
+		    filesize, state->imagefile);
+
+    //signal check
+    if(signal_caught == SIGTERM || signal_caught == SIGINT) {
+      clean_up(state, signal_caught);
+    }
+
+    if(carried > 0) {
+      memcpy(rinfo->readbuf, carry, carried);
+    }
+    rinfo->bytesread = carried + fresh;
+    rinfo->beginreadpos = start - carried - state->skip;
+    rinfo->hole = isImageHole(&imageholes, start - carried, carried + fresh);
+    if(longestneedle > 1) {
+      memcpy(carry, rinfo->readbuf + rinfo->bytesread - (longestneedle - 1),
+	     longestneedle - 1);
+    }
+    put(full_readbuf, (void *)rinfo);
+  }
+
+  asyncread_destroy(reader);
+  if(directfd >= 0) {
+    close(directfd);
+  }
+  free(pending);
+  free(pendingpos);
+  return err;
+}
+
+
 // Streaming reader gets empty buffers from the empty_readbuf queue, reads 
-// SIZE_OF_BUFFER chunks of the input image into the buffers and puts them into
-// the full_readbuf queue for processing.
+// buffer-sized chunks of the input image into the buffers and puts them into
+// the full_readbuf queue for processing.  Consecutive buffers overlap by
+// longestneedle - 1 bytes, which are copied rather than read again, so
+// each byte of the image is read once.
 void *streaming_reader(void *sss) {
 
   struct scalpelState *state = (struct scalpelState *)sss;
 
   long long filesize = 0, bytesread = 0, filebegin = 0,
-    fileposition = 0, beginreadpos = 0;
+    fileposition = 0, beginreadpos = 0, carried = 0;
   long err = SCALPEL_OK;
   int displayUnits = UNITS_BYTES;
   int longestneedle = findLongestNeedle(state->SearchSpec);
+  char *carry = 0;		// end of the previous buffer
+  readbuf_info *rinfo;
+
+  if(longestneedle > 1) {
+    carry = (char *)malloc(longestneedle - 1);
+    checkMemoryAllocation(state, carry, __LINE__, __FILE__, "carry");
+  }
 
 	reads_finished = FALSE;
 
   filebegin = ftello(state->infile);
-  if((filesize = measureOpenFile(state->infile, state)) == -1) {
+  if(streaminput) {
+    // a stream's size isn't known, and its position is counted as it's
+    // read
+    filebegin = state->skip;
+    fileposition = filebegin;
+    filesize = 0;
+  }
+  else if((filesize = measureOpenFile(state->infile, state)) == -1) {
     fprintf(stderr,
 	    "ERROR: Couldn't measure size of image file %s\n",
 	    state->imagefile);
@@ -1032,19 +2486,29 @@ void *streaming_reader(void *sss) {
 //    goto exit_reader_thread;
   }
 
+  if(state->asyncReads > 0 && !streaminput && state->imageSegments == 0 &&
+     err == SCALPEL_OK) {
+    err = readImageAsync(state, filebegin, filesize, longestneedle, carry);
+    rinfo = (readbuf_info *)get(empty_readbuf);
+    goto exit_reader_thread;
+  }
+
   // Get empty buffer from empty_readbuf queue
-  readbuf_info *rinfo = (readbuf_info *)get(empty_readbuf);
+  rinfo = (readbuf_info *)get(empty_readbuf);
 
-  // Read chunk of image into empty buffer.
+  // Read chunk of image into empty buffer, after the bytes carried over
+  // from the previous buffer.
   while ((bytesread =
-	  fread_use_coverage_map(state, rinfo->readbuf, 1, SIZE_OF_BUFFER,
-				 state->infile)) > longestneedle - 1) {
+	  fillReadBuffer(state, rinfo, carry, carried,
+			 filebegin + filesize)) > longestneedle - 1) {
 
     if(state->modeVerbose) {
 #ifdef _WIN32
-      fprintf(stdout, "Read %I64u bytes from image file.\n", bytesread);
+      fprintf(stdout, "Read %I64u bytes from image file.\n",
+	      bytesread - carried);
 #else
-      fprintf(stdout, "Read %llu bytes from image file.\n", bytesread);
+      fprintf(stdout, "Read %llu bytes from image file.\n",
+	      bytesread - carried);
 #endif
     }
 
@@ -1054,12 +2518,19 @@ void *streaming_reader(void *sss) {
     }
 
     // progress report needs a fileposition that doesn't depend on coverage map
-    fileposition = ftello(state->infile);
-    displayPosition(&displayUnits, fileposition - filebegin,
+    if(streaminput) {
+      fileposition += bytesread - carried;
+    }
+    else {
+      fileposition = ftello(state->infile);
+    }
+    displayPosition(state, &displayUnits, fileposition - filebegin,
 		    filesize, state->imagefile);
 
     // if carving is dependent on coverage map, need adjusted fileposition
-    fileposition = ftello_use_coverage_map(state, state->infile);
+    if(!streaminput) {
+      fileposition = ftello_use_coverage_map(state, state->infile);
+    }
     beginreadpos = fileposition - bytesread;
 
     //signal check
@@ -1072,17 +2543,31 @@ void *streaming_reader(void *sss) {
     // position 
     rinfo->bytesread = bytesread;
     rinfo->beginreadpos = beginreadpos - state->skip;
+    rinfo->carried = carried;
+    rinfo->hole = !state->useCoverageBlockmap &&
+      isImageHole(&imageholes, beginreadpos, bytesread);
+
+    // keep the end of the buffer for the start of the next one, so
+    // headers and footers that fall across buffer boundaries in the
+    // image file aren't missed.  It's copied before the buffer is queued,
+    // since GPU searches overwrite the buffer with their results.  Mapped
+    // windows just overlap.
+    carried = longestneedle - 1;
+    if(carried > 0 && !mapinput) {
+      memcpy(carry, rinfo->readbuf + bytesread - carried, carried);
+    }
     put(full_readbuf, (void *)rinfo);
 
     // At this point, the host, GPU, whatever can start searching the buffer. 
 
     // Get another empty buffer.
     rinfo = (readbuf_info *)get(empty_readbuf);
+  }
 
-    // move file position back a bit so headers and footers that fall
-    // across SIZE_OF_BUFFER boundaries in the image file aren't
-    // missed
-    fseeko_use_coverage_map(state, state->infile, -1 * (longestneedle - 1));
+  if(bytesread < 0) {
+    fprintf(stderr, "ERROR: Couldn't map image file %s -- %s\n",
+	    state->imagefile, strerror(errno));
+    err = SCALPEL_ERROR_FILE_READ;
   }
 
  exit_reader_thread:
@@ -1091,28 +2576,65 @@ void *streaming_reader(void *sss) {
   }
   // Done reading image.
   reads_finished = TRUE;
+#ifdef MULTICORE_THREADING
+  // pass the last buffer along empty to mark the end of the image
+  rinfo->bytesread = 0;
+  put(full_readbuf, (void *)rinfo);
+#endif
   if (state->infile) {
     fclose(state->infile);
   }
+  free(carry);
   pthread_exit(0);
   return NULL;
 }
 
 
 
+// Return TRUE if a fixed-string needle matches a run of zero bytes:
+// it's made of nothing but zeroes and wildcards.
+static int needleMatchesZeroes(char *needle, int length) {
+
+  int i;
+
+  if(length <= 0) {
+    return FALSE;
+  }
+  for(i = 0; i < length; i++) {
+    if(needle[i] != '\0' && needle[i] != wildcard) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+
 // Scalpel's approach dictates that this function digAllFiles an image
 // file, building the header/footer offset database.  The task of
 // extracting files from the image has been moved to carveImageFile(),
 // which operates in a second pass over the image.  Digging for
-// header/footer values proceeds in SIZE_OF_BUFFER sized chunks of the
+// header/footer values proceeds in buffer-sized chunks of the
 // image file.  This buffer is now global and named "readbuffer".
 int digImageFile(struct scalpelState *state) {
 
-  int status, err;
+  int status, err, i;
   int longestneedle = findLongestNeedle(state->SearchSpec);
   long long filebegin, filesize;
+  int singlepass;
 
 
+  // with --split-image, the first segment of a split image names the
+  // whole image
+  state->imageSegments =
+    state->splitImages ? segments_count(state->imagefile) : 0;
+  if(state->imageSegments > 0 && !segments_supported()) {
+    fprintf(stdout, "%s is the first of %d segments, but split images "
+	    "can't be read\nas one image on this system, so only %s will be "
+	    "read.\n", state->imagefile, state->imageSegments,
+	    state->imagefile);
+    state->imageSegments = 0;
+  }
+
   if ((err = setupAuditFile(state)) != SCALPEL_OK) {
     return err;
   }
@@ -1122,17 +2644,56 @@ int digImageFile(struct scalpelState *state) {
   }
 
   // open current image file
-  if((state->infile = fopen(state->imagefile, "rb")) == NULL) {
+  if((state->infile = openImageFile(state)) == NULL) {
+    if(state->imageSegments > 0) {
+      fprintf(stderr, "ERROR: Couldn't open the segments of %s -- %s\n",
+	      state->imagefile, strerror(errno));
+    }
     return SCALPEL_ERROR_FILE_OPEN;
   }
 
-#ifdef _WIN32
-  // set binary mode for Win32
-  setmode(fileno(state->infile), O_BINARY);
-#endif
-#ifdef __linux
-  fcntl(fileno(state->infile), F_SETFL, O_LARGEFILE);
+  if(state->imageSegments > 0) {
+    // so the later segments aren't carved again on their own
+    recordSegmentsRead(state);
+    fprintf(stdout, "%s is the first of %d segments, which will be read as "
+	    "one image.\n", state->imagefile, state->imageSegments);
+    if(state->asyncReads > 0) {
+      fprintf(stdout, "The segments will be read with stdio, not "
+	      "--async-reads.\n");
+    }
+  }
+
+  // Standard input, pipes and other streams can only be read once, so
+  // their files are carved as they're read, as with --single-pass.
+  streaminput = isStreamedImage(state->imagefile, state->infile);
+  streamsize = 0;
+  if(streaminput) {
+#ifdef GPU_THREADING
+    fprintf(stderr, "ERROR: %s is a stream, which GPU builds can't carve.\n",
+	    state->imagefile);
+    return SCALPEL_ERROR_FILE_READ;
 #endif
+    if(state->deferFooters || state->useCoverageBlockmap ||
+       state->updateCoverageBlockmap) {
+      fprintf(stderr,
+	      "ERROR: %s is a stream, so it can't be read again for\n"
+	      "--defer-footers or a coverage blockmap.\n", state->imagefile);
+      return SCALPEL_ERROR_FILE_READ;
+    }
+    if(state->retentionWindow < 2 * state->bufferSize) {
+      fprintf(stderr,
+	      "ERROR: %s is a stream, and carving it in a single pass needs a\n"
+	      "--retention-window of at least two buffers.\n",
+	      state->imagefile);
+      return SCALPEL_ERROR_FILE_READ;
+    }
+    if(!state->singlePass) {
+      fprintf(stdout,
+	      "%s is a stream, so its files will be carved in a single pass.\n",
+	      state->imagefile);
+    }
+  }
+  singlepass = state->singlePass || streaminput;
 
   // skip initial portion of input file, if that cmd line option
   // was set
@@ -1145,24 +2706,64 @@ int digImageFile(struct scalpelState *state) {
   }
 
   filebegin = ftello(state->infile);
-  if((filesize = measureOpenFile(state->infile, state)) == -1) {
+  if(streaminput) {
+    // not known until the stream ends
+    filesize = 0;
+  }
+  else if((filesize = measureOpenFile(state->infile, state)) == -1) {
     fprintf(stderr,
 	    "ERROR: Couldn't measure size of image file %s\n",
 	    state->imagefile);
     return SCALPEL_ERROR_FILE_READ;
   }
-
-  // can't process an image file smaller than the longest needle
-  if(filesize <= longestneedle * 2) {
-    return SCALPEL_ERROR_FILE_TOO_SMALL;
+
+  // can't process an image file smaller than the longest needle
+  if(!streaminput && filesize <= longestneedle * 2) {
+    return SCALPEL_ERROR_FILE_TOO_SMALL;
+  }
+
+  // with --mmap, the reader maps windows of the image instead of reading
+  mapinput = useMappedImage(state, state->infile);
+
+  // the holes of a sparse image are filled with zeroes, in both passes,
+  // rather than read, and aren't searched for fixed strings that zeroes
+  // can't match
+  findImageHoles(state, state->infile, &imageholes);
+  for(i = 0; i < state->queueLength; i++) {
+    readbuf_store[i].hole = FALSE;
+  }
+  if(imageholes.count > 0) {
+    unsigned long long holebytes = 0;
+
+    for(i = 0; i < imageholes.count; i++) {
+      holebytes += imageholes.end[i] - imageholes.start[i];
+    }
+#ifdef _WIN32
+    fprintf(stdout, "%s is sparse, so %I64u bytes in %d holes won't be "
+	    "read.\n", state->imagefile, holebytes, imageholes.count);
+#else
+    fprintf(stdout, "%s is sparse, so %llu bytes in %d holes won't be "
+	    "read.\n", state->imagefile, holebytes, imageholes.count);
+#endif
+  }
+  zeroneedles = FALSE;
+  for(i = 0; i < state->specLines; i++) {
+    if((!state->SearchSpec[i].beginisRE &&
+	needleMatchesZeroes(state->SearchSpec[i].begin,
+			    state->SearchSpec[i].beginlength)) ||
+       (!state->SearchSpec[i].endisRE &&
+	needleMatchesZeroes(state->SearchSpec[i].end,
+			    state->SearchSpec[i].endlength))) {
+      zeroneedles = TRUE;
+    }
   }
 
 #ifdef _WIN32
-  if(state->modeVerbose) {
+  if(state->modeVerbose && !streaminput) {
     fprintf(stdout, "Total file size is %I64u bytes\n", filesize);
   }
 #else
-  if(state->modeVerbose) {
+  if(state->modeVerbose && !streaminput) {
     fprintf(stdout, "Total file size is %llu bytes\n", filesize);
   }
 #endif
@@ -1172,12 +2773,39 @@ int digImageFile(struct scalpelState *state) {
     return err;
   }
 
-  // process SIZE_OF_BUFFER-sized chunks of the current image
+  // process buffer-sized chunks of the current image
   // file and look for both headers and footers, recording their
   // offsets for use in the 2nd scalpel phase, when file data will 
   // be extracted.
 
-  fprintf(stdout, "Image file pass 1/2.\n");
+  fprintf(stdout, "Image file pass 1/%d.\n", singlepass ? 1 : 2);
+
+#ifdef MULTICORE_THREADING
+  // carves are only decided once the image has been read past them, so
+  // a stream's size only matters at its end
+  if(singlepass && !state->previewMode) {
+    initCapture(state, streaminput ? LLONG_MAX : filesize);
+  }
+
+  // regular expressions with DFAs are searched for in a single stream
+  // through the image
+  regexstreams = (RegexStream *)
+    calloc(2 * state->specLines, sizeof(RegexStream));
+  checkMemoryAllocation(state, regexstreams, __LINE__, __FILE__,
+			"regexstreams");
+  for(i = 0; i < state->specLines; i++) {
+    if(state->SearchSpec[i].begindfa) {
+      regexdfa_stream_init(state, &(regexstreams[2 * i + MULTISEARCH_HEADER]),
+			   state->SearchSpec[i].begindfa, i,
+			   MULTISEARCH_HEADER, LARGEST_REGEXP_OVERLAP);
+    }
+    if(state->SearchSpec[i].enddfa && !state->deferFooters) {
+      regexdfa_stream_init(state, &(regexstreams[2 * i + MULTISEARCH_FOOTER]),
+			   state->SearchSpec[i].enddfa, i,
+			   MULTISEARCH_FOOTER, LARGEST_REGEXP_OVERLAP);
+    }
+  }
+#endif
 
   // Create and start the streaming reader thread for this image file.
   reads_finished = FALSE;
@@ -1228,19 +2856,75 @@ int digImageFile(struct scalpelState *state) {
 
 #ifdef MULTICORE_THREADING
 
-  // The reader is now reading in chunks of the image. We call digbuffer on
-  // these chunks for multi-threaded search. 
+  // The reader is now reading in chunks of the image.  Up to
+  // SEARCH_BUFFERS_IN_FLIGHT chunks are searched by the thread pool at
+  // once, and we call digBuffer on the oldest chunk to digest its
+  // results.  The reader marks the end of the image with an empty
+  // buffer; testing reads_finished instead would race with the reader's
+  // final read.
+
+  int inflight = 0, oldest = 0, endofimage = FALSE;
+  readbuf_info *rinfo;
+
+  while (!endofimage || inflight > 0) {
+
+    // keep the thread pool supplied with buffers, waiting for one only
+    // if none are being searched
+    while (!endofimage && inflight < SEARCH_BUFFERS_IN_FLIGHT) {
+      if(inflight == 0) {
+	rinfo = (readbuf_info *)get(full_readbuf);
+      }
+      else if((rinfo = (readbuf_info *)tryget(full_readbuf)) == NULL) {
+	break;
+      }
+      if(rinfo->bytesread == 0) {
+	put(empty_readbuf, (void *)rinfo);
+	endofimage = TRUE;
+	break;
+      }
+      searchBuffer(state, &(searchbuffers[(oldest + inflight) %
+					  SEARCH_BUFFERS_IN_FLIGHT]), rinfo);
+      if(inflight == 0) {
+	submitStreamTasks(&(searchbuffers[oldest]));
+      }
+      inflight++;
+    }
 
-  while (!reads_finished || !full_readbuf->empty) {
+    if(inflight == 0) {
+      break;
+    }
 
-    readbuf_info *rinfo = (readbuf_info *)get(full_readbuf);
-    readbuffer = rinfo->readbuf;
+    digestbuffer = &(searchbuffers[oldest]);
+    readbuffer = digestbuffer->rinfo->readbuf;
     if((status =
-	digBuffer(state, rinfo->bytesread, rinfo->beginreadpos
-		  )) != SCALPEL_OK) {
+	digBuffer(state, digestbuffer->rinfo->bytesread,
+		  digestbuffer->rinfo->beginreadpos)) != SCALPEL_OK) {
       return status;
     }
-    put(empty_readbuf, (void *)rinfo);
+    if(streaminput) {
+      streamsize = digestbuffer->rinfo->beginreadpos +
+	digestbuffer->rinfo->bytesread;
+    }
+    put(empty_readbuf, (void *)digestbuffer->rinfo);
+    oldest = (oldest + 1) % SEARCH_BUFFERS_IN_FLIGHT;
+    inflight--;
+    if(inflight > 0) {
+      submitStreamTasks(&(searchbuffers[oldest]));
+    }
+  }
+
+  if(mapinput) {
+    unmapReadBuffers(state);
+  }
+  flushRegexStreams(state);
+
+  if(captures) {
+    if(streaminput) {
+      captureimagesize = streamsize;
+    }
+    if((err = finishCapture(state)) != SCALPEL_OK) {
+      return err;
+    }
   }
 
 #endif
@@ -1251,6 +2935,162 @@ int digImageFile(struct scalpelState *state) {
 
 
 
+// decide where the file carved for header 'i' of a file type stops,
+// using the header/footer database.  Returns the offset of the last
+// byte to carve, or 0 if no file is carved for the header, and sets
+// 'chopped'.  'prevstopindex' carries the index of the first footer
+// still of interest from one header to the next, so headers must be
+// planned in ascending order, starting with *prevstopindex = 0.
+static long long
+planCarve(struct scalpelState *state, struct SearchSpecLine *currentneedle,
+	  unsigned long long i, unsigned long long *prevstopindex,
+	  long long filesize, char *chopped) {
+
+  OffsetList *headers = &(currentneedle->offsets.headers);
+  OffsetList *footers = &(currentneedle->offsets.footers);
+  long long start = offsets_position(headers, i), stop;
+  unsigned long long firstcandidatefooter = 0;
+  long long j;
+  int halt;
+
+  // block aligned test for "-q" and ALIGN=.  Headers found in pass 1
+  // are already aligned, but the test is cheap.
+
+  if(!headerIsAligned(currentneedle, start)) {
+    return 0;
+  }
+
+  stop = 0;
+  *chopped = 0;
+
+  // case 1: no footer defined for this file type
+  if(!currentneedle->endlength) {
+
+    // this is the unfortunate case--if file type doesn't have a footer,
+    // all we can done is carve a block between header position and
+    // maximum carve size.
+    stop = start + currentneedle->length - 1;
+    // these are always considered chopped, because we don't really
+    // know the actual size
+    *chopped = 1;
+  }
+  else if(currentneedle->searchtype == SEARCHTYPE_FORWARD ||
+	  currentneedle->searchtype == SEARCHTYPE_FORWARD_NEXT) {
+    // footer defined: use FORWARD or FORWARD_NEXT semantics.
+    // Stop at first occurrence of footer, but for FORWARD,
+    // include the header in the carved file; for FORWARD_NEXT,
+    // don't include footer in carved file.  For FORWARD_NEXT, if
+    // no footer is found, then the maximum carve size for this
+    // file type will be used and carving will proceed.  For
+    // FORWARD, if no footer is found then no carving will be
+    // performed unless -b was specified on the command line.
+
+    halt = 0;
+
+    if (state->handleEmbedded && 
+	(currentneedle->searchtype == SEARCHTYPE_FORWARD ||
+	 currentneedle->searchtype == SEARCHTYPE_FORWARD_NEXT)) {
+      firstcandidatefooter=adjustForEmbedding(currentneedle, i, prevstopindex);
+    }
+    else {
+      firstcandidatefooter=*prevstopindex;
+    }
+
+    for (j=firstcandidatefooter;
+	 j < (long long)footers->count && ! halt; j++) {
+
+      if((long long)offsets_position(footers, j) <= start) {
+	if (! state->handleEmbedded) {
+	  *prevstopindex=j;
+	}
+
+      }
+      else {
+	halt = 1;
+	stop = offsets_position(footers, j);
+
+	if(currentneedle->searchtype == SEARCHTYPE_FORWARD) {
+	  // include footer in carved file
+	  stop += currentneedle->endlength - 1;
+	  // 	BUG? this or above?		    stop += offsets_length(footers, j) - 1;
+	}
+	else {
+	  // FORWARD_NEXT--don't include footer in carved file
+	  stop--;
+	}
+	// sanity check on size of potential file to carve--different
+	// actions depending on FORWARD or FORWARD_NEXT semantics
+	if(stop - start + 1 > (long long)currentneedle->length) {
+	  if(currentneedle->searchtype == SEARCHTYPE_FORWARD) {
+	    // if the user specified -b, then foremost 0.69
+	    // compatibility is desired: carve this file even 
+	    // though the footer wasn't found and indicate
+	    // the file was chopped, in the log.  Otherwise, 
+	    // carve nothing and move on.
+	    if(state->carveWithMissingFooters) {
+	      stop = start + currentneedle->length - 1;
+	      *chopped = 1;
+	    }
+	    else {
+	      stop = 0;
+	    }
+	  }
+	  else {
+	    // footer found for FORWARD_NEXT, but distance exceeds
+	    // max carve size for this file type, so use max carve
+	    // size as stop
+	    stop = start + currentneedle->length - 1;
+	    *chopped = 1;
+	  }
+	}
+      }
+    }
+    if(!halt &&
+       (currentneedle->searchtype == SEARCHTYPE_FORWARD_NEXT ||
+	(currentneedle->searchtype == SEARCHTYPE_FORWARD &&
+	 state->carveWithMissingFooters))) {
+      // no footer found for SEARCHTYPE_FORWARD_NEXT, or no footer
+      // found for SEARCHTYPE_FORWARD and user specified -b, so just use
+      // max carve size for this file type as stop
+      stop = start + currentneedle->length - 1;
+    }
+  }
+  else {
+    // footer defined: use REVERSE semantics: want matching footer
+    // as far away from header as possible, within maximum carving
+    // size for this file type.  Don't bother to look at footers
+    // that can't possibly match a header and remember this info
+    // in prevstopindex, as the next headers will be even deeper
+    // into the image file.  Footer is included in carved file for
+    // this type of carve.
+    halt = 0;
+    for(j = *prevstopindex; j < (long long)footers->count && !halt; j++) {
+      if((long long)offsets_position(footers, j) <= start) {
+	*prevstopindex = j;
+      }
+      else if(offsets_position(footers, j) - start <=
+	      currentneedle->length) {
+	stop = offsets_position(footers, j)
+	  + currentneedle->endlength - 1;
+      }
+      else {
+	halt = 1;
+      }
+    }
+  }
+
+  // if stop <> 0, then we have enough information to set up a
+  // file carving operation.  It must pass the minimum carve size
+  // test, if currentneedle->minLength != 0.
+  if(!stop || (stop - start + 1) < (long long)currentneedle->minlength) {
+    return 0;
+  }
+
+  // don't carve past end of image file...
+  return stop >= filesize ? filesize - 1 : stop;
+}
+
+
 // carveImageFile() uses the header/footer offsets database
 // created by digImageFile() to build a list of files to carve.  These
 // files are then carved during a single, sequential pass over the
@@ -1261,6 +3101,7 @@ int carveImageFile(struct scalpelState *state) {
 
   FILE *infile;
   struct SearchSpecLine *currentneedle;
+  OffsetList *headers;		// header database for the type
   struct CarveInfo *carveinfo;
   char fn[MAX_STRING_LENGTH];	// temp buffer for output filename
   char orgdir[MAX_STRING_LENGTH];	// buffer for name of organizing subdirectory
@@ -1273,62 +3114,75 @@ int carveImageFile(struct scalpelState *state) {
   int displayUnits = UNITS_BYTES;
   int success = 0;
   long long i, j;
-  int halt;
   char chopped;			// file chopped because it exceeds
   // max carve size for type?
   int CURRENTFILESOPEN = 0;	// number of files open (during carve)
-  unsigned long long firstcandidatefooter=0;
 
-  // index of header and footer within image file, in SIZE_OF_BUFFER
+  // index of header and footer within image file, in buffer-size
   // blocks
   unsigned long long headerblockindex, footerblockindex;
 
-  struct Queue *carvelists;	// one entry for each SIZE_OF_BUFFER bytes of
+  struct Queue *carvelists;	// one entry for each buffer-size bytes of
   // input file
+  MappedWindow window;		// with --mmap, the window being carved
+  char *buffer = readbuffer;
 //  struct timeval queuenow, queuethen;
 
-  // open image file and get size so carvelists can be allocated
-  if((infile = fopen(state->imagefile, "rb")) == NULL) {
-    fprintf(stderr, "ERROR: Couldn't open input file: %s -- %s\n",
-	    (*(state->imagefile) == '\0') ? "<blank>" : state->imagefile,
-	    strerror(errno));
-    return SCALPEL_ERROR_FILE_OPEN;
+  // open image file and get size so carvelists can be allocated.  A
+  // stream has already been read, and its files carved, in pass 1.
+  if(streaminput) {
+    infile = NULL;
+    filebegin = 0;
+    filesize = streamsize;
   }
+  else {
+    if((infile = openImageFile(state)) == NULL) {
+      fprintf(stderr, "ERROR: Couldn't open input file: %s -- %s\n",
+	      (*(state->imagefile) == '\0') ? "<blank>" : state->imagefile,
+	      strerror(errno));
+      return SCALPEL_ERROR_FILE_OPEN;
+    }
 
-#ifdef _WIN32
-  // explicit binary option for Win32
-  setmode(fileno(infile), O_BINARY);
-#endif
-#ifdef __linux
-  fcntl(fileno(infile), F_SETFL, O_LARGEFILE);
-#endif
+    // If skip was activated, then there's no way headers/footers were
+    // found there, so skip during the carve operations, too
 
-  // If skip was activated, then there's no way headers/footers were
-  // found there, so skip during the carve operations, too
+    if(state->skip > 0) {
+      if(!skipInFile(state, infile)) {
+	return SCALPEL_ERROR_FILE_READ;
+      }
+    }
 
-  if(state->skip > 0) {
-    if(!skipInFile(state, infile)) {
+    filebegin = ftello(infile);
+    if((filesize = measureOpenFile(infile, state)) == -1) {
+      fprintf(stderr,
+	      "ERROR: Couldn't measure size of image file %s\n",
+	      state->imagefile);
       return SCALPEL_ERROR_FILE_READ;
     }
   }
 
-  filebegin = ftello(infile);
-  if((filesize = measureOpenFile(infile, state)) == -1) {
-    fprintf(stderr,
-	    "ERROR: Couldn't measure size of image file %s\n",
-	    state->imagefile);
-    return SCALPEL_ERROR_FILE_READ;
-  }
 
+#ifdef MULTICORE_THREADING
+  if(state->deferFooters) {
+    fprintf(stdout, "Searching for footers near headers...\n");
+    for(needlenum = 0; needlenum < state->specLines; needlenum++) {
+      if((err = resolveDeferredFooters(state, infile, needlenum))
+	 != SCALPEL_OK) {
+	return err;
+      }
+    }
+    fseeko(infile, filebegin, SEEK_SET);
+  }
+#endif
 
 //  gettimeofday(&queuethen, 0);
 
   // allocate memory for carvelists--we alloc a queue for each
-  // SIZE_OF_BUFFER bytes in advance because it's simpler and an empty
+  // buffer-size bytes in advance because it's simpler and an empty
   // queue doesn't consume much memory, anyway.
 
   carvelists =
-    (Queue *) malloc(sizeof(Queue) * (2 + (filesize / SIZE_OF_BUFFER)));
+    (Queue *) malloc(sizeof(Queue) * (2 + (filesize / (long long)state->bufferSize)));
   checkMemoryAllocation(state, carvelists, __LINE__, __FILE__, "carvelists");
 
   // queue associated with each buffer of data holds pointers to
@@ -1336,7 +3190,7 @@ int carveImageFile(struct scalpelState *state) {
 
   fprintf(stdout, "Allocating work queues...\n");
 
-  for(i = 0; i < 2 + (filesize / SIZE_OF_BUFFER); i++) {
+  for(i = 0; i < 2 + (filesize / (long long)state->bufferSize); i++) {
     init_queue(&carvelists[i], sizeof(struct CarveInfo *), TRUE, 0, TRUE);
   }
   fprintf(stdout, "Work queues allocation complete. Building work queues...\n");
@@ -1346,159 +3200,28 @@ int carveImageFile(struct scalpelState *state) {
   for(needlenum = 0; needlenum < state->specLines; needlenum++) {
 
     currentneedle = &(state->SearchSpec[needlenum]);
+    headers = &(currentneedle->offsets.headers);
 
     // handle each discovered header independently
 
     prevstopindex = 0;
-    for(i = 0; i < (long long)currentneedle->offsets.numheaders; i++) {
-      start = currentneedle->offsets.headers[i];
+    for(i = 0; i < (long long)headers->count; i++) {
+      start = offsets_position(headers, i);
 
 			////////////// DEBUG ////////////////////////
 			//fprintf(stdout, "start: %lu\n", start);
 			
-      // block aligned test for "-q"
-
-      if(state->blockAlignedOnly && start % state->alignedblocksize != 0) {
-	continue;
-      }
-
-      stop = 0;
-      chopped = 0;
-
-      // case 1: no footer defined for this file type
-      if(!currentneedle->endlength) {
-
-	// this is the unfortunate case--if file type doesn't have a footer,
-	// all we can done is carve a block between header position and
-	// maximum carve size.
-	stop = start + currentneedle->length - 1;
-	// these are always considered chopped, because we don't really
-	// know the actual size
-	chopped = 1;
-      }
-      else if(currentneedle->searchtype == SEARCHTYPE_FORWARD ||
-	      currentneedle->searchtype == SEARCHTYPE_FORWARD_NEXT) {
-	// footer defined: use FORWARD or FORWARD_NEXT semantics.
-	// Stop at first occurrence of footer, but for FORWARD,
-	// include the header in the carved file; for FORWARD_NEXT,
-	// don't include footer in carved file.  For FORWARD_NEXT, if
-	// no footer is found, then the maximum carve size for this
-	// file type will be used and carving will proceed.  For
-	// FORWARD, if no footer is found then no carving will be
-	// performed unless -b was specified on the command line.
-
-	halt = 0;
-
-	if (state->handleEmbedded && 
-	    (currentneedle->searchtype == SEARCHTYPE_FORWARD ||
-	     currentneedle->searchtype == SEARCHTYPE_FORWARD_NEXT)) {
-	  firstcandidatefooter=adjustForEmbedding(currentneedle, i, &prevstopindex);
-	}
-	else {
-	  firstcandidatefooter=prevstopindex;
-	}
-
-	for (j=firstcandidatefooter;
-	     j < (long long)currentneedle->offsets.numfooters && ! halt; j++) {
-
-	  if((long long)currentneedle->offsets.footers[j] <= start) {
-	    if (! state->handleEmbedded) {
-	      prevstopindex=j;
-	    }
-
-	  }
-	  else {
-	    halt = 1;
-	    stop = currentneedle->offsets.footers[j];
-
-	    if(currentneedle->searchtype == SEARCHTYPE_FORWARD) {
-	      // include footer in carved file
-	      stop += currentneedle->endlength - 1;
-	      // 	BUG? this or above?		    stop += currentneedle->offsets.footerlens[j] - 1;
-	    }
-	    else {
-	      // FORWARD_NEXT--don't include footer in carved file
-	      stop--;
-	    }
-	    // sanity check on size of potential file to carve--different
-	    // actions depending on FORWARD or FORWARD_NEXT semantics
-	    if(stop - start + 1 > (long long)currentneedle->length) {
-	      if(currentneedle->searchtype == SEARCHTYPE_FORWARD) {
-		// if the user specified -b, then foremost 0.69
-		// compatibility is desired: carve this file even 
-		// though the footer wasn't found and indicate
-		// the file was chopped, in the log.  Otherwise, 
-		// carve nothing and move on.
-		if(state->carveWithMissingFooters) {
-		  stop = start + currentneedle->length - 1;
-		  chopped = 1;
-		}
-		else {
-		  stop = 0;
-		}
-	      }
-	      else {
-		// footer found for FORWARD_NEXT, but distance exceeds
-		// max carve size for this file type, so use max carve
-		// size as stop
-		stop = start + currentneedle->length - 1;
-		chopped = 1;
-	      }
-	    }
-	  }
-	}
-	if(!halt &&
-	   (currentneedle->searchtype == SEARCHTYPE_FORWARD_NEXT ||
-	    (currentneedle->searchtype == SEARCHTYPE_FORWARD &&
-	     state->carveWithMissingFooters))) {
-	  // no footer found for SEARCHTYPE_FORWARD_NEXT, or no footer
-	  // found for SEARCHTYPE_FORWARD and user specified -b, so just use
-	  // max carve size for this file type as stop
-	  stop = start + currentneedle->length - 1;
-	}
-      }
-      else {
-	// footer defined: use REVERSE semantics: want matching footer
-	// as far away from header as possible, within maximum carving
-	// size for this file type.  Don't bother to look at footers
-	// that can't possibly match a header and remember this info
-	// in prevstopindex, as the next headers will be even deeper
-	// into the image file.  Footer is included in carved file for
-	// this type of carve.
-	halt = 0;
-	for(j = prevstopindex; j < (long long)currentneedle->offsets.numfooters &&
-	      !halt; j++) {
-	  if((long long)currentneedle->offsets.footers[j] <= start) {
-	    prevstopindex = j;
-	  }
-	  else if(currentneedle->offsets.footers[j] - start <=
-		  currentneedle->length) {
-	    stop = currentneedle->offsets.footers[j]
-	      + currentneedle->endlength - 1;
-	  }
-	  else {
-	    halt = 1;
-	  }
-	}
-      }
+      if((stop = planCarve(state, currentneedle, i, &prevstopindex,
+			   filesize, &chopped))) {
 
-      // if stop <> 0, then we have enough information to set up a
-      // file carving operation.  It must pass the minimum carve size
-      // test, if currentneedle->minLength != 0.
-      //     if(stop) {
-      if (stop && (stop - start + 1) >= (long long)currentneedle->minlength) {
-
-	// don't carve past end of image file...
-	stop = stop > filesize ? filesize : stop;
-
-	// find indices (in SIZE_OF_BUFFER units) of header and
+	// find indices (in buffer-size units) of header and
 	// footer, so the carveinfo can be placed into the right
 	// queues.  The priority of each element in a queue allows the
 	// appropriate thing to be done (e.g., STARTSTOPCARVE,
 	// STARTCARVE, STOPCARVE, CONTINUECARVE).
 
-	headerblockindex = start / SIZE_OF_BUFFER;
-	footerblockindex = stop / SIZE_OF_BUFFER;
+	headerblockindex = start / state->bufferSize;
+	footerblockindex = stop / state->bufferSize;
 
 	// set up a struct CarveInfo for inclusion into the
 	// appropriate carvelists
@@ -1560,6 +3283,13 @@ int carveImageFile(struct scalpelState *state) {
 	carveinfo->start = start;
 	carveinfo->stop = stop;
 	carveinfo->chopped = chopped;
+	carveinfo->partfilename = 0;
+#ifdef MULTICORE_THREADING
+	if(captures) {
+	  carveinfo->partfilename =
+	    capturedCarveFile(state, needlenum, i, start, stop);
+	}
+#endif
 
 	// fp will be allocated when the first byte of the file is
 	// in the current buffer and cleaned up when we encounter the
@@ -1577,7 +3307,7 @@ int carveImageFile(struct scalpelState *state) {
 	  add_to_queue(&carvelists[headerblockindex], &carveinfo, STARTCARVE);
 	  add_to_queue(&carvelists[footerblockindex], &carveinfo, STOPCARVE);
 	  // .. and to all lists in between (these will result in a full
-	  // SIZE_OF_BUFFER bytes being carved into the file).  
+	  // buffer-size bytes being carved into the file).  
 	  for(j = (long long)headerblockindex + 1; j < (long long)footerblockindex; j++) {
 	    add_to_queue(&carvelists[j], &carveinfo, CONTINUECARVE);
 	  }
@@ -1611,13 +3341,25 @@ int carveImageFile(struct scalpelState *state) {
     fprintf(stdout, "** NO CARVED FILES WILL BE WRITTEN **\n");
   }
 
-  fprintf(stdout, "Carving files from image.\n");
-  fprintf(stdout, "Image file pass 2/2.\n");
+  if(state->singlePass || streaminput) {
+    fprintf(stdout, "Naming files carved in pass 1.\n");
+    if((err = placeCarvedFiles(state, infile, carvelists,
+			       2 + (filesize / (long long)state->bufferSize)))
+       != SCALPEL_OK) {
+      return err;
+    }
+  }
+  else {
+    fprintf(stdout, "Carving files from image.\n");
+    fprintf(stdout, "Image file pass 2/2.\n");
+  }
 
-  // now read image file in SIZE_OF_BUFFER-sized windows, writing
-  // carved files to output directory
+  // now read image file in buffer-sized windows, writing
+  // carved files to output directory.  In single-pass mode, that's
+  // already been done.
 
-  success = 1;
+  memset(&window, 0, sizeof(MappedWindow));
+  success = !(state->singlePass || streaminput);
   while (success) {
 
     unsigned long long biglseek = 0L;
@@ -1625,10 +3367,10 @@ int carveImageFile(struct scalpelState *state) {
     // seek
     fileposition = ftello_use_coverage_map(state, infile);
 
-    while (queue_length(&carvelists[fileposition / SIZE_OF_BUFFER]) == 0
+    while (queue_length(&carvelists[fileposition / state->bufferSize]) == 0
 	   && success) {
-      biglseek += SIZE_OF_BUFFER;
-      fileposition += SIZE_OF_BUFFER;
+      biglseek += state->bufferSize;
+      fileposition += state->bufferSize;
       success = fileposition <= filesize;
 
     }
@@ -1640,14 +3382,38 @@ int carveImageFile(struct scalpelState *state) {
     if(!success) {
       // not an error--just means we've exhausted the image file--show
       // progress report then quit carving
-      displayPosition(&displayUnits, filesize, filesize, state->imagefile);
+      displayPosition(state, &displayUnits, filesize, filesize,
+		      state->imagefile);
 
       continue;
     }
 
-    if(!state->previewMode) {
+    if(!state->previewMode && mapinput) {
+      // carve straight from a mapped window of the image, leaving the
+      // file position where a read would have
+      unmapImageWindow(&window);
+      readbuffer = buffer;
+      fileposition = ftello(infile);
+      bytesread = filebegin + filesize - fileposition;
+      if(bytesread > (long long)state->bufferSize) {
+	bytesread = state->bufferSize;
+      }
+      if(bytesread <= 0) {
+	success = 0;
+	continue;
+      }
+      if(mapImageWindow(infile, fileposition, bytesread, &window) == NULL ||
+	 fseeko(infile, bytesread, SEEK_CUR)) {
+	fprintf(stderr, "ERROR: Couldn't map image file %s -- %s\n",
+		state->imagefile, strerror(errno));
+	return SCALPEL_ERROR_FILE_READ;
+      }
+      readbuffer = window.data;
+    }
+    else if(!state->previewMode) {
       bytesread =
-	fread_use_coverage_map(state, readbuffer, 1, SIZE_OF_BUFFER, infile);
+	fread_use_coverage_map(state, readbuffer, 1, state->bufferSize,
+			       infile);
       // Check for read errors
       if((err = ferror(infile))) {
 	return SCALPEL_ERROR_FILE_READ;
@@ -1664,7 +3430,7 @@ int carveImageFile(struct scalpelState *state) {
       // complicating the file carving code further.
 
       fileposition = ftello_use_coverage_map(state, infile);
-      fseeko_use_coverage_map(state, infile, SIZE_OF_BUFFER);
+      fseeko_use_coverage_map(state, infile, state->bufferSize);
       bytesread = ftello_use_coverage_map(state, infile) - fileposition;
 
       // Check for errors
@@ -1682,7 +3448,7 @@ int carveImageFile(struct scalpelState *state) {
 
     // progress report needs real file position
     fileposition = ftello(infile);
-    displayPosition(&displayUnits, fileposition - filebegin,
+    displayPosition(state, &displayUnits, fileposition - filebegin,
 		    filesize, state->imagefile);
 
     // if using coverage map for carving, need adjusted file position
@@ -1693,21 +3459,21 @@ int carveImageFile(struct scalpelState *state) {
       clean_up(state, signal_caught);
     }
 
-    // deal with work for this SIZE_OF_BUFFER-sized block by
+    // deal with work for this buffer-sized block by
     // examining the associated queue
-    rewind_queue(&carvelists[(fileposition - bytesread) / SIZE_OF_BUFFER]);
+    rewind_queue(&carvelists[(fileposition - bytesread) / state->bufferSize]);
 
     while (!end_of_queue
-	   (&carvelists[(fileposition - bytesread) / SIZE_OF_BUFFER])) {
+	   (&carvelists[(fileposition - bytesread) / state->bufferSize])) {
       struct CarveInfo *carve;
       int operation;
       unsigned long long bytestowrite = 0, byteswritten = 0, offset = 0;
 
       peek_at_current(&carvelists
-		      [(fileposition - bytesread) / SIZE_OF_BUFFER], &carve);
+		      [(fileposition - bytesread) / state->bufferSize], &carve);
       operation =
 	current_priority(&carvelists
-			 [(fileposition - bytesread) / SIZE_OF_BUFFER]);
+			 [(fileposition - bytesread) / state->bufferSize]);
 
       // open file, if beginning of carve operation or file had to be closed
       // previously due to resource limitations
@@ -1739,7 +3505,7 @@ int carveImageFile(struct scalpelState *state) {
       switch (operation) {
       case CONTINUECARVE:
 	offset = 0;
-	bytestowrite = SIZE_OF_BUFFER;
+	bytestowrite = state->bufferSize;
 	break;
       case STARTSTOPCARVE:
 	offset = carve->start - (fileposition - bytesread);
@@ -1748,7 +3514,7 @@ int carveImageFile(struct scalpelState *state) {
       case STARTCARVE:
 	offset = carve->start - (fileposition - bytesread);
 	bytestowrite = (carve->stop - carve->start + 1) >
-	  (SIZE_OF_BUFFER - offset) ? (SIZE_OF_BUFFER - offset) :
+	  (state->bufferSize - offset) ? (state->bufferSize - offset) :
 	  (carve->stop - carve->start + 1);
 	break;
       case STOPCARVE:
@@ -1779,7 +3545,7 @@ int carveImageFile(struct scalpelState *state) {
       // coverage blockmap and auditing is done here, when a file being carved
       // is closed for the last time.
       if(operation == STARTSTOPCARVE ||
-	 operation == STOPCARVE || CURRENTFILESOPEN > MAX_FILES_TO_OPEN) {
+	 operation == STOPCARVE || CURRENTFILESOPEN > state->maxFilesToOpen) {
 	err = 0;
 	if(!state->previewMode) {
 	  if(state->modeVerbose) {
@@ -1809,12 +3575,17 @@ int carveImageFile(struct scalpelState *state) {
 	  }
 	}
       }
-      next_element(&carvelists[(fileposition - bytesread) / SIZE_OF_BUFFER]);
+      next_element(&carvelists[(fileposition - bytesread) / state->bufferSize]);
     }
   }
 
+  unmapImageWindow(&window);
+  readbuffer = buffer;
+
   //  closeFile(infile);
-  fclose(infile);
+  if(infile) {
+    fclose(infile);
+  }
 
   // write header/footer database, if necessary, before 
   // cleanup for current image file.  
@@ -1830,31 +3601,26 @@ int carveImageFile(struct scalpelState *state) {
 
   printf("Processing of image file complete. Cleaning up...\n");
 
+#ifdef MULTICORE_THREADING
+  removeCapturedCarves(state);
+#endif
+
   // tear down header/footer databases
 
   for(needlenum = 0; needlenum < state->specLines; needlenum++) {
     currentneedle = &(state->SearchSpec[needlenum]);
-    if(currentneedle->offsets.headers) {
-      free(currentneedle->offsets.headers);
-    }
-    if(currentneedle->offsets.footers) {
-      free(currentneedle->offsets.footers);
-    }
-    currentneedle->offsets.headers = 0;
-    currentneedle->offsets.footers = 0;
-    currentneedle->offsets.numheaders = 0;
-    currentneedle->offsets.numfooters = 0;
-    currentneedle->offsets.headerstorage = 0;
-    currentneedle->offsets.footerstorage = 0;
+    offsets_destroy(&(currentneedle->offsets.headers));
+    offsets_destroy(&(currentneedle->offsets.footers));
     currentneedle->numfilestocarve = 0;
   }
+  removeHeaderFooterSpill();
 
   // tear down work queues--no memory deallocation for each queue
   // entry required, because memory associated with fp and the
   // filename was freed after the carved file was closed.
 
   // destroy queues
-  for(i = 0; i < 2 + (filesize / SIZE_OF_BUFFER); i++) {
+  for(i = 0; i < 2 + (filesize / (long long)state->bufferSize); i++) {
     destroy_queue(&carvelists[i]);
   }
   // destroy array of queues
@@ -1869,6 +3635,122 @@ int carveImageFile(struct scalpelState *state) {
 
 
 
+// In single-pass mode, the files were carved during pass 1.  Move them
+// to the names carveImageFile() has given them and audit them, in the
+// order in which pass 2 would have.  Files whose carves were planned
+// differently in pass 1 are extracted from the image instead.
+static int
+placeCarvedFiles(struct scalpelState *state, FILE * infile,
+		 Queue * carvelists, unsigned long long numlists) {
+
+  struct CarveInfo *carve;
+  unsigned long long block;
+  int operation, err;
+
+  for(block = 0; block < numlists; block++) {
+    rewind_queue(&carvelists[block]);
+    while (!end_of_queue(&carvelists[block])) {
+      peek_at_current(&carvelists[block], &carve);
+      operation = current_priority(&carvelists[block]);
+      if(operation == STARTSTOPCARVE || operation == STOPCARVE) {
+	if(!state->previewMode) {
+	  if(carve->partfilename) {
+	    if(rename(carve->partfilename, carve->filename)) {
+	      fprintf(stderr, "Error renaming file: %s -- %s\n",
+		      carve->partfilename, strerror(errno));
+	      fprintf(state->auditFile, "Error renaming file: %s -- %s\n",
+		      carve->partfilename, strerror(errno));
+	      return SCALPEL_ERROR_FILE_WRITE;
+	    }
+	    free(carve->partfilename);
+	  }
+	  else if(infile == NULL) {
+	    // a stream can't be read again
+	    fprintf(stderr, "Error carving file: %s -- %s can't be reread\n",
+		    carve->filename, state->imagefile);
+	    fprintf(state->auditFile,
+		    "Error carving file: %s -- %s can't be reread\n",
+		    carve->filename, state->imagefile);
+	    return SCALPEL_ERROR_FILE_READ;
+	  }
+	  else if((err = extractCarve(state, infile, carve)) != SCALPEL_OK) {
+	    return err;
+	  }
+	}
+	auditUpdateCoverageBlockmap(state, carve);
+	free(carve->filename);
+      }
+      next_element(&carvelists[block]);
+    }
+  }
+  return SCALPEL_OK;
+}
+
+
+// write a carved file by reading its bytes from the image
+static int
+extractCarve(struct scalpelState *state, FILE * infile,
+	     struct CarveInfo *carve) {
+
+  unsigned long long remaining = carve->stop - carve->start + 1;
+  size_t bytesread;
+  off64_t position;
+  FILE *fp;
+
+  if(state->modeVerbose) {
+    fprintf(stdout, "EXTRACTING %s\n", carve->filename);
+  }
+  if((fp = fopen(carve->filename, "wb")) == NULL) {
+    fprintf(stderr, "Error opening file: %s -- %s\n",
+	    carve->filename, strerror(errno));
+    fprintf(state->auditFile, "Error opening file: %s -- %s\n",
+	    carve->filename, strerror(errno));
+    return SCALPEL_ERROR_FILE_WRITE;
+  }
+
+  position = ftello_use_coverage_map(state, infile);
+  if(fseeko_use_coverage_map(state, infile,
+			     (off64_t)(carve->start + state->skip) -
+			     position)) {
+    fclose(fp);
+    return SCALPEL_ERROR_FILE_READ;
+  }
+  while (remaining > 0) {
+    bytesread = fread_use_coverage_map(state, readbuffer, 1,
+				       remaining > state->bufferSize ?
+				       state->bufferSize : remaining, infile);
+    if(ferror(infile)) {
+      fclose(fp);
+      return SCALPEL_ERROR_FILE_READ;
+    }
+    if(bytesread == 0) {
+      // end of the image
+      break;
+    }
+    if(fwrite(readbuffer, 1, bytesread, fp) != bytesread) {
+      fprintf(stderr, "Error writing to file: %s -- %s\n",
+	      carve->filename, strerror(ferror(fp)));
+      fprintf(state->auditFile, "Error writing to file: %s -- %s\n",
+	      carve->filename, strerror(ferror(fp)));
+      fclose(fp);
+      return SCALPEL_ERROR_FILE_WRITE;
+    }
+    remaining -= bytesread;
+  }
+
+  if(fclose(fp)) {
+    fprintf(stderr, "Error closing file: %s -- %s\n\n",
+	    carve->filename, strerror(errno));
+    fprintf(state->auditFile, "Error closing file: %s -- %s\n\n",
+	    carve->filename, strerror(errno));
+    return SCALPEL_ERROR_FILE_WRITE;
+  }
+  return SCALPEL_OK;
+}
+
+
+
+
 // The coverage blockmap marks which blocks (of a user-specified size)
 // have been "covered" by a carved file.  If the coverage blockmap
 // is to be modified, check to see if it exists.  If it does, then
@@ -2522,8 +4404,8 @@ fread_use_coverage_map(struct scalpelState *state, void *ptr,
       }
 
       if((bytesread =
-	  fread((char *)ptr + totalbytesread, 1, (size_t) bytestoread,
-		stream)) < bytestoread) {
+	  readImageData(&imageholes, (char *)ptr + totalbytesread,
+			(size_t) bytestoread, stream)) < bytestoread) {
 	shortread = 1;
       }
 
@@ -2549,163 +4431,66 @@ fread_use_coverage_map(struct scalpelState *state, void *ptr,
     return totalbytesread / size;
   }
   else {
-    size_t ret = fread(ptr, size, nmemb, stream);
+    size_t ret = readImageData(&imageholes, (char *)ptr, size * nmemb,
+			       stream) / size;
     return ret;
   }
 }
 
-#ifdef MULTICORE_THREADING
-
-// threaded header/footer search
-static void *threadedFindAll(void *args) {
-
-  int id = ((ThreadFindAllParams *) args)->id;
-  char *str;
-  size_t length;
-  char *startpos;
-  long offset;
-  char **foundat;
-  size_t *foundatlens;
-  size_t *table = 0;
-  regex_t *regexp = 0;
-  int strisRE;
-  int casesensitive;
-  int nosearchoverlap;
-  struct scalpelState *state;
-
-  regmatch_t *match;
-
-  // wait for work
-  //  sem_wait(&workavailable[id]);
-	
-  // you need to be holding the workcomplete mutex initially
-  pthread_mutex_lock(&workcomplete[id]);
-  pthread_mutex_lock(&workavailable[id]);
-
-  while (1) {
-    // get args that define current workload
-    str = ((ThreadFindAllParams *) args)->str;
-    length = ((ThreadFindAllParams *) args)->length;
-    startpos = ((ThreadFindAllParams *) args)->startpos;
-    offset = ((ThreadFindAllParams *) args)->offset;
-    foundat = ((ThreadFindAllParams *) args)->foundat;
-    foundatlens = ((ThreadFindAllParams *) args)->foundatlens;
-    strisRE = ((ThreadFindAllParams *) args)->strisRE;
-    if(strisRE) {
-      regexp = ((ThreadFindAllParams *) args)->regex;
-    }
-    else {
-      table = ((ThreadFindAllParams *) args)->table;
-    }
-    casesensitive = ((ThreadFindAllParams *) args)->casesensitive;
-    nosearchoverlap = ((ThreadFindAllParams *) args)->nosearchoverlap;
-    state = ((ThreadFindAllParams *) args)->state;
-
-    if(state->modeVerbose) {
-      printf("needle search thread # %d awake.\n", id);
-    }
-
-    while (startpos) {
-      if(!strisRE) {
-	startpos = bm_needleinhaystack(str,
-				       length,
-				       startpos,
-				       offset - (long)startpos,
-				       table, casesensitive);
-      }
-      else {
-	//printf("Before regexp search, startpos = %p\n", startpos);
-	match = re_needleinhaystack(regexp, startpos, offset - (long)startpos);
-	if(!match) {
-	  startpos = 0;
-	}
-	else {
-	  startpos = match->rm_so + startpos;
-	  length = match->rm_eo - match->rm_so;
-	  free(match);
-	  //printf("After regexp search, startpos = %p\n", startpos);
-	}
-      }
-
-      if(startpos) {
-	// remember match location
-	foundat[(long)(foundat[MAX_MATCHES_PER_BUFFER])] = startpos;
-	foundatlens[(long)(foundat[MAX_MATCHES_PER_BUFFER])] = length;
-	foundat[MAX_MATCHES_PER_BUFFER]++;
-
-	// move past match position.  Foremost 0.69 didn't find overlapping
-	// headers/footers.  If you need that behavior, specify "-r" on the
-	// command line.  Scalpel's default behavior is to find overlapping
-	// headers/footers.
-
-	if(nosearchoverlap) {
-	  startpos += length;
-	}
-	else {
-	  startpos++;
-	}
-      }
-    }
-
-    if(state->modeVerbose) {
-      printf("needle search thread # %d asleep.\n", id);
-    }
-
-    // signal completion of work
-    //    sem_post(&workcomplete[id]);
-    pthread_mutex_unlock(&workcomplete[id]);
-
-    // wait for more work
-    //    sem_wait(&workavailable[id]);
-    pthread_mutex_lock(&workavailable[id]);
-
-  }
-
-  return 0;
-
-}
-
-#endif
-
 
 // Buffers for reading image in and holding gpu results.
 // The ourCudaMallocHost call MUST be executed by the 
 // gpu_handler thread.
-void init_store() {
+void init_store(struct scalpelState *state) {
 
   // 3 queues:
   //              inque filled by reader, emptied by gpu_handler
   //              outque filled by gpu_handler, emptied by host thread
   //              freequeue filled by host, emptied by reader
 
-  // the queues hold pointers to full and empty SIZE_OF_BUFFER read buffers 
-  full_readbuf = syncqueue_init("full_readbuf", QUEUELEN);
-  empty_readbuf = syncqueue_init("empty_readbuf", QUEUELEN);
+  // the queues hold pointers to full and empty buffer-sized read
+  // buffers
+  full_readbuf = syncqueue_init("full_readbuf", state->queueLength);
+  empty_readbuf = syncqueue_init("empty_readbuf", state->queueLength);
 #ifdef GPU_THREADING
-  results_readbuf = syncqueue_init("results_readbuf", QUEUELEN);
+  results_readbuf = syncqueue_init("results_readbuf", state->queueLength);
 #endif
 
   // backing store of actual buffers pointed to above, along with some  
   // necessary bookeeping info
-  readbuf_info *readbuf_store;
   if((readbuf_store =
-      (readbuf_info *)malloc(QUEUELEN * sizeof(readbuf_info))) == 0) {
+      (readbuf_info *)malloc(state->queueLength * sizeof(readbuf_info))) == 0) {
     fprintf(stderr, (char *)"malloc %lu failed in streaming reader\n",
-	    (unsigned long)QUEUELEN * sizeof(readbuf_info));
+	    (unsigned long)state->queueLength * sizeof(readbuf_info));
   }
 
   // initialization
   int g;
-  for(g = 0; g < QUEUELEN; g++) {
+  for(g = 0; g < state->queueLength; g++) {
     readbuf_store[g].bytesread = 0;
     readbuf_store[g].beginreadpos = 0;
+    readbuf_store[g].hole = FALSE;
 
     // for fast gpu operation we need to use the CUDA pinned-memory allocations
 #ifdef GPU_THREADING
-    ourCudaMallocHost((void **)&(readbuf_store[g].readbuf), SIZE_OF_BUFFER);
+    ourCudaMallocHost((void **)&(readbuf_store[g].readbuf), state->bufferSize);
 #else
-    readbuf_store[g].readbuf = (char *)malloc(SIZE_OF_BUFFER);
+    readbuf_store[g].readbuf =
+      (char *)malloc(state->bufferSize +
+		     (state->directIO ? 4 * ASYNCREAD_ALIGNMENT : 0));
 #endif
+    readbuf_store[g].store = readbuf_store[g].readbuf;
+    if(state->directIO) {
+      // direct reads land at aligned addresses, and may begin up to a
+      // block early; see readImageAsync()
+      readbuf_store[g].store = (char *)
+	(((size_t)readbuf_store[g].readbuf + ASYNCREAD_ALIGNMENT - 1) &
+	 ~((size_t)ASYNCREAD_ALIGNMENT - 1));
+      readbuf_store[g].readbuf = readbuf_store[g].store;
+    }
+    readbuf_store[g].window.mapping = 0;
+    readbuf_store[g].window.length = 0;
+    readbuf_store[g].window.data = 0;
 
     // put pointer to empty but initialized readbuf in the empty que        
     put(empty_readbuf, (void *)(&readbuf_store[g]));
@@ -2717,8 +4502,6 @@ void init_store() {
 // MULTICORE_THREADING models
 int init_threading_model(struct scalpelState *state) {
 
-  int i;
-
 #ifdef GPU_THREADING
 
   printf("GPU-based threading model enabled.\n");
@@ -2731,61 +4514,25 @@ int init_threading_model(struct scalpelState *state) {
   printf("Initializing thread group data structures.\n");
 
   // initialize global data structures for threads
-  searchthreads = (pthread_t *) malloc(state->specLines * sizeof(pthread_t));
-  checkMemoryAllocation(state, searchthreads, __LINE__, __FILE__,
-			"searchthreads");
-  threadargs =
-    (ThreadFindAllParams *) malloc(state->specLines *
-				   sizeof(ThreadFindAllParams));
-  checkMemoryAllocation(state, threadargs, __LINE__, __FILE__, "args");
-  foundat = (char ***)malloc(state->specLines * sizeof(char *));
-  checkMemoryAllocation(state, foundat, __LINE__, __FILE__, "foundat");
-  foundatlens = (size_t **) malloc(state->specLines * sizeof(size_t));
-  checkMemoryAllocation(state, foundatlens, __LINE__, __FILE__, "foundatlens");
-  workavailable = (pthread_mutex_t *)malloc(state->specLines * sizeof(pthread_mutex_t));
-
-  checkMemoryAllocation(state, workavailable, __LINE__, __FILE__,
-			"workavailable");
-  workcomplete = (pthread_mutex_t *)malloc(state->specLines * sizeof(pthread_mutex_t));
-
-  checkMemoryAllocation(state, workcomplete, __LINE__, __FILE__,
-			"workcomplete");
-
-  printf("Creating threads...\n");
-  for(i = 0; i < state->specLines; i++) {
-    foundat[i] = (char **)malloc((MAX_MATCHES_PER_BUFFER + 1) * sizeof(char *));
-    checkMemoryAllocation(state, foundat[i], __LINE__, __FILE__, "foundat");
-    foundatlens[i] = (size_t *) malloc(MAX_MATCHES_PER_BUFFER * sizeof(size_t));
-    checkMemoryAllocation(state, foundatlens[i], __LINE__, __FILE__,
-			  "foundatlens");
-    foundat[i][MAX_MATCHES_PER_BUFFER] = 0;
-
-    // BUG:  NEED PROPER ERROR CODE/MESSAGE FOR MX CREATION FAILURE
-    if(pthread_mutex_init(&workavailable[i], 0)) {
-    	//return SCALPEL_ERROR_PTHREAD_FAILURE;
-      fprintf(stderr, "COULDN'T CREATE MUTEX\n");
-      exit(1);
-    }
-
-    pthread_mutex_lock(&workavailable[i]);
-
-    if(pthread_mutex_init(&workcomplete[i], 0)) {
-      fprintf(stderr, "COULDN'T CREATE MUTEX\n");
-      exit(1);
-    }		
-
-    // create a thread in the thread pool; thread will block on workavailable[] 
-    // semaphore until there's work to do
-
-    // FIX:  NEED PROPER ERROR CODE/MESSAGE FOR THREAD CREATION FAILURE
-    threadargs[i].id = i;	// thread needs to read id before blocking
-    if(pthread_create
-       (&searchthreads[i], NULL, &threadedFindAll, &threadargs[i])) {
-      //return SCALPEL_ERROR_PTHREAD_FAILURE;
-      fprintf(stderr, "COULDN'T CREATE THREAD\n");
-      exit(1);
-    }
+  searchbuffers = (SearchBuffer *)calloc(SEARCH_BUFFERS_IN_FLIGHT,
+					 sizeof(SearchBuffer));
+  checkMemoryAllocation(state, searchbuffers, __LINE__, __FILE__,
+			"searchbuffers");
+  nextsearchpos = (unsigned long long *)
+    malloc(state->specLines * sizeof(unsigned long long));
+  checkMemoryAllocation(state, nextsearchpos, __LINE__, __FILE__,
+			"nextsearchpos");
+  footerwindows = (FooterWindows *)
+    calloc(state->specLines, sizeof(FooterWindows));
+  checkMemoryAllocation(state, footerwindows, __LINE__, __FILE__,
+			"footerwindows");
+
+  // create the thread pool; threads block until there's work to do
+  if(state->numthreads <= 0) {
+    state->numthreads = workpool_cpus();
   }
+  printf("Creating %d search threads...\n", state->numthreads);
+  searchpool = workpool_init(state->numthreads);
   printf("Thread creation completed.\n");
 
 #endif
@@ -2867,10 +4614,10 @@ static int writeHeaderFooterDatabase(struct scalpelState *state) {
 
       // # of headers
 #ifdef _WIN32
-      if(fprintf(dbfile, "%I64u\n", currentneedle->offsets.numheaders)
+      if(fprintf(dbfile, "%I64u\n", currentneedle->offsets.headers.count)
 	 <= 0) {
 #else
-	if(fprintf(dbfile, "%llu\n", currentneedle->offsets.numheaders) <= 0) {
+	if(fprintf(dbfile, "%llu\n", currentneedle->offsets.headers.count) <= 0) {
 #endif
 	  fprintf(stderr,
 		  "Error writing to header/footer database file: %s\n", fn);
@@ -2880,19 +4627,21 @@ static int writeHeaderFooterDatabase(struct scalpelState *state) {
 	}
 
 	// all header positions for current suffix
-	for(i = 0; i < currentneedle->offsets.numheaders; i++) {
+	for(i = 0; i < currentneedle->offsets.headers.count; i++) {
 #ifdef _WIN32
 	  if(fprintf
 	     (dbfile, "%I64u\n",
 	      positionUseCoverageBlockmap(state,
-					  currentneedle->offsets.
-					  headers[i])) <= 0) {
+					  offsets_position
+					  (&(currentneedle->offsets.headers),
+					   i))) <= 0) {
 #else
 	    if(fprintf
 	       (dbfile, "%llu\n",
 		positionUseCoverageBlockmap(state,
-					    currentneedle->offsets.
-					    headers[i])) <= 0) {
+					    offsets_position
+					    (&(currentneedle->offsets.headers),
+					     i))) <= 0) {
 #endif
 	      fprintf(stderr,
 		      "Error writing to header/footer database file: %s\n", fn);
@@ -2904,10 +4653,10 @@ static int writeHeaderFooterDatabase(struct scalpelState *state) {
 
 	  // # of footers
 #ifdef _WIN32
-	  if(fprintf(dbfile, "%I64u\n", currentneedle->offsets.numfooters)
+	  if(fprintf(dbfile, "%I64u\n", currentneedle->offsets.footers.count)
 	     <= 0) {
 #else
-	    if(fprintf(dbfile, "%llu\n", currentneedle->offsets.numfooters) <= 0) {
+	    if(fprintf(dbfile, "%llu\n", currentneedle->offsets.footers.count) <= 0) {
 #endif
 	      fprintf(stderr,
 		      "Error writing to header/footer database file: %s\n", fn);
@@ -2917,19 +4666,21 @@ static int writeHeaderFooterDatabase(struct scalpelState *state) {
 	    }
 
 	    // all footer positions for current suffix
-	    for(i = 0; i < currentneedle->offsets.numfooters; i++) {
+	    for(i = 0; i < currentneedle->offsets.footers.count; i++) {
 #ifdef _WIN32
 	      if(fprintf
 		 (dbfile, "%I64u\n",
 		  positionUseCoverageBlockmap(state,
-					      currentneedle->offsets.
-					      footers[i])) <= 0) {
+					      offsets_position
+					      (&(currentneedle->offsets.footers),
+					       i))) <= 0) {
 #else
 		if(fprintf
 		   (dbfile, "%llu\n",
 		    positionUseCoverageBlockmap(state,
-						currentneedle->offsets.
-						footers[i])) <= 0) {
+						offsets_position
+						(&(currentneedle->offsets.footers),
+						 i))) <= 0) {
 #endif
 		  fprintf(stderr,
 			  "Error writing to header/footer database file: %s\n", fn);
@@ -21,8 +21,15 @@
 // on Foremost.  Foremost 0.69 was used as the starting point for 
 // Scalpel, in 2005.
 
+// for SEEK_DATA and SEEK_HOLE
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "scalpel.h"
 
+static int findHole(ImageHoles * holes, long long position);
+
 // Returns TRUE if the directory exists and is empty. 
 // If the directory does not exist, an attempt is made to 
 // create it.  On error, returns FALSE 
@@ -204,8 +211,9 @@ int outputDirectoryOK(char *dir) {
     descriptor = fileno(f);
     info = (struct stat *)malloc(sizeof(struct stat));
     checkMemoryAllocation(state, info, __LINE__, __FILE__, "info");
-    fstat(descriptor, info);
-    if(S_ISBLK(info->st_mode)) {
+    // a split image's stream has no descriptor of its own
+    if(descriptor >= 0 && fstat(descriptor, info) == 0 &&
+       S_ISBLK(info->st_mode)) {
 
 #if defined (__linux)
       if(ioctl(descriptor, BLKGETSIZE, &numsectors) < 0) {
@@ -259,3 +267,522 @@ int outputDirectoryOK(char *dir) {
 
     return (total - original);
   }
+
+
+  // time one probe: read up to AUTO_TUNE_PROBE_BYTES from the image in
+  // chunks of size bytes, starting at offset.  Returns the read
+  // throughput in bytes per second, or -1 on error.
+  static double probeReadThroughput(FILE * f, unsigned long long offset,
+				    unsigned long long size, char *buf) {
+
+#ifdef _WIN32
+    LARGE_INTEGER then, now;
+#else
+    struct timeval then, now;
+#endif
+    unsigned long long total = 0;
+    size_t bytesread;
+    int reads = 0;
+    double secs = 0;
+
+    if(fseeko(f, offset, SEEK_SET)) {
+      return -1;
+    }
+#if defined(__linux)
+    // don't let an earlier run (or an earlier probe) answer from the cache
+    posix_fadvise(fileno(f), offset, AUTO_TUNE_PROBE_BYTES,
+		  POSIX_FADV_DONTNEED);
+#endif
+
+    gettimeofday(&then, (struct timezone *)0);
+    while (total < AUTO_TUNE_PROBE_BYTES || reads < 2) {
+      bytesread = fread(buf, 1, size, f);
+      if(bytesread == 0) {
+	if(ferror(f)) {
+	  return -1;
+	}
+	break;
+      }
+      total += bytesread;
+      reads++;
+      gettimeofday(&now, (struct timezone *)0);
+      secs = elapsed(now, then);
+      if(secs > AUTO_TUNE_PROBE_TIME && reads >= 2) {
+	break;
+      }
+    }
+
+    if(total == 0) {
+      return -1;
+    }
+    // guard against a timer too coarse to see a fast (cached) read
+    return total / (secs > 0.000001 ? secs : 0.000001);
+  }
+
+
+  // --auto-tune: pick the read buffer size and queue length by timing
+  // reads of the first image with each candidate buffer size, keeping
+  // the buffers within state->autoTuneMemory.  On any error the default
+  // geometry is kept.
+  void autoTuneBuffers(struct scalpelState *state, char **argv) {
+
+    char image[MAX_STRING_LENGTH];
+    FILE *f, *listoffiles;
+    char *buf;
+    unsigned long long size, best = 0, chosen = 0, offset = 0;
+    unsigned long long imagesize;
+    long long measured;
+    double rate[16], bestrate = 0;
+    unsigned long long sizes[16];
+    int numsizes = 0, i;
+    unsigned long long queuelen;
+
+    // the first image named on the command line or in the -i list
+    image[0] = '\0';
+    if(state->useInputFileList) {
+      if((listoffiles = fopen(state->inputFileList, "r")) != NULL) {
+	if(fgets(image, MAX_STRING_LENGTH, listoffiles) == NULL) {
+	  image[0] = '\0';
+	}
+	fclose(listoffiles);
+	if(image[0] && image[strlen(image) - 1] == '\n') {
+	  image[strlen(image) - 1] = '\0';
+	}
+      }
+    }
+    else if(*argv) {
+      strncpy(image, *argv, MAX_STRING_LENGTH - 1);
+      image[MAX_STRING_LENGTH - 1] = '\0';
+    }
+
+    // reading a stream to time it would consume the image
+    if(image[0] && isStreamedImage(image, NULL)) {
+      fprintf(stderr,
+	      "WARNING: --auto-tune can't time reads from a stream, using the "
+	      "default buffer size and queue length.\n");
+      return;
+    }
+
+    if(image[0] == '\0' || (f = fopen(image, "rb")) == NULL) {
+      fprintf(stderr,
+	      "WARNING: --auto-tune couldn't open the first image, using the "
+	      "default buffer size and queue length.\n");
+      return;
+    }
+
+    if((measured = measureOpenFile(f, state)) <= 0) {
+      fprintf(stderr,
+	      "WARNING: --auto-tune couldn't measure %s, using the default "
+	      "buffer size and queue length.\n", image);
+      fclose(f);
+      return;
+    }
+    imagesize = (unsigned long long)measured;
+
+    // candidates must leave room for the buffers being searched plus
+    // one being read, and for two in a single-pass retention window
+    for(size = MIN_SIZE_OF_BUFFER; size <= MAX_AUTO_TUNE_BUFFER && numsizes < 16;
+	size *= AUTO_TUNE_STEP) {
+      if(size * (SEARCH_BUFFERS_IN_FLIGHT + 1) > state->autoTuneMemory ||
+	 (state->singlePass && 2 * size > state->retentionWindow)) {
+	break;
+      }
+      // a buffer bigger than the image gains nothing
+      if(numsizes > 0 && size > imagesize) {
+	break;
+      }
+      sizes[numsizes++] = size;
+    }
+
+    if(numsizes == 0) {
+      fprintf(stderr,
+	      "WARNING: --auto-tune memory is too small for %d buffers of "
+	      "%d kilobytes, using the default buffer size and queue length.\n",
+	      SEARCH_BUFFERS_IN_FLIGHT + 1, MIN_SIZE_OF_BUFFER / KILOBYTE);
+      fclose(f);
+      return;
+    }
+
+    buf = (char *)malloc(sizes[numsizes - 1]);
+    checkMemoryAllocation(state, buf, __LINE__, __FILE__, "buf");
+
+    fprintf(stdout, "Auto-tuning read buffers on %s.\n", image);
+    for(i = 0; i < numsizes; i++) {
+      // probe a different region of the image for each size
+      offset = (i * (unsigned long long)AUTO_TUNE_PROBE_BYTES) % imagesize;
+      offset -= offset % SCALPEL_BLOCK_SIZE;
+      rate[i] = probeReadThroughput(f, offset, sizes[i], buf);
+      if(rate[i] < 0) {
+	fprintf(stderr,
+		"WARNING: --auto-tune couldn't read %s, using the default "
+		"buffer size and queue length.\n", image);
+	free(buf);
+	fclose(f);
+	return;
+      }
+      if(state->modeVerbose) {
+#ifdef _WIN32
+	fprintf(stdout, "  %6I64u KB buffers: %.1f MB/s\n",
+		sizes[i] / KILOBYTE, rate[i] / MEGABYTE);
+#else
+	fprintf(stdout, "  %6llu KB buffers: %.1f MB/s\n",
+		sizes[i] / KILOBYTE, rate[i] / MEGABYTE);
+#endif
+      }
+      if(rate[i] > bestrate) {
+	bestrate = rate[i];
+	best = sizes[i];
+      }
+    }
+    free(buf);
+    fclose(f);
+
+    // smaller buffers cost less memory and let searches start sooner
+    for(i = 0; i < numsizes; i++) {
+      if(rate[i] * 100 >= bestrate * (100 - AUTO_TUNE_TOLERANCE)) {
+	chosen = sizes[i];
+	break;
+      }
+    }
+    if(chosen == 0) {
+      chosen = best;
+    }
+
+    queuelen = state->autoTuneMemory / chosen;
+    if(queuelen < SEARCH_BUFFERS_IN_FLIGHT + 1) {
+      queuelen = SEARCH_BUFFERS_IN_FLIGHT + 1;
+    }
+    if(queuelen > MAX_AUTO_TUNE_QUEUELEN) {
+      queuelen = MAX_AUTO_TUNE_QUEUELEN;
+    }
+
+    state->bufferSize = chosen;
+    state->queueLength = (int)queuelen;
+
+#ifdef _WIN32
+    fprintf(stdout, "Using %I64u KB read buffers, %d in the queue.\n",
+	    state->bufferSize / KILOBYTE, state->queueLength);
+#else
+    fprintf(stdout, "Using %llu KB read buffers, %d in the queue.\n",
+	    state->bufferSize / KILOBYTE, state->queueLength);
+#endif
+  }
+
+
+  // Return TRUE if an open image file should be read through
+  // memory-mapped windows: --mmap was given and the image is a regular
+  // file.  Other images (devices, pipes) are read with stdio.
+  int useMappedImage(struct scalpelState *state, FILE * f) {
+
+#ifdef _WIN32
+    return FALSE;
+#else
+    struct stat info;
+
+    if(!state->useMmap) {
+      return FALSE;
+    }
+    if(state->imageSegments > 0) {
+      fprintf(stdout, "%s is split into segments, so it won't be mapped.\n",
+	      state->imagefile);
+      return FALSE;
+    }
+    if(fstat(fileno(f), &info) || !S_ISREG(info.st_mode)) {
+      fprintf(stdout, "%s isn't a regular file, so it won't be mapped.\n",
+	      state->imagefile);
+      return FALSE;
+    }
+    return TRUE;
+#endif
+  }
+
+
+  // Map 'length' bytes of an open image file, starting at 'offset', for
+  // reading, and advise the kernel that they'll be read in order.
+  // Mappings must begin on a page boundary, so the mapping may begin a
+  // little before 'offset'.  Returns a pointer to the byte at 'offset',
+  // or NULL on error.
+  char *mapImageWindow(FILE * f, off64_t offset, size_t length,
+		       MappedWindow * w) {
+
+#ifdef _WIN32
+    w->mapping = 0;
+    w->length = 0;
+    w->data = 0;
+    return NULL;
+#else
+    static long pagesize = 0;
+    off64_t start;
+    int flags = MAP_PRIVATE;
+
+    if(pagesize == 0) {
+      pagesize = sysconf(_SC_PAGESIZE);
+    }
+    start = offset - offset % pagesize;
+
+#ifdef MAP_POPULATE
+    // fault the whole window in at once, rather than a page at a time
+    flags |= MAP_POPULATE;
+#endif
+    w->length = length + (size_t)(offset - start);
+    w->mapping = mmap(0, w->length, PROT_READ, flags, fileno(f), start);
+    if(w->mapping == MAP_FAILED) {
+      w->mapping = 0;
+      w->length = 0;
+      w->data = 0;
+      return NULL;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(w->mapping, w->length, MADV_SEQUENTIAL);
+#endif
+    w->data = (char *)w->mapping + (offset - start);
+    return w->data;
+#endif
+  }
+
+
+  // unmap a window mapped by mapImageWindow(), if there is one
+  void unmapImageWindow(MappedWindow * w) {
+
+#ifndef _WIN32
+    if(w->length) {
+      munmap(w->mapping, w->length);
+    }
+#endif
+    w->mapping = 0;
+    w->length = 0;
+    w->data = 0;
+  }
+
+
+  // Return TRUE if an image can only be read once, from beginning to
+  // end: standard input, a pipe or socket, or another file that can't be
+  // seeked.  If 'f' is NULL, the image hasn't been opened, and only its
+  // name and type are checked.
+  int isStreamedImage(char *imagefile, FILE * f) {
+
+    if(strcmp(imagefile, SCALPEL_STDIN_IMAGE) == 0) {
+      return TRUE;
+    }
+#ifndef _WIN32
+    struct stat info;
+
+    if(f == NULL) {
+      return stat(imagefile, &info) == 0 &&
+	(S_ISFIFO(info.st_mode) || S_ISSOCK(info.st_mode));
+    }
+    if(fstat(fileno(f), &info) == 0 &&
+       (S_ISFIFO(info.st_mode) || S_ISSOCK(info.st_mode))) {
+      return TRUE;
+    }
+#endif
+    return f != NULL && fseeko(f, 0, SEEK_CUR) != 0;
+  }
+
+
+  // Open the current image for reading: standard input for "-", the
+  // segments of a split image as one stream, or else the named file.
+  // Returns NULL, with errno set, on error.
+  FILE *openImageFile(struct scalpelState *state) {
+
+    FILE *f;
+
+    if(strcmp(state->imagefile, SCALPEL_STDIN_IMAGE) == 0) {
+      f = stdin;
+    }
+    else if(state->imageSegments > 0) {
+      f = segments_open(state->imagefile, state->imageSegments);
+    }
+    else {
+      f = fopen(state->imagefile, "rb");
+    }
+    if(f == NULL) {
+      return NULL;
+    }
+
+#ifdef _WIN32
+    // set binary mode for Win32
+    setmode(fileno(f), O_BINARY);
+#endif
+#ifdef __linux
+    if(fileno(f) >= 0) {
+      fcntl(fileno(f), F_SETFL, O_LARGEFILE);
+    }
+#endif
+    return f;
+  }
+
+
+  // Find the holes in an open image file that's sparse, with SEEK_DATA
+  // and SEEK_HOLE, so that they can be filled with zeroes rather than
+  // read.  Holes shorter than MIN_SKIPPED_HOLE are left to be read.
+  // Images that aren't regular files, and systems without SEEK_HOLE,
+  // have no holes.  The file position is left unchanged.
+  void findImageHoles(struct scalpelState *state, FILE * f,
+		      ImageHoles * holes) {
+
+    holes->count = 0;
+#if !defined(_WIN32) && defined(SEEK_DATA) && defined(SEEK_HOLE)
+    struct stat info;
+    off64_t original = ftello(f), data, hole = 0;
+    int fd = fileno(f);
+
+    if(fd < 0 || fstat(fd, &info) || !S_ISREG(info.st_mode)) {
+      return;
+    }
+    while (hole < info.st_size) {
+      // there's no more data past the last hole
+      if((data = lseek(fd, hole, SEEK_DATA)) < 0) {
+	if(errno != ENXIO) {
+	  holes->count = 0;
+	  break;
+	}
+	data = info.st_size;
+      }
+      if(data - hole >= MIN_SKIPPED_HOLE) {
+	if(holes->count == holes->storage) {
+	  holes->storage = holes->storage ? 2 * holes->storage : 64;
+	  holes->start = (long long *)realloc(holes->start, holes->storage *
+					      sizeof(long long));
+	  checkMemoryAllocation(state, holes->start, __LINE__, __FILE__,
+				"holes->start");
+	  holes->end = (long long *)realloc(holes->end, holes->storage *
+					    sizeof(long long));
+	  checkMemoryAllocation(state, holes->end, __LINE__, __FILE__,
+				"holes->end");
+	}
+	holes->start[holes->count] = hole;
+	holes->end[holes->count] = data;
+	holes->count++;
+      }
+      if(data >= info.st_size) {
+	break;
+      }
+      if((hole = lseek(fd, data, SEEK_HOLE)) < 0) {
+	holes->count = 0;
+	break;
+      }
+    }
+
+    // the descriptor's offset has moved under the stream
+    fseeko(f, original, SEEK_SET);
+#endif
+  }
+
+
+  // the first hole that ends after 'position', or holes->count if none
+  static int findHole(ImageHoles * holes, long long position) {
+
+    int low = 0, high = holes->count, mid;
+
+    while (low < high) {
+      mid = (low + high) / 2;
+      if(holes->end[mid] <= position) {
+	low = mid + 1;
+      }
+      else {
+	high = mid;
+      }
+    }
+    return low;
+  }
+
+
+  // Return TRUE if the 'length' bytes of an image file at 'start' all
+  // lie in one hole.
+  int isImageHole(ImageHoles * holes, long long start, long long length) {
+
+    int h = findHole(holes, start);
+
+    return h < holes->count && holes->start[h] <= start &&
+      holes->end[h] >= start + length;
+  }
+
+
+  // Read up to 'length' bytes from an image file's current position, like
+  // fread(), except that the parts lying in holes are filled with zeroes
+  // and seeked past rather than read.  Returns the number of bytes read.
+  size_t readImageData(ImageHoles * holes, char *buf, size_t length,
+		       FILE * f) {
+
+    long long position, n;
+    size_t done = 0, got;
+    int h;
+
+    if(holes->count == 0) {
+      return fread(buf, 1, length, f);
+    }
+
+    position = ftello(f);
+    h = findHole(holes, position);
+    while (done < length) {
+      n = (long long)(length - done);
+      if(h < holes->count && holes->start[h] <= position) {
+	if(n > holes->end[h] - position) {
+	  n = holes->end[h] - position;
+	}
+	if(fseeko(f, n, SEEK_CUR)) {
+	  break;
+	}
+	memset(buf + done, 0, (size_t)n);
+	h++;
+	got = (size_t)n;
+      }
+      else {
+	if(h < holes->count && n > holes->start[h] - position) {
+	  n = holes->start[h] - position;
+	}
+	if((got = fread(buf + done, 1, (size_t)n, f)) < (size_t)n) {
+	  done += got;
+	  break;
+	}
+      }
+      done += got;
+      position += got;
+    }
+    return done;
+  }
+
+
+  // Remember the real paths of the segments of the split image being
+  // read, so that segmentAlreadyRead() can tell when one is named again.
+  void recordSegmentsRead(struct scalpelState *state) {
+
+    char name[MAX_STRING_LENGTH], path[PATH_MAX];
+    int i;
+
+    state->segmentsRead = (char **)
+      realloc(state->segmentsRead, (state->numSegmentsRead +
+				    state->imageSegments) * sizeof(char *));
+    checkMemoryAllocation(state, state->segmentsRead, __LINE__, __FILE__,
+			  "state->segmentsRead");
+    for(i = 0; i < state->imageSegments; i++) {
+      if(segments_name(state->imagefile, i, name, MAX_STRING_LENGTH) == 0 &&
+	 realpath(name, path)) {
+	state->segmentsRead[state->numSegmentsRead] = strdup(path);
+	checkMemoryAllocation(state,
+			      state->segmentsRead[state->numSegmentsRead],
+			      __LINE__, __FILE__, "segment path");
+	state->numSegmentsRead++;
+      }
+    }
+  }
+
+
+  // Return TRUE if an image was already read as a segment of a split
+  // image.
+  int segmentAlreadyRead(struct scalpelState *state, char *imagefile) {
+
+    char path[PATH_MAX];
+    int i;
+
+    if(state->numSegmentsRead == 0 || !realpath(imagefile, path)) {
+      return FALSE;
+    }
+    for(i = 0; i < state->numSegmentsRead; i++) {
+      if(strcmp(state->segmentsRead[i], path) == 0) {
+	return TRUE;
+      }
+    }
+    return FALSE;
+  }
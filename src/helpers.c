@@ -23,9 +23,17 @@
 
 #include "scalpel.h"
 
+// vectorized string search requires GCC-style target attributes and
+// runtime CPU feature detection
+#if defined(USE_FAST_STRING_SEARCH) && defined(__GNUC__) && \
+  (defined(__x86_64__) || defined(__i386__))
+#define SIMD_STRING_SEARCH
+#include <immintrin.h>
+#endif
+
 // get # of seconds between two specified times
 #if defined(_WIN32)
-inline double elapsed(LARGE_INTEGER A, LARGE_INTEGER B) {
+double elapsed(LARGE_INTEGER A, LARGE_INTEGER B) {
   LARGE_INTEGER freq;
   QueryPerformanceFrequency(&freq);
   return fabs(((double)A.QuadPart - (double)B.QuadPart) /
@@ -33,7 +41,7 @@ inline double elapsed(LARGE_INTEGER A, LARGE_INTEGER B) {
 }
 #else
 double elapsed(struct timeval A, struct timeval B) {
-  return fabs(A.tv_sec - B.tv_sec) + fabs(A.tv_usec - B.tv_usec) / 1000000;
+  return fabs((A.tv_sec - B.tv_sec) + (A.tv_usec - B.tv_usec) / 1000000.0);
 }
 #endif
 
@@ -136,15 +144,201 @@ int memwildcardcmp(const void *s1, const void *s2, size_t n, int caseSensitive)
 }
 
 
+// load an 8-byte word of a candidate match, without alignment
+// requirements
+static unsigned long long loadWord(const char *s) {
+
+  unsigned long long w;
+
+  memcpy(&w, s, sizeof(w));
+  return w;
+}
+
+
+// needles shorter than a word are compared with a single partial word
+static int verifyPartialWord(const NeedleVerifier * v, const char *s) {
+
+  unsigned long long w = 0;
+
+  memcpy(&w, s, v->length);
+  return (w & v->mask[0]) == v->value[0];
+}
+
+
+// needles of 8 to 16 bytes are compared with two, possibly
+// overlapping, words
+static int verifyTwoWords(const NeedleVerifier * v, const char *s) {
+
+  return ((loadWord(s) & v->mask[0]) == v->value[0]) &
+    ((loadWord(s + v->length - 8) & v->mask[1]) == v->value[1]);
+}
+
+
+static int verifyWords(const NeedleVerifier * v, const char *s) {
+
+  size_t i;
+
+  for(i = 0; i + 1 < v->numwords; i++) {
+    if((loadWord(s + 8 * i) & v->mask[i]) != v->value[i]) {
+      return FALSE;
+    }
+  }
+  return (loadWord(s + v->length - 8) & v->mask[i]) == v->value[i];
+}
+
+
+// longer needles without wildcards or case-insensitive letters
+static int verifyExact(const NeedleVerifier * v, const char *s) {
+
+  return !memcmp(v->needle, s, v->length);
+}
+
+
+// roughly how many bits of a match a needle byte decides: fill bytes
+// and spaces are common in disk images and decide little, and letters
+// of case-insensitive needles match either case
+static int fragmentByteBits(unsigned char c, int casesensitive) {
+
+  if(c == 0x00 || c == 0xff || c == ' ') {
+    return 2;
+  }
+  if(!casesensitive && ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))) {
+    return 7;
+  }
+  return 8;
+}
+
+
+// Choose the literal fragment of a needle that's searched for when the
+// needle contains wildcards: the run of non-wildcard bytes expected to
+// match least often, by the bits it decides.  Matches of the whole
+// needle are verified around each fragment match.  A needle without
+// wildcards is its own fragment.  Returns FALSE, with the whole needle
+// as the fragment, if the needle consists only of wildcards.
+int
+find_needle_fragment(char *needle, size_t len, int casesensitive,
+		     size_t *offset, size_t *length) {
+
+  size_t i, runstart = 0;
+  int bits = 0, bestbits = 0;
+
+  *offset = 0;
+  *length = len;
+  for(i = 0; i <= len; i++) {
+    if(i == len || needle[i] == wildcard) {
+      if(bits > bestbits) {
+	bestbits = bits;
+	*offset = runstart;
+	*length = i - runstart;
+      }
+      runstart = i + 1;
+      bits = 0;
+    }
+    else {
+      bits += fragmentByteBits((unsigned char)needle[i], casesensitive);
+    }
+  }
+  return bestbits > 0;
+}
+
+
+// prepare a needle for verification of candidate matches.  A byte of a
+// candidate matches a needle byte as in charactersMatch(): the
+// wildcard matches anything, and in case-insensitive needles, an ASCII
+// letter matches either case, which differs only in bit 0x20.
+void
+init_needle_verifier(struct scalpelState *state, NeedleVerifier * v,
+		     char *needle, size_t len, int casesensitive) {
+
+  unsigned char value[MAX_STRING_LENGTH], mask[MAX_STRING_LENGTH];
+  size_t i, offset;
+  int exact = TRUE;
+
+  v->needle = needle;
+  v->length = len;
+  v->casesensitive = casesensitive;
+  find_needle_fragment(needle, len, casesensitive, &(v->fragoffset),
+		       &(v->fraglength));
+  v->numwords = len < 8 ? 1 : (len + 7) / 8;
+  v->value = (unsigned long long *)
+    calloc(v->numwords, sizeof(unsigned long long));
+  checkMemoryAllocation(state, v->value, __LINE__, __FILE__,
+			"needle verifier");
+  v->mask = (unsigned long long *)
+    calloc(v->numwords, sizeof(unsigned long long));
+  checkMemoryAllocation(state, v->mask, __LINE__, __FILE__,
+			"needle verifier");
+
+  for(i = 0; i < len; i++) {
+    if(needle[i] == wildcard) {
+      value[i] = 0;
+      mask[i] = 0;
+      exact = FALSE;
+    }
+    else if(!casesensitive && ((needle[i] >= 'A' && needle[i] <= 'Z') ||
+			       (needle[i] >= 'a' && needle[i] <= 'z'))) {
+      value[i] = needle[i] & ~0x20;
+      mask[i] = (unsigned char)~0x20;
+      exact = FALSE;
+    }
+    else {
+      value[i] = needle[i];
+      mask[i] = 0xFF;
+    }
+  }
+
+  // words are laid out as candidates are loaded, so the comparison
+  // doesn't depend on byte order
+  if(len < 8) {
+    memcpy(v->value, value, len);
+    memcpy(v->mask, mask, len);
+  }
+  else {
+    for(i = 0; i < v->numwords; i++) {
+      offset = i + 1 < v->numwords ? 8 * i : len - 8;
+      memcpy(&(v->value[i]), value + offset, 8);
+      memcpy(&(v->mask[i]), mask + offset, 8);
+    }
+  }
+
+  if(len < 8) {
+    v->verify = verifyPartialWord;
+  }
+  else if(len <= 16) {
+    v->verify = verifyTwoWords;
+  }
+  else if(exact) {
+    v->verify = verifyExact;
+  }
+  else {
+    v->verify = verifyWords;
+  }
+}
+
+
+void destroy_needle_verifier(NeedleVerifier * v) {
+
+  free(v->value);
+  free(v->mask);
+  v->value = 0;
+  v->mask = 0;
+}
+
+
 // initialize Boyer-Moore "jump table" for search. Dependence
 // on search type (e.g., FORWARD, REVERSE, etc.) from Foremost 
 // has been removed, because Scalpel always performs searches across
-// a buffer in a forward direction.
+// a buffer in a forward direction.  The table is for the needle's
+// literal fragment (see find_needle_fragment()), so wildcards elsewhere
+// in the needle don't limit the shifts.
 void
 init_bm_table(char *needle, size_t table[UCHAR_MAX + 1],
 	      size_t len, int casesensitive) {
 
-  size_t i = 0, j = 0, currentindex = 0;
+  size_t i = 0, j = 0, currentindex = 0, offset;
+
+  find_needle_fragment(needle, len, casesensitive, &offset, &len);
+  needle += offset;
 
   for(i = 0; i <= UCHAR_MAX; i++) {
     table[i] = len;
@@ -171,27 +365,19 @@ init_bm_table(char *needle, size_t table[UCHAR_MAX + 1],
 // Perform a simple string search, supporting wildcards,
 // case-insensitive searches, and specifiable start locations in the buffer.
 // The parameter 'table' is ignored.
-char *bm_needleinhaystack_skipnchars(char *needle, size_t needle_len,
+char *bm_needleinhaystack_skipnchars(const NeedleVerifier * needle,
 				     char *haystack, size_t haystack_len,
 				     size_t table[UCHAR_MAX + 1],
-				     int casesensitive, int start_pos) {
+				     int start_pos) {
 
-  register int i, j, go;
+  register size_t i;
 
-  if(needle_len == 0) {
+  if(needle->length == 0) {
     return haystack;
   }
 
-  for(i = start_pos; i < haystack_len; i++) {
-    go = 1;
-    j = 0;
-    while (go) {
-      go = (i + j) < haystack_len && j < needle_len &&
-	charactersMatch(needle[j], haystack[i + j], casesensitive);
-      j++;
-    }
-
-    if(j > needle_len) {
+  for(i = start_pos; i + needle->length <= haystack_len; i++) {
+    if(needle->verify(needle, haystack + i)) {
       return haystack + i;
     }
   }
@@ -209,30 +395,40 @@ char *bm_needleinhaystack_skipnchars(char *needle, size_t needle_len,
 // Perform a modified Boyer-Moore string search, supporting wildcards,
 // case-insensitive searches, and specifiable start locations in the buffer.
 // Dependence on search type (e.g., FORWARD, REVERSe, etc.) from Foremost has 
-// been removed, because Scalpel always performs forward searching.
-char *bm_needleinhaystack_skipnchars(char *needle, size_t needle_len,
-				     char *haystack, size_t haystack_len,
-				     size_t table[UCHAR_MAX + 1],
-				     int casesensitive, int start_pos) {
-
+// been removed, because Scalpel always performs forward searching.  The
+// needle's literal fragment is searched for with 'table', and the whole
+// needle is verified around each match of the fragment.
+static char *horspool_needleinhaystack(const NeedleVerifier * needle,
+				       char *haystack, size_t haystack_len,
+				       size_t table[UCHAR_MAX + 1],
+				       int start_pos) {
+
+  // pos is the position of the last byte of the fragment, which is
+  // fragend bytes into the needle and followed by 'after' more
+  size_t fragend = needle->fragoffset + needle->fraglength;
+  size_t after = needle->length - fragend;
   register size_t shift = 0;
-  register size_t pos = start_pos;
+  register size_t pos;
+  size_t limit;
   char *here;
 
-  if(needle_len == 0) {
-    return haystack;
+  if(haystack_len < after) {
+    return NULL;
+  }
+  limit = haystack_len - after;
+  pos = (size_t)start_pos > after ? start_pos - after : 0;
+  if(pos + 1 < fragend) {
+    pos = fragend - 1;
   }
 
-  while (pos < haystack_len) {
-    while (pos < haystack_len
+  while (pos < limit) {
+    while (pos < limit
 	   && (shift = table[(unsigned char)haystack[pos]]) > 0) {
       pos += shift;
     }
     if(0 == shift) {
-      if(0 ==
-	 memwildcardcmp(needle, here =
-			(char *)&haystack[pos - needle_len + 1],
-			needle_len, casesensitive)) {
+      here = &haystack[pos + 1 - fragend];
+      if(needle->verify(needle, here)) {
 	return (here);
       }
       else {
@@ -243,36 +439,271 @@ char *bm_needleinhaystack_skipnchars(char *needle, size_t needle_len,
   return NULL;
 }
 
+
+#ifdef SIMD_STRING_SEARCH
+
+// The vectorized searches compare 16 (SSE2) or 32 (AVX2) candidate
+// positions at a time against two "probe" characters from the needle--
+// the first and last non-wildcard characters--and fully verify only
+// the candidates where both probes match.  For case-insensitive searches
+// each probe also matches the other case of an ASCII letter, which is
+// the only pairing charactersMatch() allows.
+typedef struct NeedleProbes {
+  size_t first, last;		// offsets of the probe characters
+  char first1, first2;		// first probe and its case variant
+  char last1, last2;		// last probe and its case variant
+} NeedleProbes;
+
+static int stringsearchlevel = STRING_SEARCH_SCALAR;
+
+
+// return the other case of an ASCII letter, or the character itself
+static char otherCase(char c, int casesensitive) {
+
+  if(!casesensitive && ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))) {
+    return c ^ 0x20;
+  }
+  return c;
+}
+
+
+// choose probe characters for a needle: the ends of its literal
+// fragment, or the fragment and the needle's last non-wildcard character
+// if the fragment is a single character.  Returns FALSE if the needle
+// consists only of wildcards.
+static int findNeedleProbes(const NeedleVerifier * v, NeedleProbes * probes) {
+
+  char *needle = v->needle;
+  size_t needle_len = v->length;
+  int casesensitive = v->casesensitive;
+  size_t i;
+
+  for(i = 0; i < needle_len && needle[i] == wildcard; i++);
+  if(i == needle_len) {
+    return FALSE;
+  }
+  probes->first = v->fragoffset;
+  probes->last = v->fragoffset + v->fraglength - 1;
+  if(probes->first == probes->last) {
+    for(i = needle_len - 1; needle[i] == wildcard; i--);
+    probes->last = i;
+  }
+
+  probes->first1 = needle[probes->first];
+  probes->first2 = otherCase(probes->first1, casesensitive);
+  probes->last1 = needle[probes->last];
+  probes->last2 = otherCase(probes->last1, casesensitive);
+  return TRUE;
+}
+
+
+// scalar search for the candidates left over at the end of the haystack
+static char *probe_needleinhaystack(const NeedleVerifier * needle,
+				    char *haystack, size_t haystack_len,
+				    size_t pos, NeedleProbes * probes) {
+
+  char c;
+
+  for(; pos + needle->length <= haystack_len; pos++) {
+    c = haystack[pos + probes->first];
+    if(c != probes->first1 && c != probes->first2) {
+      continue;
+    }
+    c = haystack[pos + probes->last];
+    if(c != probes->last1 && c != probes->last2) {
+      continue;
+    }
+    if(needle->verify(needle, haystack + pos)) {
+      return haystack + pos;
+    }
+  }
+  return NULL;
+}
+
+
+static char *sse2_needleinhaystack(const NeedleVerifier * needle,
+				   char *haystack, size_t haystack_len,
+				   size_t pos, NeedleProbes * probes)
+  __attribute__ ((target("sse2")));
+
+static char *sse2_needleinhaystack(const NeedleVerifier * needle,
+				   char *haystack, size_t haystack_len,
+				   size_t pos, NeedleProbes * probes) {
+
+  const __m128i first1 = _mm_set1_epi8(probes->first1);
+  const __m128i first2 = _mm_set1_epi8(probes->first2);
+  const __m128i last1 = _mm_set1_epi8(probes->last1);
+  const __m128i last2 = _mm_set1_epi8(probes->last2);
+  __m128i block;
+  unsigned int mask, bit;
+
+  while (pos + needle->length + 15 <= haystack_len) {
+    block = _mm_loadu_si128((const __m128i *)(haystack + pos + probes->first));
+    mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, first1),
+					  _mm_cmpeq_epi8(block, first2)));
+    if(mask) {
+      block = _mm_loadu_si128((const __m128i *)(haystack + pos + probes->last));
+      mask &= _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, last1),
+					     _mm_cmpeq_epi8(block, last2)));
+      while (mask) {
+	bit = __builtin_ctz(mask);
+	if(needle->verify(needle, haystack + pos + bit)) {
+	  return haystack + pos + bit;
+	}
+	mask &= mask - 1;
+      }
+    }
+    pos += 16;
+  }
+
+  return probe_needleinhaystack(needle, haystack, haystack_len, pos,
+				probes);
+}
+
+
+static char *avx2_needleinhaystack(const NeedleVerifier * needle,
+				   char *haystack, size_t haystack_len,
+				   size_t pos, NeedleProbes * probes)
+  __attribute__ ((target("avx2")));
+
+static char *avx2_needleinhaystack(const NeedleVerifier * needle,
+				   char *haystack, size_t haystack_len,
+				   size_t pos, NeedleProbes * probes) {
+
+  const __m256i first1 = _mm256_set1_epi8(probes->first1);
+  const __m256i first2 = _mm256_set1_epi8(probes->first2);
+  const __m256i last1 = _mm256_set1_epi8(probes->last1);
+  const __m256i last2 = _mm256_set1_epi8(probes->last2);
+  __m256i block;
+  unsigned int mask, bit;
+
+  while (pos + needle->length + 31 <= haystack_len) {
+    block =
+      _mm256_loadu_si256((const __m256i *)(haystack + pos + probes->first));
+    mask =
+      _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, first1),
+					   _mm256_cmpeq_epi8(block, first2)));
+    if(mask) {
+      block =
+	_mm256_loadu_si256((const __m256i *)(haystack + pos + probes->last));
+      mask &=
+	_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, last1),
+					     _mm256_cmpeq_epi8(block, last2)));
+      while (mask) {
+	bit = __builtin_ctz(mask);
+	if(needle->verify(needle, haystack + pos + bit)) {
+	  return haystack + pos + bit;
+	}
+	mask &= mask - 1;
+      }
+    }
+    pos += 32;
+  }
+
+  return probe_needleinhaystack(needle, haystack, haystack_len, pos,
+				probes);
+}
+
+#endif // SIMD_STRING_SEARCH
+
+
+// Find the first occurrence of needle in haystack that ends at or after
+// position start_pos, supporting wildcards and case-insensitive searches.
+// Vectorized searches are used if the CPU supports them; otherwise, a
+// modified Boyer-Moore search using 'table' is performed.
+char *bm_needleinhaystack_skipnchars(const NeedleVerifier * needle,
+				     char *haystack, size_t haystack_len,
+				     size_t table[UCHAR_MAX + 1],
+				     int start_pos) {
+
+#ifdef SIMD_STRING_SEARCH
+  NeedleProbes probes;
+  size_t pos;
 #endif
 
+  if(needle->length == 0) {
+    return haystack;
+  }
+
+#ifdef SIMD_STRING_SEARCH
+  if(stringsearchlevel != STRING_SEARCH_SCALAR &&
+     findNeedleProbes(needle, &probes)) {
+    // first candidate position for the start of the needle
+    pos = (size_t)start_pos + 1 >= needle->length ?
+      (size_t)start_pos + 1 - needle->length : 0;
+    if(stringsearchlevel == STRING_SEARCH_AVX2) {
+      return avx2_needleinhaystack(needle, haystack, haystack_len, pos,
+				   &probes);
+    }
+    return sse2_needleinhaystack(needle, haystack, haystack_len, pos,
+				 &probes);
+  }
+#endif
+
+  return horspool_needleinhaystack(needle, haystack, haystack_len, table,
+				   start_pos);
+}
 
-char *bm_needleinhaystack(char *needle, size_t needle_len,
+#endif
+
+
+// select the fastest string search supported by the CPU.  Must be called
+// before any searches are performed.
+void init_string_search(void) {
+
+#ifdef SIMD_STRING_SEARCH
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) {
+    stringsearchlevel = STRING_SEARCH_AVX2;
+  }
+  else if(__builtin_cpu_supports("sse2")) {
+    stringsearchlevel = STRING_SEARCH_SSE2;
+  }
+#endif
+}
+
+
+// return the string search selected by init_string_search()
+int string_search_level(void) {
+
+#ifdef SIMD_STRING_SEARCH
+  return stringsearchlevel;
+#else
+  return STRING_SEARCH_SCALAR;
+#endif
+}
+
+
+char *bm_needleinhaystack(const NeedleVerifier * needle,
 			  char *haystack, size_t haystack_len,
-			  size_t table[UCHAR_MAX + 1], int casesensitive) {
+			  size_t table[UCHAR_MAX + 1]) {
 
   return bm_needleinhaystack_skipnchars(needle,
-					needle_len,
 					haystack,
 					haystack_len,
-					table, casesensitive, needle_len - 1);
+					table, needle->length - 1);
 }
 
 
 
 // find longest header OR footer.  Headers or footers which are
 // regular expressions are assigned LARGEST_REGEXP_OVERLAP lengths, to
-// allow for regular expressions spanning SIZE_OF_BUFFER-sized chunks
-// of the disk image.
+// allow for regular expressions spanning buffer-sized chunks
+// of the disk image, unless they're searched for with a streaming DFA,
+// which carries its state across chunks.
 int findLongestNeedle(struct SearchSpecLine *SearchSpec) {
   int longest = 0;
   int i = 0;
   int lenb, lene;
   for(i = 0; SearchSpec[i].suffix != NULL; i++) {
     lenb =
-      SearchSpec[i].beginisRE ? LARGEST_REGEXP_OVERLAP : SearchSpec[i].
-      beginlength;
+      SearchSpec[i].beginisRE ? (SearchSpec[i].begindfa ? 1 :
+				 LARGEST_REGEXP_OVERLAP) :
+      SearchSpec[i].beginlength;
     lene =
-      SearchSpec[i].endisRE ? LARGEST_REGEXP_OVERLAP : SearchSpec[i].endlength;
+      SearchSpec[i].endisRE ? (SearchSpec[i].enddfa ? 1 :
+			       LARGEST_REGEXP_OVERLAP) :
+      SearchSpec[i].endlength;
     if(lenb > longest) {
       longest = lenb;
     }
@@ -286,23 +717,368 @@ int findLongestNeedle(struct SearchSpecLine *SearchSpec) {
 
 // do a regular expression search using the Tre regular expression
 // library.  The needle is a previously compiled regular expression
-// (via Tre regcomp()).  The caller must free the memory associated 
-// with the returned regmatch_t structure.
-regmatch_t *re_needleinhaystack(regex_t * needle, char *haystack,
-				size_t haystack_len) {
+// (via Tre regcomp()).  On a match, the offsets of the match are
+// stored in the caller's regmatch_t structure and TRUE is returned.
+int re_needleinhaystack(regex_t * needle, char *haystack,
+			size_t haystack_len, regmatch_t * match) {
 
-  regmatch_t *match = (regmatch_t *) malloc(sizeof(regmatch_t));
+  // LMIII temp fix till working with g++
+  return !regnexec(needle, haystack, (size_t) haystack_len, (size_t) 1,
+		   match, 0);
+}
 
 
-  // LMIII temp fix till working with g++
-  if(!regnexec(needle, haystack, (size_t) haystack_len, (size_t) 1, match, 0)) {
-    // match
-    return match;
+// state for the search for the longest run of literal characters that
+// every match of a regular expression must contain
+typedef struct RegexLiteralRun {
+  char run[MAX_STRING_LENGTH];	// run being collected
+  size_t runlength;
+  size_t runbefore;		// max width of the regex before the run
+  RegexLiteral *best;		// longest complete run so far
+  int alternation;		// top level of the regex has alternatives
+} RegexLiteralRun;
+
+static int parseRegexAtom(char *re, size_t len, size_t * pos,
+			  size_t * width, int *c);
+static int parseRegexQuantifier(char *re, size_t len, size_t * pos,
+				size_t * min, size_t * max);
+static int parseRegexBranches(char *re, size_t len, size_t * pos,
+			      int depth, size_t * width,
+			      RegexLiteralRun * lit);
+static size_t addRegexWidth(size_t a, size_t b);
+static void endRegexLiteralRun(RegexLiteralRun * lit);
+
+
+static size_t addRegexWidth(size_t a, size_t b) {
+
+  if(a == REGEX_UNBOUNDED || b == REGEX_UNBOUNDED ||
+     a + b >= REGEX_UNBOUNDED) {
+    return REGEX_UNBOUNDED;
   }
-  else {
-    // no match
+  return a + b;
+}
+
+
+static void endRegexLiteralRun(RegexLiteralRun * lit) {
+
+  if(lit->runlength > lit->best->length) {
+    memcpy(lit->best->literal, lit->run, lit->runlength);
+    lit->best->length = lit->runlength;
+    lit->best->before = lit->runbefore;
+  }
+  lit->runlength = 0;
+}
+
+
+// parse one atom of an extended regular expression, as understood by
+// Tre, starting at re[*pos].  The atom's maximum width is stored in
+// *width, and *c is set to the character matched by the atom if it's a
+// single literal character, or -1 otherwise.  Returns FALSE for
+// constructs the literal prefilter doesn't handle, including anchors
+// and assertions, which depend on text outside the prefilter's window.
+static int parseRegexAtom(char *re, size_t len, size_t * pos,
+			  size_t * width, int *c) {
+
+  char hex[3];
+  unsigned long val;
+  char *close;
+  size_t end;
+
+  *width = 1;
+  *c = -1;
+
+  switch (re[*pos]) {
+  case '(':
+    (*pos)++;
+    if(*pos < len && re[*pos] == '?') {
+      // Tre extensions such as "(?i)"
+      return FALSE;
+    }
+    if(!parseRegexBranches(re, len, pos, 1, width, 0) ||
+       *pos >= len || re[*pos] != ')') {
+      return FALSE;
+    }
+    (*pos)++;
+    return TRUE;
+  case '[':
+    (*pos)++;
+    if(*pos < len && re[*pos] == '^') {
+      (*pos)++;
+    }
+    if(*pos < len && re[*pos] == ']') {
+      (*pos)++;
+    }
+    while (*pos < len && re[*pos] != ']') {
+      if(re[*pos] == '[' && *pos + 1 < len &&
+	 (re[*pos + 1] == ':' || re[*pos + 1] == '=' || re[*pos + 1] == '.')) {
+	// character class, equivalence class or collating symbol
+	for(end = *pos + 2; end + 1 < len; end++) {
+	  if(re[end] == re[*pos + 1] && re[end + 1] == ']') {
+	    break;
+	  }
+	}
+	if(end + 1 >= len) {
+	  return FALSE;
+	}
+	*pos = end + 2;
+      }
+      else {
+	(*pos)++;
+      }
+    }
+    if(*pos >= len) {
+      return FALSE;
+    }
+    (*pos)++;
+    return TRUE;
+  case '.':
+    (*pos)++;
+    return TRUE;
+  case '\\':
+    (*pos)++;
+    if(*pos >= len) {
+      return FALSE;
+    }
+    switch (re[(*pos)++]) {
+    case 't':
+      *c = '\t';
+      return TRUE;
+    case 'n':
+      *c = '\n';
+      return TRUE;
+    case 'r':
+      *c = '\r';
+      return TRUE;
+    case 'f':
+      *c = '\f';
+      return TRUE;
+    case 'a':
+      *c = '\a';
+      return TRUE;
+    case 'e':
+      *c = 033;
+      return TRUE;
+    case 'w':
+    case 'W':
+    case 's':
+    case 'S':
+    case 'd':
+    case 'D':
+      return TRUE;
+    case 'x':
+      if(*pos < len && re[*pos] == '{') {
+	close = (char *)memchr(re + *pos, '}', len - *pos);
+	if(!close || close - (re + *pos) > 3) {
+	  return FALSE;
+	}
+	memset(hex, 0, sizeof(hex));
+	memcpy(hex, re + *pos + 1, close - (re + *pos) - 1);
+	*pos = close - re + 1;
+      }
+      else {
+	memset(hex, 0, sizeof(hex));
+	for(end = 0;
+	    end < 2 && *pos < len && isxdigit((unsigned char)re[*pos]);
+	    end++) {
+	  hex[end] = re[(*pos)++];
+	}
+      }
+      val = strtoul(hex, 0, 16);
+      *c = (int)val;
+      return TRUE;
+    default:
+      // back references, word boundaries and Tre's "\Q" can't be
+      // handled; other escaped characters stand for themselves
+      (*pos)--;
+      if(isalnum((unsigned char)re[*pos]) ||
+	 re[*pos] == '<' || re[*pos] == '>') {
+	return FALSE;
+      }
+      *c = (unsigned char)re[(*pos)++];
+      return TRUE;
+    }
+  case '^':
+  case '$':
+  case '*':
+  case '+':
+  case '?':
+  case '{':
+  case '|':
+  case ')':
+    return FALSE;
+  default:
+    *c = (unsigned char)re[(*pos)++];
+    return TRUE;
+  }
+}
+
+
+// parse an optional repetition operator following an atom, storing the
+// minimum and maximum repetition counts
+static int parseRegexQuantifier(char *re, size_t len, size_t * pos,
+				size_t * min, size_t * max) {
+
+  char *end;
+
+  *min = *max = 1;
+  if(*pos >= len) {
+    return TRUE;
+  }
+
+  switch (re[*pos]) {
+  case '*':
+    *min = 0;
+    *max = REGEX_UNBOUNDED;
+    (*pos)++;
+    break;
+  case '+':
+    *max = REGEX_UNBOUNDED;
+    (*pos)++;
+    break;
+  case '?':
+    *min = 0;
+    (*pos)++;
+    break;
+  case '{':
+    (*pos)++;
+    if(*pos >= len || !isdigit((unsigned char)re[*pos])) {
+      return FALSE;
+    }
+    *min = *max = strtoul(re + *pos, &end, 10);
+    *pos = end - re;
+    if(*pos < len && re[*pos] == ',') {
+      (*pos)++;
+      *max = REGEX_UNBOUNDED;
+      if(*pos < len && isdigit((unsigned char)re[*pos])) {
+	*max = strtoul(re + *pos, &end, 10);
+	*pos = end - re;
+      }
+    }
+    if(*pos >= len || re[*pos] != '}' || *max < *min) {
+      return FALSE;
+    }
+    (*pos)++;
+    break;
+  default:
+    return TRUE;
+  }
+
+  // minimal (non-greedy) repetition doesn't change the widths
+  if(*pos < len && re[*pos] == '?') {
+    (*pos)++;
+  }
+  // give up on stacked repetition operators
+  if(*pos < len && (re[*pos] == '*' || re[*pos] == '+' ||
+		    re[*pos] == '?' || re[*pos] == '{')) {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+
+// parse a list of alternatives, up to the end of the regular expression
+// or an unmatched ')'.  The maximum width of a match is stored in
+// *width.  At the top level (depth 0), runs of required literal
+// characters are collected in lit.
+static int parseRegexBranches(char *re, size_t len, size_t * pos,
+			      int depth, size_t * width,
+			      RegexLiteralRun * lit) {
+
+  size_t branchwidth = 0, atomwidth, min, max;
+  int c;
+
+  *width = 0;
+  while (*pos < len) {
+    if(re[*pos] == '|') {
+      if(branchwidth > *width) {
+	*width = branchwidth;
+      }
+      branchwidth = 0;
+      if(lit) {
+	lit->alternation = TRUE;
+      }
+      (*pos)++;
+      continue;
+    }
+    if(re[*pos] == ')' && depth > 0) {
+      break;
+    }
+    if(!parseRegexAtom(re, len, pos, &atomwidth, &c) ||
+       !parseRegexQuantifier(re, len, pos, &min, &max)) {
+      return FALSE;
+    }
+
+    if(lit) {
+      if(c >= 0 && min > 0) {
+	// a required character extends the current run, but the run ends
+	// after a repeated character
+	if(lit->runlength == 0) {
+	  lit->runbefore = branchwidth;
+	}
+	lit->run[lit->runlength++] = (char)c;
+	if(max != 1) {
+	  endRegexLiteralRun(lit);
+	}
+      }
+      else {
+	endRegexLiteralRun(lit);
+      }
+    }
+
+    if(max == 0) {
+      atomwidth = 0;
+    }
+    else if(max == REGEX_UNBOUNDED && atomwidth > 0) {
+      atomwidth = REGEX_UNBOUNDED;
+    }
+    else if(atomwidth != REGEX_UNBOUNDED) {
+      atomwidth = max > REGEX_UNBOUNDED / (atomwidth ? atomwidth : 1) ?
+	REGEX_UNBOUNDED : atomwidth * max;
+    }
+    branchwidth = addRegexWidth(branchwidth, atomwidth);
+  }
+
+  if(branchwidth > *width) {
+    *width = branchwidth;
+  }
+  if(lit) {
+    endRegexLiteralRun(lit);
+  }
+  return TRUE;
+}
+
+
+// find the longest literal string that every match of a regular
+// expression (without its enclosing '/'s) must contain, along with
+// bounds on where matches can start and end relative to the literal.
+// Returns NULL if there's no such literal, e.g., when the regular
+// expression has top-level alternatives or uses constructs that can't
+// be analyzed.
+RegexLiteral *extractRegexLiteral(struct scalpelState *state, char *re,
+				  size_t len, int casesensitive) {
+
+  RegexLiteralRun lit;
+  size_t pos = 0;
+
+  lit.best = (RegexLiteral *) malloc(sizeof(RegexLiteral));
+  checkMemoryAllocation(state, lit.best, __LINE__, __FILE__,
+			"regular expression literal");
+  lit.best->length = 0;
+  lit.runlength = 0;
+  lit.alternation = FALSE;
+
+  if(!parseRegexBranches(re, len, &pos, 0, &(lit.best->width), &lit) ||
+     pos != len || lit.alternation || lit.best->length == 0) {
+    free(lit.best);
     return NULL;
   }
+
+  lit.best->casesensitive = casesensitive;
+  init_bm_table(lit.best->literal, lit.best->table, lit.best->length,
+		casesensitive);
+  init_needle_verifier(state, &(lit.best->verifier), lit.best->literal,
+		       lit.best->length, casesensitive);
+  return lit.best;
 }
 
 
@@ -522,6 +1298,37 @@ void setttywidth(void) {
 int skipInFile(struct scalpelState *state, FILE * infile) {
 
   int retries = 0;
+  char discard[SCALPEL_BLOCK_SIZE];
+  unsigned long long left;
+  size_t n;
+
+  // a stream can't be seeked, so read past the skipped bytes instead
+  if(isStreamedImage(state->imagefile, infile)) {
+    for(left = state->skip; left > 0; left -= n) {
+      n = left < sizeof(discard) ? left : sizeof(discard);
+      if(fread(discard, 1, n, infile) != n) {
+#ifdef _WIN32
+	fprintf(stderr,
+		"ERROR: Image file %s ended before %I64u bytes were skipped\n",
+		state->imagefile, state->skip);
+#else
+	fprintf(stderr,
+		"ERROR: Image file %s ended before %lld bytes were skipped\n",
+		state->imagefile, state->skip);
+#endif
+	return FALSE;
+      }
+    }
+#ifdef _WIN32
+    fprintf(stderr, "Skipped the first %I64u bytes of %s...\n",
+	    state->skip, state->imagefile);
+#else
+    fprintf(stderr, "Skipped the first %lld bytes of %s...\n",
+	    state->skip, state->imagefile);
+#endif
+    return TRUE;
+  }
+
   while (TRUE) {
     if((fseeko(infile, state->skip, SEEK_SET))) {
 
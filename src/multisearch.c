@@ -0,0 +1,643 @@
+// Scalpel Copyright (C) 2005-11 by Golden G. Richard III and
+// 2007-11 by Vico Marziale.
+// Written by Golden G. Richard III and Vico Marziale.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+//
+// Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+// on Foremost.  Foremost 0.69 was used as the starting point for
+// Scalpel, in 2005.
+
+// Aho-Corasick multi-pattern search for fixed-string headers and
+// footers.  See multisearch.h.
+
+#include "scalpel.h"
+
+static unsigned char foldCase(unsigned char c);
+static void recordHit(struct scalpelState *state, MultiSearchHits * hits,
+		      MultiSearchPattern * p, size_t pos);
+static void scanPattern(struct scalpelState *state, MultiSearchPattern * p,
+			char *buf, size_t buflen, size_t from, size_t to,
+			MultiSearchHits * hits);
+static size_t chooseKey(MultiSearchPattern * p, size_t keylength);
+static unsigned int indexKey(MultiSearchIndex * x, const unsigned char *s);
+static unsigned int indexBucket(MultiSearchIndex * x, unsigned int key);
+static void compileIndex(struct scalpelState *state, MultiSearch * ms);
+static void scanIndex(struct scalpelState *state, MultiSearch * ms,
+		      MultiSearchIndex * x, char *buf, size_t buflen,
+		      size_t from, size_t to, MultiSearchHits * hits);
+static void freeHitChunks(MultiSearchHitChunk * chunk);
+
+
+// The automaton runs over case-folded input, so that case-insensitive
+// needles need only one path through the trie.  Case-sensitive needles
+// containing letters are verified after an anchor hit.  Folding matches
+// charactersMatch(), which only pairs ASCII letters.
+static unsigned char foldCase(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+
+void multisearch_init(MultiSearch * ms) {
+
+  memset(ms, 0, sizeof(MultiSearch));
+}
+
+
+// register a needle with the automaton.  The needle isn't copied, so
+// it must remain valid until multisearch_destroy() is called.
+void
+multisearch_add(struct scalpelState *state, MultiSearch * ms,
+		char *needle, size_t length, size_t table[UCHAR_MAX + 1],
+		int casesensitive, int rule, int kind) {
+
+  MultiSearchPattern *p;
+  size_t i;
+  int hasletters = 0;
+
+  if(ms->numpatterns == ms->patternstorage) {
+    ms->patternstorage = ms->patternstorage ? ms->patternstorage * 2 : 64;
+    ms->patterns = (MultiSearchPattern *)
+      realloc(ms->patterns, ms->patternstorage * sizeof(MultiSearchPattern));
+    checkMemoryAllocation(state, ms->patterns, __LINE__, __FILE__,
+			  "multisearch patterns");
+  }
+
+  p = &(ms->patterns[ms->numpatterns++]);
+  p->needle = needle;
+  p->length = length;
+  p->table = table;
+  p->casesensitive = casesensitive;
+  p->rule = rule;
+  p->kind = kind;
+  p->next = -1;
+  p->keytable = -1;
+  p->keyoffset = 0;
+  init_needle_verifier(state, &(p->verifier), needle, length, casesensitive);
+
+  // anchor is the needle's literal fragment.  Needles consisting only of
+  // wildcards have none.
+  if(!find_needle_fragment(needle, length, casesensitive,
+			   &(p->anchoroffset), &(p->anchorlength))) {
+    p->anchoroffset = 0;
+    p->anchorlength = 0;
+  }
+  for(i = 0; i < length; i++) {
+    if((needle[i] >= 'A' && needle[i] <= 'Z') ||
+       (needle[i] >= 'a' && needle[i] <= 'z')) {
+      hasletters = 1;
+    }
+  }
+
+  p->verify = (p->anchorlength != length) || (casesensitive && hasletters);
+}
+
+
+// build the automaton for all registered needles
+void multisearch_compile(struct scalpelState *state, MultiSearch * ms) {
+
+  unsigned int maxstates = 1, s, t, c, nc, head = 0, tail = 0;
+  unsigned int *queue, *fail;
+  int i, used[256];
+  size_t j;
+  MultiSearchPattern *p;
+
+  // map the (folded) bytes used by anchors to equivalence classes;
+  // every other byte value shares class 0
+  memset(used, 0, sizeof(used));
+  for(i = 0; i < ms->numpatterns; i++) {
+    p = &(ms->patterns[i]);
+    for(j = 0; j < p->anchorlength; j++) {
+      used[foldCase((unsigned char)p->needle[p->anchoroffset + j])] = 1;
+    }
+    maxstates += p->anchorlength;
+    if(p->anchoroffset + p->anchorlength > ms->longestanchorend) {
+      ms->longestanchorend = p->anchoroffset + p->anchorlength;
+    }
+  }
+  ms->unanchored = (int *)malloc((ms->numpatterns + 1) * sizeof(int));
+  checkMemoryAllocation(state, ms->unanchored, __LINE__, __FILE__,
+			"multisearch unanchored");
+
+  if(ms->numpatterns > MULTISEARCH_MAX_AUTOMATON_PATTERNS) {
+    compileIndex(state, ms);
+    return;
+  }
+
+  nc = 1;
+  for(c = 0; c < 256; c++) {
+    if(used[c]) {
+      used[c] = nc++;
+    }
+  }
+  for(c = 0; c < 256; c++) {
+    ms->classmap[c] = used[foldCase(c)];
+  }
+  ms->numclasses = nc;
+
+  ms->delta = (unsigned int *)malloc(maxstates * nc * sizeof(unsigned int));
+  checkMemoryAllocation(state, ms->delta, __LINE__, __FILE__,
+			"multisearch transitions");
+  ms->firstpattern = (int *)malloc(maxstates * sizeof(int));
+  checkMemoryAllocation(state, ms->firstpattern, __LINE__, __FILE__,
+			"multisearch outputs");
+  ms->outputlink = (int *)malloc(maxstates * sizeof(int));
+  checkMemoryAllocation(state, ms->outputlink, __LINE__, __FILE__,
+			"multisearch outputs");
+  queue = (unsigned int *)malloc(maxstates * sizeof(unsigned int));
+  checkMemoryAllocation(state, queue, __LINE__, __FILE__, "multisearch queue");
+  fail = (unsigned int *)malloc(maxstates * sizeof(unsigned int));
+  checkMemoryAllocation(state, fail, __LINE__, __FILE__, "multisearch queue");
+
+  // build trie of anchors.  During construction, 0 marks a missing
+  // transition--no transition can lead back to the root state.
+  memset(ms->delta, 0, maxstates * nc * sizeof(unsigned int));
+  ms->firstpattern[0] = -1;
+  ms->outputlink[0] = -1;
+  ms->numstates = 1;
+  ms->numunanchored = 0;
+  for(i = 0; i < ms->numpatterns; i++) {
+    p = &(ms->patterns[i]);
+    if(p->anchorlength == 0) {
+      ms->unanchored[ms->numunanchored++] = i;
+      continue;
+    }
+    s = 0;
+    for(j = 0; j < p->anchorlength; j++) {
+      c = ms->classmap[(unsigned char)p->needle[p->anchoroffset + j]];
+      if(!ms->delta[s * nc + c]) {
+	ms->firstpattern[ms->numstates] = -1;
+	ms->outputlink[ms->numstates] = -1;
+	ms->delta[s * nc + c] = ms->numstates++;
+      }
+      s = ms->delta[s * nc + c];
+    }
+    p->next = ms->firstpattern[s];
+    ms->firstpattern[s] = i;
+  }
+
+  // breadth-first computation of failure transitions, turning the
+  // trie into a complete DFA
+  fail[0] = 0;
+  for(c = 0; c < nc; c++) {
+    if((t = ms->delta[c])) {
+      fail[t] = 0;
+      queue[tail++] = t;
+    }
+  }
+  while (head < tail) {
+    s = queue[head++];
+    for(c = 0; c < nc; c++) {
+      t = ms->delta[s * nc + c];
+      if(t) {
+	fail[t] = ms->delta[fail[s] * nc + c];
+	ms->outputlink[t] = ms->firstpattern[fail[t]] >= 0 ?
+	  (int)fail[t] : ms->outputlink[fail[t]];
+	queue[tail++] = t;
+      }
+      else {
+	ms->delta[s * nc + c] = ms->delta[fail[s] * nc + c];
+      }
+    }
+  }
+
+  // premultiply transitions by the row width and flag output states
+  for(s = 0; s < ms->numstates * nc; s++) {
+    t = ms->delta[s];
+    ms->delta[s] = t * nc;
+    if(ms->firstpattern[t] >= 0 || ms->outputlink[t] >= 0) {
+      ms->delta[s] |= MULTISEARCH_OUTPUT;
+    }
+  }
+
+  free(queue);
+  free(fail);
+}
+
+
+// choose the key for a needle in the anchor index: the run of keylength
+// bytes of the anchor containing the fewest bytes that are common in disk
+// images (fill bytes and spaces), so that keys match rarely.  Returns the
+// offset of the key within the needle.
+static size_t chooseKey(MultiSearchPattern * p, size_t keylength) {
+
+  size_t i, j, score, bestscore = keylength + 1, best = p->anchoroffset;
+  unsigned char c;
+
+  for(i = p->anchoroffset; i + keylength <= p->anchoroffset + p->anchorlength;
+      i++) {
+    score = 0;
+    for(j = i; j < i + keylength; j++) {
+      c = (unsigned char)p->needle[j];
+      score += (c == 0x00 || c == 0xff || c == ' ');
+    }
+    if(score < bestscore) {
+      bestscore = score;
+      best = i;
+    }
+  }
+  return best;
+}
+
+
+// key at s, with bit 0x20 of each byte cleared
+static unsigned int indexKey(MultiSearchIndex * x, const unsigned char *s) {
+
+  unsigned int k;
+  unsigned short k2;
+
+  switch (x->keylength) {
+  case 1:
+    return s[0] & 0xDF;
+  case 2:
+    memcpy(&k2, s, 2);
+    return k2 & 0xDFDF;
+  default:
+    memcpy(&k, s, 4);
+    return k & 0xDFDFDFDFU;
+  }
+}
+
+
+// bucket for a key.  Shorter keys index their tables directly.
+static unsigned int indexBucket(MultiSearchIndex * x, unsigned int key) {
+
+  return x->keylength == 4 ? (key * 2654435761U) >> (32 - x->bits) : key;
+}
+
+
+// build the anchor index used instead of the automaton for many needles.
+// Each needle is entered in the table for the longest key its anchor can
+// hold.
+static void compileIndex(struct scalpelState *state, MultiSearch * ms) {
+
+  static const unsigned int keylengths[MULTISEARCH_NUM_KEYS] = { 1, 2, 4 };
+  MultiSearchIndex *x;
+  MultiSearchPattern *p;
+  MultiSearchEntry *e;
+  unsigned int b, key, numbuckets;
+  int i, t;
+
+  ms->useindex = TRUE;
+  ms->numunanchored = 0;
+  for(t = 0; t < MULTISEARCH_NUM_KEYS; t++) {
+    ms->index[t].keylength = keylengths[t];
+    ms->index[t].numpatterns = 0;
+  }
+
+  for(i = 0; i < ms->numpatterns; i++) {
+    p = &(ms->patterns[i]);
+    if(p->anchorlength == 0) {
+      ms->unanchored[ms->numunanchored++] = i;
+      continue;
+    }
+    p->keytable = p->anchorlength >= 4 ? MULTISEARCH_KEY4 :
+      p->anchorlength >= 2 ? MULTISEARCH_KEY2 : MULTISEARCH_KEY1;
+    p->keyoffset = chooseKey(p, keylengths[p->keytable]);
+    ms->index[p->keytable].numpatterns++;
+  }
+
+  for(t = 0; t < MULTISEARCH_NUM_KEYS; t++) {
+    x = &(ms->index[t]);
+    if(x->numpatterns == 0) {
+      continue;
+    }
+
+    // 4-byte keys are hashed into a table with at least 32 buckets per
+    // needle; shorter keys index their tables directly
+    x->bits = 8 * x->keylength;
+    if(x->keylength == 4) {
+      for(x->bits = 12; x->bits < 22 && (1U << x->bits) < 32U *
+	  (unsigned int)x->numpatterns; x->bits++);
+    }
+    numbuckets = 1U << x->bits;
+
+    x->bucketstart = (int *)calloc(numbuckets + 1, sizeof(int));
+    checkMemoryAllocation(state, x->bucketstart, __LINE__, __FILE__,
+			  "multisearch index");
+    x->bucketentries = (MultiSearchEntry *)
+      malloc(x->numpatterns * sizeof(MultiSearchEntry));
+    checkMemoryAllocation(state, x->bucketentries, __LINE__, __FILE__,
+			  "multisearch index");
+    x->filter = (unsigned char *)calloc(numbuckets / 8 + 1, 1);
+    checkMemoryAllocation(state, x->filter, __LINE__, __FILE__,
+			  "multisearch index");
+
+    // count needles per bucket, then place them, in order
+    for(i = 0; i < ms->numpatterns; i++) {
+      p = &(ms->patterns[i]);
+      if(p->keytable == t) {
+	b = indexBucket(x, indexKey(x, (const unsigned char *)p->needle +
+				    p->keyoffset));
+	x->bucketstart[b + 1]++;
+	x->filter[b >> 3] |= 1 << (b & 7);
+      }
+    }
+    for(b = 0; b < numbuckets; b++) {
+      x->bucketstart[b + 1] += x->bucketstart[b];
+    }
+    for(i = 0; i < ms->numpatterns; i++) {
+      p = &(ms->patterns[i]);
+      if(p->keytable == t) {
+	key = indexKey(x, (const unsigned char *)p->needle + p->keyoffset);
+	e = &(x->bucketentries[x->bucketstart[indexBucket(x, key)]++]);
+	e->key = key;
+	e->keyoffset = p->keyoffset;
+	e->pattern = i;
+      }
+    }
+    // placing the needles advanced each bucket's start to the next's
+    for(b = numbuckets; b > 0; b--) {
+      x->bucketstart[b] = x->bucketstart[b - 1];
+    }
+    x->bucketstart[0] = 0;
+  }
+}
+
+
+// search for the needles in one table of the anchor index.  Every
+// position where a key could lie is hashed, and the needles in the
+// bucket with the same key are verified.
+static void
+scanIndex(struct scalpelState *state, MultiSearch * ms, MultiSearchIndex * x,
+	  char *buf, size_t buflen, size_t from, size_t to,
+	  MultiSearchHits * hits) {
+
+  const unsigned char *hay = (const unsigned char *)buf;
+  MultiSearchPattern *p;
+  MultiSearchEntry *e;
+  size_t i, end, start;
+  unsigned int b, key;
+  int k;
+
+  // keys lie within the needles' anchors
+  end = to + ms->longestanchorend;
+  if(end > buflen) {
+    end = buflen;
+  }
+
+  for(i = from; i + x->keylength <= end; i++) {
+    key = indexKey(x, hay + i);
+    b = indexBucket(x, key);
+    if(!(x->filter[b >> 3] & (1 << (b & 7)))) {
+      continue;
+    }
+    for(k = x->bucketstart[b]; k < x->bucketstart[b + 1]; k++) {
+      e = &(x->bucketentries[k]);
+      if(e->key != key || i < from + e->keyoffset) {
+	continue;
+      }
+      start = i - e->keyoffset;
+      p = &(ms->patterns[e->pattern]);
+      if(start >= to || start + p->length > buflen) {
+	continue;
+      }
+      if(p->verifier.verify(&(p->verifier), buf + start)) {
+	recordHit(state, hits, p, start);
+      }
+    }
+  }
+}
+
+
+// append a match to a list of hits
+static void
+recordHit(struct scalpelState *state, MultiSearchHits * hits,
+	  MultiSearchPattern * p, size_t pos) {
+
+  multisearch_hits_add(state, hits, p->rule, p->kind, pos, p->length);
+}
+
+
+// search for a single needle with bm_needleinhaystack_skipnchars()
+static void
+scanPattern(struct scalpelState *state, MultiSearchPattern * p,
+	    char *buf, size_t buflen, size_t from, size_t to,
+	    MultiSearchHits * hits) {
+
+  size_t end = to + p->length - 1;
+  size_t pos = from + p->length - 1;
+  char *found;
+
+  if(end > buflen) {
+    end = buflen;
+  }
+  while (pos < end &&
+	 (found = bm_needleinhaystack_skipnchars(&(p->verifier), buf, end,
+						 p->table, pos))) {
+    recordHit(state, hits, p, found - buf);
+    // resume with the match ending one byte later
+    pos = found - buf + p->length;
+  }
+}
+
+
+// Scan 'buf' for all registered needles, appending one hit for each
+// match that starts in [from, to) and lies entirely within the first
+// 'buflen' bytes of the buffer.  Hits for any single needle are
+// appended in ascending order of position.
+void
+multisearch_scan(struct scalpelState *state, MultiSearch * ms,
+		 char *buf, size_t buflen, size_t from, size_t to,
+		 MultiSearchHits * hits) {
+
+  register const unsigned int *delta = ms->delta;
+  register const unsigned char *classmap = ms->classmap;
+  register const unsigned char *hay = (const unsigned char *)buf;
+  register unsigned int s = 0;
+  size_t i, end, start;
+  int k, st, pid;
+  MultiSearchPattern *p;
+
+  if(to > buflen) {
+    to = buflen;
+  }
+  if(from >= to) {
+    return;
+  }
+
+  // for a handful of needles, separate vectorized searches beat a
+  // byte-at-a-time walk of the automaton
+  if(ms->numpatterns <= MULTISEARCH_MAX_VECTOR_PATTERNS &&
+     string_search_level() != STRING_SEARCH_SCALAR) {
+    for(k = 0; k < ms->numpatterns; k++) {
+      scanPattern(state, &(ms->patterns[k]), buf, buflen, from, to, hits);
+    }
+    return;
+  }
+
+  // needles consisting only of wildcards match everywhere they fit
+  for(k = 0; k < ms->numunanchored; k++) {
+    p = &(ms->patterns[ms->unanchored[k]]);
+    for(i = from; i < to && i + p->length <= buflen; i++) {
+      if(p->verifier.verify(&(p->verifier), buf + i)) {
+	recordHit(state, hits, p, i);
+      }
+    }
+  }
+
+  if(ms->useindex) {
+    for(k = 0; k < MULTISEARCH_NUM_KEYS; k++) {
+      if(ms->index[k].numpatterns > 0) {
+	scanIndex(state, ms, &(ms->index[k]), buf, buflen, from, to, hits);
+      }
+    }
+    return;
+  }
+
+  if(ms->numstates <= 1) {
+    return;
+  }
+
+  end = to + ms->longestanchorend - 1;
+  if(end > buflen) {
+    end = buflen;
+  }
+
+  for(i = from; i < end; i++) {
+    s = delta[(s & ~MULTISEARCH_OUTPUT) + classmap[hay[i]]];
+    if(!(s & MULTISEARCH_OUTPUT)) {
+      continue;
+    }
+
+    // walk every needle that ends at position i
+    st = (s & ~MULTISEARCH_OUTPUT) / ms->numclasses;
+    if(ms->firstpattern[st] < 0) {
+      st = ms->outputlink[st];
+    }
+    while (st >= 0) {
+      for(pid = ms->firstpattern[st]; pid >= 0; pid = p->next) {
+	p = &(ms->patterns[pid]);
+	// anchor occupies [i + 1 - anchorlength, i]
+	if(i + 1 < from + p->anchoroffset + p->anchorlength) {
+	  continue;
+	}
+	start = i + 1 - p->anchorlength - p->anchoroffset;
+	if(start >= to || start + p->length > buflen) {
+	  continue;
+	}
+	if(p->verify && !p->verifier.verify(&(p->verifier), buf + start)) {
+	  continue;
+	}
+	recordHit(state, hits, p, start);
+      }
+      st = ms->outputlink[st];
+    }
+  }
+}
+
+
+void multisearch_destroy(MultiSearch * ms) {
+
+  int i;
+
+  for(i = 0; i < ms->numpatterns; i++) {
+    destroy_needle_verifier(&(ms->patterns[i].verifier));
+  }
+  for(i = 0; i < MULTISEARCH_NUM_KEYS; i++) {
+    free(ms->index[i].bucketstart);
+    free(ms->index[i].bucketentries);
+    free(ms->index[i].filter);
+  }
+  free(ms->patterns);
+  free(ms->delta);
+  free(ms->firstpattern);
+  free(ms->outputlink);
+  free(ms->unanchored);
+  multisearch_init(ms);
+}
+
+
+void multisearch_hits_init(MultiSearchHits * hits) {
+
+  hits->first = 0;
+  hits->last = 0;
+  hits->spare = 0;
+  hits->numhits = 0;
+}
+
+
+// append a match to a list of hits, adding a chunk when the last one
+// is full
+void
+multisearch_hits_add(struct scalpelState *state, MultiSearchHits * hits,
+		     int rule, int kind, size_t pos, size_t length) {
+
+  MultiSearchHitChunk *chunk = hits->last;
+  MultiSearchHit *hit;
+
+  if(chunk == 0 || chunk->numhits == MULTISEARCH_HITS_PER_CHUNK) {
+    if(hits->spare) {
+      chunk = hits->spare;
+      hits->spare = chunk->next;
+    }
+    else {
+      chunk = (MultiSearchHitChunk *) malloc(sizeof(MultiSearchHitChunk));
+      checkMemoryAllocation(state, chunk, __LINE__, __FILE__,
+			    "multisearch hits");
+    }
+    chunk->next = 0;
+    chunk->numhits = 0;
+    if(hits->last) {
+      hits->last->next = chunk;
+    }
+    else {
+      hits->first = chunk;
+    }
+    hits->last = chunk;
+  }
+
+  hit = &(chunk->hits[chunk->numhits++]);
+  hit->rule = rule;
+  hit->kind = kind;
+  hit->pos = pos;
+  hit->length = length;
+  hits->numhits++;
+}
+
+
+// empty a list of hits.  The chunks just emptied are kept for reuse,
+// and spare chunks that went unused since the last reset are released,
+// so a list holds about as many chunks as its recent fills needed.
+void multisearch_hits_reset(MultiSearchHits * hits) {
+
+  freeHitChunks(hits->spare);
+  hits->spare = hits->first;
+  hits->first = 0;
+  hits->last = 0;
+  hits->numhits = 0;
+}
+
+
+void multisearch_hits_destroy(MultiSearchHits * hits) {
+
+  freeHitChunks(hits->first);
+  freeHitChunks(hits->spare);
+  multisearch_hits_init(hits);
+}
+
+
+// release a chain of chunks of hits
+static void freeHitChunks(MultiSearchHitChunk * chunk) {
+
+  MultiSearchHitChunk *next;
+
+  while (chunk) {
+    next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+}
@@ -0,0 +1,202 @@
+// Scalpel Copyright (C) 2005-11 by Golden G. Richard III and
+// 2007-11 by Vico Marziale.
+// Written by Golden G. Richard III and Vico Marziale.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+//
+// Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+// on Foremost.  Foremost 0.69 was used as the starting point for
+// Scalpel, in 2005.
+
+// Multi-pattern search for fixed-string (non-regular expression)
+// headers and footers.  All fixed-string needles from the
+// configuration file are compiled into a single Aho-Corasick
+// automaton, so each buffer of the image is examined once, no matter
+// how many file types are being carved.  Needles containing wildcards
+// are entered into the automaton by their literal fragment (the
+// "anchor"), the wildcard-free run expected to match least often, and
+// are verified in full around each anchor hit.
+//
+// With thousands of needles, the automaton's transition table no longer
+// fits in cache, so needles are instead bucketed by a hashed 1, 2 or 4
+// byte "key" taken from their anchors.  The buffer is hashed at every
+// position and the needles in matching buckets are verified.
+
+#ifndef MULTISEARCH_H
+#define MULTISEARCH_H
+
+#include <stddef.h>
+#include <limits.h>
+
+#define MULTISEARCH_HEADER      0
+#define MULTISEARCH_FOOTER      1
+
+// high bit of a transition marks a target state with output
+#define MULTISEARCH_OUTPUT      0x80000000U
+
+// with this many needles or fewer, each needle is searched for
+// separately with the vectorized string search, if it's available
+#define MULTISEARCH_MAX_VECTOR_PATTERNS  4
+
+// with more needles than this, the anchor index is used instead of the
+// automaton
+#define MULTISEARCH_MAX_AUTOMATON_PATTERNS  64
+
+// number of matches stored in each chunk of a list of hits
+#define MULTISEARCH_HITS_PER_CHUNK  4096
+
+// anchor index tables, by key length
+#define MULTISEARCH_KEY1        0
+#define MULTISEARCH_KEY2        1
+#define MULTISEARCH_KEY4        2
+#define MULTISEARCH_NUM_KEYS    3
+
+// A fixed-string needle prepared for verifying candidate matches, by
+// init_needle_verifier().  The needle is compared with a candidate 8
+// bytes at a time: each word of the candidate is masked and compared
+// with a precomputed value, with wildcard bytes masked out entirely and
+// letters in case-insensitive needles masked to ignore case.  verify()
+// is specialized for the needle's length and for needles that need no
+// masking at all.
+typedef struct NeedleVerifier NeedleVerifier;
+typedef int (*NeedleVerifyFn) (const NeedleVerifier * v, const char *s);
+
+struct NeedleVerifier {
+  NeedleVerifyFn verify;	// returns TRUE if s begins with a match
+  char *needle;			// translate()-d needle, not owned
+  size_t length;
+  int casesensitive;
+  size_t fragoffset;		// literal fragment searched for, by
+  size_t fraglength;		// find_needle_fragment()
+  size_t numwords;		// words compared; the last word ends at the
+				// end of the needle and may overlap the one
+				// before it
+  unsigned long long *value;	// expected value of each masked word
+  unsigned long long *mask;
+};
+
+// one needle registered with the automaton
+typedef struct MultiSearchPattern {
+  char *needle;			// translate()-d needle, owned by the SearchSpecLine
+  size_t length;		// length of the needle
+  NeedleVerifier verifier;	// full comparison for the needle
+  size_t *table;		// Boyer-Moore jump table for the needle
+  size_t anchoroffset;		// offset of the anchor within the needle
+  size_t anchorlength;		// length of the anchor
+  int casesensitive;
+  int verify;			// is a full comparison needed after an anchor hit?
+  int rule;			// index of the file type in the SearchSpec array
+  int kind;			// MULTISEARCH_HEADER or MULTISEARCH_FOOTER
+  int next;			// next pattern ending in the same state, or -1
+  int keytable;			// anchor index table holding the needle
+  size_t keyoffset;		// offset of the key within the needle
+} MultiSearchPattern;
+
+// one needle match discovered in a buffer
+typedef struct MultiSearchHit {
+  int rule;
+  int kind;
+  size_t pos;			// offset of the match in the buffer
+  size_t length;
+} MultiSearchHit;
+
+// a needle in a bucket of the anchor index.  The key and its offset
+// are copied from the needle so that most candidates can be rejected
+// without touching the needle.
+typedef struct MultiSearchEntry {
+  unsigned int key;		// needle's key, with bit 0x20 of each byte clear
+  unsigned int keyoffset;	// offset of the key within the needle
+  int pattern;
+} MultiSearchEntry;
+
+// needles bucketed by the hash of a fixed-length key.  Keys are
+// compared with bit 0x20 of each byte cleared, which folds case; the
+// extra matches this allows are weeded out by verification.
+typedef struct MultiSearchIndex {
+  unsigned int keylength;	// 1, 2 or 4
+  unsigned int bits;		// log2 of the number of buckets
+  int numpatterns;
+  int *bucketstart;		// needles in bucket b are bucketentries
+  MultiSearchEntry *bucketentries;	// [bucketstart[b], bucketstart[b+1])
+  unsigned char *filter;	// bit set for each non-empty bucket
+} MultiSearchIndex;
+
+// matches are stored in fixed-size chunks, so a list grows to the
+// number of matches actually found without copying the matches already
+// stored
+typedef struct MultiSearchHitChunk {
+  struct MultiSearchHitChunk *next;
+  size_t numhits;
+  MultiSearchHit hits[MULTISEARCH_HITS_PER_CHUNK];
+} MultiSearchHitChunk;
+
+// growable list of matches, filled by multisearch_scan().  Each search
+// task owns a list, so a list is only ever filled by one worker at a
+// time.  Chunks emptied by multisearch_hits_reset() are kept for reuse.
+typedef struct MultiSearchHits {
+  MultiSearchHitChunk *first;	// chunks holding matches, in order
+  MultiSearchHitChunk *last;	// chunk being filled
+  MultiSearchHitChunk *spare;	// emptied chunks
+  size_t numhits;
+} MultiSearchHits;
+
+typedef struct MultiSearch {
+  MultiSearchPattern *patterns;
+  int numpatterns;
+  int patternstorage;
+  size_t longestanchorend;	// max(anchoroffset + anchorlength)
+
+  // compiled automaton.  Input bytes are case-folded and mapped to
+  // equivalence classes; transitions hold the premultiplied row
+  // offset of the target state, with MULTISEARCH_OUTPUT set when the
+  // target state (or a state on its failure chain) ends a needle.
+  unsigned char classmap[256];
+  unsigned int numclasses;
+  unsigned int numstates;
+  unsigned int *delta;		// numstates * numclasses transitions
+  int *firstpattern;		// first pattern ending in each state, or -1
+  int *outputlink;		// nearest state on failure chain with output, or -1
+
+  // anchor index, used instead of the automaton for many needles
+  int useindex;
+  MultiSearchIndex index[MULTISEARCH_NUM_KEYS];
+
+  // needles with no wildcard-free run can't be entered in the
+  // automaton and are tried at every position
+  int *unanchored;
+  int numunanchored;
+} MultiSearch;
+
+struct scalpelState;
+
+void multisearch_init (MultiSearch * ms);
+void multisearch_add (struct scalpelState *state, MultiSearch * ms,
+		      char *needle, size_t length,
+		      size_t table[UCHAR_MAX + 1], int casesensitive,
+		      int rule, int kind);
+void multisearch_compile (struct scalpelState *state, MultiSearch * ms);
+void multisearch_scan (struct scalpelState *state, MultiSearch * ms,
+		       char *buf, size_t buflen, size_t from, size_t to,
+		       MultiSearchHits * hits);
+void multisearch_destroy (MultiSearch * ms);
+
+void multisearch_hits_init (MultiSearchHits * hits);
+void multisearch_hits_add (struct scalpelState *state, MultiSearchHits * hits,
+			   int rule, int kind, size_t pos, size_t length);
+void multisearch_hits_reset (MultiSearchHits * hits);
+void multisearch_hits_destroy (MultiSearchHits * hits);
+
+#endif // MULTISEARCH_H
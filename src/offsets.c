@@ -0,0 +1,521 @@
+// Scalpel Copyright (C) 2005-11 by Golden G. Richard III and
+// 2007-11 by Vico Marziale.
+// Written by Golden G. Richard III and Vico Marziale.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+//
+// Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+// on Foremost.  Foremost 0.69 was used as the starting point for
+// Scalpel, in 2005.
+
+
+// Compressed storage for header/footer positions.  See offsets.h.
+
+#include "scalpel.h"
+
+static size_t varintLength(unsigned long long v);
+static unsigned char *putVarint(unsigned char *p, unsigned long long v);
+static unsigned char *getVarint(unsigned char *p, unsigned long long *v);
+static unsigned char *reserve(struct scalpelState *state, OffsetList * list,
+			      size_t bytes, int *grown);
+static int encodeBlock(struct scalpelState *state, OffsetList * list);
+static void decodeBlock(OffsetBlock * block, unsigned char *data,
+			unsigned long long *positions, size_t *lengths);
+static void spillReadFailure(OffsetSpill * spill);
+static OffsetBlock *findBlock(OffsetList * list, unsigned long long b);
+static int cacheBlock(OffsetList * list, unsigned long long b);
+
+
+void offsets_init(OffsetList * list) {
+
+  list->count = 0;
+  list->storage = 0;
+  list->spilledblocks = 0;
+  list->blocks = 0;
+  list->numblocks = 0;
+  list->blockstorage = 0;
+  list->pool = 0;
+  list->spill = 0;
+  list->runs = 0;
+  list->numruns = 0;
+  list->runstorage = 0;
+  list->rundirectory = 0;
+  list->loadedrun = 0;
+  list->tailpositions = 0;
+  list->taillengths = 0;
+  list->cache = 0;
+}
+
+
+// number of bytes in the varint encoding of v
+static size_t varintLength(unsigned long long v) {
+
+  size_t n = 1;
+
+  while (v >= 0x80) {
+    v >>= 7;
+    n++;
+  }
+  return n;
+}
+
+
+// store v as a varint--7 bits per byte, least significant first, with
+// the high bit set on all but the last byte
+static unsigned char *putVarint(unsigned char *p, unsigned long long v) {
+
+  while (v >= 0x80) {
+    *p++ = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (unsigned char)v;
+  return p;
+}
+
+
+static unsigned char *getVarint(unsigned char *p, unsigned long long *v) {
+
+  int shift = 0;
+
+  *v = 0;
+  while (*p & 0x80) {
+    *v |= (unsigned long long)(*p++ & 0x7f) << shift;
+    shift += 7;
+  }
+  *v |= (unsigned long long)(*p++) << shift;
+  return p;
+}
+
+
+// space for an encoded block in the list's newest pool chunk, or in a
+// new chunk if it's full
+static unsigned char *
+reserve(struct scalpelState *state, OffsetList * list, size_t bytes,
+	int *grown) {
+
+  OffsetPoolChunk *chunk = list->pool;
+  size_t size;
+  unsigned char *data;
+
+  if(chunk == 0 || chunk->size - chunk->used < bytes) {
+    size = chunk ? chunk->size * 2 : OFFSETS_FIRST_POOL_CHUNK;
+    if(size > OFFSETS_MAX_POOL_CHUNK) {
+      size = OFFSETS_MAX_POOL_CHUNK;
+    }
+    while (size < bytes) {
+      size *= 2;
+    }
+    chunk = (OffsetPoolChunk *) malloc(sizeof(OffsetPoolChunk) + size);
+    checkMemoryAllocation(state, chunk, __LINE__, __FILE__, "offset pool");
+    chunk->next = list->pool;
+    chunk->size = size;
+    chunk->used = 0;
+    list->pool = chunk;
+    list->storage += size;
+    *grown = TRUE;
+  }
+
+  data = (unsigned char *)(chunk + 1) + chunk->used;
+  chunk->used += bytes;
+  return data;
+}
+
+
+// encode the full block of unencoded entries.  Returns TRUE if storage
+// for the list had to be grown.
+static int encodeBlock(struct scalpelState *state, OffsetList * list) {
+
+  unsigned long long *p = list->tailpositions;
+  size_t *l = list->taillengths;
+  unsigned long long span, d;
+  size_t deltabytes = 0, bitmapbytes = 0, lengthbytes = 0, bytes;
+  int ascending = TRUE, distinct = TRUE, uniform = TRUE;
+  int grown = FALSE;
+  OffsetBlock *block;
+  unsigned char *data;
+  int k;
+
+  for(k = 1; k < OFFSETS_BLOCK_ENTRIES; k++) {
+    if(p[k] < p[k - 1]) {
+      ascending = FALSE;
+    }
+    else {
+      distinct = distinct && p[k] != p[k - 1];
+      deltabytes += varintLength(p[k] - p[k - 1]);
+    }
+    uniform = uniform && l[k] == l[0];
+  }
+  if(!uniform) {
+    for(k = 0; k < OFFSETS_BLOCK_ENTRIES; k++) {
+      lengthbytes += varintLength(l[k]);
+    }
+  }
+
+  if(list->numblocks == list->blockstorage) {
+    list->storage -= list->blockstorage * sizeof(OffsetBlock);
+    list->blockstorage = list->blockstorage ? list->blockstorage * 2 : 16;
+    list->blocks = (OffsetBlock *)
+      realloc(list->blocks, list->blockstorage * sizeof(OffsetBlock));
+    checkMemoryAllocation(state, list->blocks, __LINE__, __FILE__,
+			  "offset blocks");
+    list->storage += list->blockstorage * sizeof(OffsetBlock);
+    grown = TRUE;
+  }
+  block = &(list->blocks[list->numblocks]);
+  block->first = p[0];
+  block->length = uniform ? l[0] : OFFSETS_VARIABLE_LENGTH;
+
+  // the bitmap has a bit for each byte after the first position, up to
+  // the last
+  span = p[OFFSETS_BLOCK_ENTRIES - 1] - p[0];
+  if(!ascending) {
+    block->encoding = OFFSETS_RAW;
+    bytes = (OFFSETS_BLOCK_ENTRIES - 1) * sizeof(unsigned long long);
+  }
+  else if(distinct && span / 8 + 1 < deltabytes) {
+    block->encoding = OFFSETS_BITMAP;
+    bitmapbytes = (size_t)(span / 8 + 1);
+    bytes = bitmapbytes;
+  }
+  else {
+    block->encoding = OFFSETS_DELTA;
+    bytes = deltabytes;
+  }
+
+  data = reserve(state, list, bytes + lengthbytes, &grown);
+  block->data = data;
+  block->spillpos = 0;
+  block->size = bytes + lengthbytes;
+  switch (block->encoding) {
+  case OFFSETS_RAW:
+    memcpy(data, p + 1, bytes);
+    data += bytes;
+    break;
+  case OFFSETS_BITMAP:
+    memset(data, 0, bitmapbytes);
+    for(k = 1; k < OFFSETS_BLOCK_ENTRIES; k++) {
+      d = p[k] - p[0];
+      data[d >> 3] |= (unsigned char)(1 << (d & 7));
+    }
+    data += bitmapbytes;
+    break;
+  default:
+    for(k = 1; k < OFFSETS_BLOCK_ENTRIES; k++) {
+      data = putVarint(data, p[k] - p[k - 1]);
+    }
+    break;
+  }
+  if(!uniform) {
+    for(k = 0; k < OFFSETS_BLOCK_ENTRIES; k++) {
+      data = putVarint(data, l[k]);
+    }
+  }
+  list->numblocks++;
+
+  if(list->cache == 0) {
+    list->cache = (OffsetCache *) malloc(sizeof(OffsetCache));
+    checkMemoryAllocation(state, list->cache, __LINE__, __FILE__,
+			  "offset cache");
+    for(k = 0; k < OFFSETS_CACHED_BLOCKS; k++) {
+      list->cache->block[k] = ULLONG_MAX;
+    }
+    list->cache->next = 0;
+    list->storage += sizeof(OffsetCache);
+    grown = TRUE;
+  }
+  return grown;
+}
+
+
+// decode all entries of an encoded block, whose data is at 'data'
+static void
+decodeBlock(OffsetBlock * block, unsigned char *data,
+	    unsigned long long *positions, size_t *lengths) {
+
+  unsigned long long v;
+  unsigned char bits;
+  int k, b;
+  size_t j;
+
+  positions[0] = block->first;
+  switch (block->encoding) {
+  case OFFSETS_RAW:
+    memcpy(positions + 1, data,
+	   (OFFSETS_BLOCK_ENTRIES - 1) * sizeof(unsigned long long));
+    data += (OFFSETS_BLOCK_ENTRIES - 1) * sizeof(unsigned long long);
+    break;
+  case OFFSETS_BITMAP:
+    k = 1;
+    for(j = 0; k < OFFSETS_BLOCK_ENTRIES; j++) {
+      bits = data[j];
+      for(b = 0; bits; b++, bits >>= 1) {
+	if(bits & 1) {
+	  positions[k++] = block->first + j * 8 + b;
+	}
+      }
+    }
+    data += j;
+    break;
+  default:
+    for(k = 1; k < OFFSETS_BLOCK_ENTRIES; k++) {
+      data = getVarint(data, &v);
+      positions[k] = positions[k - 1] + v;
+    }
+    break;
+  }
+
+  for(k = 0; k < OFFSETS_BLOCK_ENTRIES; k++) {
+    if(block->length == OFFSETS_VARIABLE_LENGTH) {
+      data = getVarint(data, &v);
+      lengths[k] = (size_t)v;
+    }
+    else {
+      lengths[k] = block->length;
+    }
+  }
+}
+
+
+// the spill file is only read during carve planning, where there's no
+// way to recover from a failed read
+static void spillReadFailure(OffsetSpill * spill) {
+
+  scalpelLog(spill->state,
+	     "ERROR: Couldn't read header/footer spill file %s\n",
+	     spill->filename);
+  handleError(spill->state, SCALPEL_ERROR_FATAL_READ);
+}
+
+
+// directory entry for block b of the list, reading the directory of
+// the run holding it if the block has been spilled
+static OffsetBlock *findBlock(OffsetList * list, unsigned long long b) {
+
+  OffsetRun *run;
+  size_t lo, hi, mid;
+
+  if(b >= list->spilledblocks) {
+    return &(list->blocks[b - list->spilledblocks]);
+  }
+
+  run = &(list->runs[list->loadedrun]);
+  if(list->rundirectory == 0 || b < run->firstblock ||
+     b >= run->firstblock + run->numblocks) {
+    // binary search for the last run starting at or before block b
+    lo = 0;
+    hi = list->numruns - 1;
+    while (lo < hi) {
+      mid = (lo + hi + 1) / 2;
+      if(list->runs[mid].firstblock <= b) {
+	lo = mid;
+      }
+      else {
+	hi = mid - 1;
+      }
+    }
+    list->loadedrun = lo;
+    run = &(list->runs[lo]);
+
+    free(list->rundirectory);
+    list->rundirectory = (OffsetBlock *)
+      malloc(run->numblocks * sizeof(OffsetBlock));
+    checkMemoryAllocation(list->spill->state, list->rundirectory,
+			  __LINE__, __FILE__, "spilled offset blocks");
+    if(fseeko(list->spill->file, run->directory, SEEK_SET) ||
+       fread(list->rundirectory, sizeof(OffsetBlock), run->numblocks,
+	     list->spill->file) != run->numblocks) {
+      spillReadFailure(list->spill);
+    }
+  }
+  return &(list->rundirectory[b - run->firstblock]);
+}
+
+
+// cache slot holding the decoded entries of block b, decoding it if
+// necessary
+static int cacheBlock(OffsetList * list, unsigned long long b) {
+
+  OffsetCache *cache = list->cache;
+  OffsetBlock *block;
+  unsigned char *data;
+  int slot;
+
+  for(slot = 0; slot < OFFSETS_CACHED_BLOCKS; slot++) {
+    if(cache->block[slot] == b) {
+      return slot;
+    }
+  }
+  slot = cache->next;
+  cache->next = (cache->next + 1) % OFFSETS_CACHED_BLOCKS;
+  block = findBlock(list, b);
+  data = block->data;
+  if(data == 0) {
+    data = cache->data;
+    if(fseeko(list->spill->file, block->spillpos, SEEK_SET) ||
+       fread(data, 1, block->size, list->spill->file) != block->size) {
+      spillReadFailure(list->spill);
+    }
+  }
+  decodeBlock(block, data, cache->positions[slot], cache->lengths[slot]);
+  cache->block[slot] = b;
+  return slot;
+}
+
+
+// append an entry to the list.  Entries must be appended in ascending
+// order of position to compress well.  Returns TRUE if storage for the
+// list had to be grown.
+int
+offsets_append(struct scalpelState *state, OffsetList * list,
+	       unsigned long long position, size_t length) {
+
+  size_t k = (size_t)(list->count & OFFSETS_BLOCK_MASK);
+  int grown = FALSE;
+
+  if(list->tailpositions == 0) {
+    list->tailpositions = (unsigned long long *)
+      malloc(OFFSETS_BLOCK_ENTRIES * sizeof(unsigned long long));
+    checkMemoryAllocation(state, list->tailpositions, __LINE__, __FILE__,
+			  "offset array");
+    list->taillengths = (size_t *)
+      malloc(OFFSETS_BLOCK_ENTRIES * sizeof(size_t));
+    checkMemoryAllocation(state, list->taillengths, __LINE__, __FILE__,
+			  "offset array");
+    list->storage += OFFSETS_BLOCK_ENTRIES *
+      (sizeof(unsigned long long) + sizeof(size_t));
+    grown = TRUE;
+  }
+
+  list->tailpositions[k] = position;
+  list->taillengths[k] = length;
+  list->count++;
+  if(k == OFFSETS_BLOCK_MASK) {
+    grown = encodeBlock(state, list) || grown;
+  }
+  return grown;
+}
+
+
+// position of entry i, which must be < list->count
+unsigned long long offsets_position(OffsetList * list, unsigned long long i) {
+
+  if(i >= (list->spilledblocks + list->numblocks) << OFFSETS_BLOCK_BITS) {
+    return list->tailpositions[i & OFFSETS_BLOCK_MASK];
+  }
+  return list->cache->positions[cacheBlock(list, i >> OFFSETS_BLOCK_BITS)]
+    [i & OFFSETS_BLOCK_MASK];
+}
+
+
+// length of entry i, which must be < list->count
+size_t offsets_length(OffsetList * list, unsigned long long i) {
+
+  OffsetBlock *block;
+
+  if(i >= (list->spilledblocks + list->numblocks) << OFFSETS_BLOCK_BITS) {
+    return list->taillengths[i & OFFSETS_BLOCK_MASK];
+  }
+  block = findBlock(list, i >> OFFSETS_BLOCK_BITS);
+  if(block->length != OFFSETS_VARIABLE_LENGTH) {
+    return block->length;
+  }
+  return list->cache->lengths[cacheBlock(list, i >> OFFSETS_BLOCK_BITS)]
+    [i & OFFSETS_BLOCK_MASK];
+}
+
+
+// write the list's encoded blocks to the end of the spill file as a
+// run, and release their memory.  Unencoded entries stay in memory.
+int offsets_spill(OffsetSpill * spill, OffsetList * list) {
+
+  OffsetPoolChunk *chunk;
+  OffsetRun *run;
+  unsigned long long pos;
+  size_t b;
+
+  if(list->numblocks == 0) {
+    return SCALPEL_OK;
+  }
+
+  if(list->numruns == list->runstorage) {
+    list->storage -= list->runstorage * sizeof(OffsetRun);
+    list->runstorage = list->runstorage ? list->runstorage * 2 : 4;
+    list->runs = (OffsetRun *)
+      realloc(list->runs, list->runstorage * sizeof(OffsetRun));
+    checkMemoryAllocation(spill->state, list->runs, __LINE__, __FILE__,
+			  "offset runs");
+    list->storage += list->runstorage * sizeof(OffsetRun);
+  }
+
+  if(fseeko(spill->file, 0, SEEK_END)) {
+    return SCALPEL_ERROR_FILE_WRITE;
+  }
+  pos = ftello(spill->file);
+  for(b = 0; b < list->numblocks; b++) {
+    if(fwrite(list->blocks[b].data, 1, list->blocks[b].size, spill->file)
+       != list->blocks[b].size) {
+      return SCALPEL_ERROR_FILE_WRITE;
+    }
+    list->blocks[b].data = 0;
+    list->blocks[b].spillpos = pos;
+    pos += list->blocks[b].size;
+  }
+  if(fwrite(list->blocks, sizeof(OffsetBlock), list->numblocks, spill->file)
+     != list->numblocks) {
+    return SCALPEL_ERROR_FILE_WRITE;
+  }
+
+  run = &(list->runs[list->numruns++]);
+  run->firstblock = list->spilledblocks;
+  run->numblocks = list->numblocks;
+  run->directory = pos;
+  list->spill = spill;
+  list->spilledblocks += list->numblocks;
+
+  while (list->pool) {
+    chunk = list->pool;
+    list->pool = chunk->next;
+    list->storage -= chunk->size;
+    free(chunk);
+  }
+  list->storage -= list->blockstorage * sizeof(OffsetBlock);
+  free(list->blocks);
+  list->blocks = 0;
+  list->numblocks = 0;
+  list->blockstorage = 0;
+  return SCALPEL_OK;
+}
+
+
+// release the list's storage and leave it empty.  Runs in the spill
+// file are abandoned; the file belongs to the caller.
+void offsets_destroy(OffsetList * list) {
+
+  OffsetPoolChunk *chunk;
+
+  while (list->pool) {
+    chunk = list->pool;
+    list->pool = chunk->next;
+    free(chunk);
+  }
+  free(list->runs);
+  free(list->rundirectory);
+  free(list->blocks);
+  free(list->tailpositions);
+  free(list->taillengths);
+  free(list->cache);
+  offsets_init(list);
+}
@@ -0,0 +1,152 @@
+// Scalpel Copyright (C) 2005-11 by Golden G. Richard III and
+// 2007-11 by Vico Marziale.
+// Written by Golden G. Richard III and Vico Marziale.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+//
+// Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+// on Foremost.  Foremost 0.69 was used as the starting point for
+// Scalpel, in 2005.
+
+
+// Storage for the positions and lengths of the headers or footers
+// discovered for one file type.  Positions arrive in ascending order
+// and are packed into blocks of OFFSETS_BLOCK_ENTRIES entries: each
+// block stores its first position and encodes the rest either as
+// varint deltas or, when matches are dense, as a bitmap of the bytes
+// the block covers, whichever is smaller.  Lengths are only stored for
+// blocks whose entries don't all have the same length, which in
+// practice means regular expression needles.  Encoded blocks are packed
+// into pooled chunks, so appending never copies stored entries.
+//
+// Entries stay addressable by index for the carve planner.  The
+// newest entries are kept unencoded until a block fills, and reads of
+// earlier entries decode whole blocks into a small cache, so the
+// mostly-sequential access patterns of the carve planner decode each
+// block about once.
+//
+// To bound memory use, the encoded blocks of a list can be spilled to a
+// temporary file as a run.  Each list's entries arrive in ascending
+// order, so its runs cover consecutive, ascending ranges of the list,
+// and merging them for the carve planner amounts to reading them in
+// turn.  Only a small table of runs stays in memory; a run's block
+// directory and blocks are read back when entries in it are needed.
+
+#ifndef OFFSETS_H
+#define OFFSETS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define OFFSETS_BLOCK_BITS          7
+#define OFFSETS_BLOCK_ENTRIES       (1 << OFFSETS_BLOCK_BITS)
+#define OFFSETS_BLOCK_MASK          (OFFSETS_BLOCK_ENTRIES - 1)
+
+// largest encoded block: raw positions and a length per entry
+#define OFFSETS_MAX_BLOCK_BYTES     \
+  ((OFFSETS_BLOCK_ENTRIES - 1) * 8 + OFFSETS_BLOCK_ENTRIES * 10)
+
+// decoded blocks cached per list
+#define OFFSETS_CACHED_BLOCKS       2
+
+// encoded blocks are packed into chunks that grow geometrically from
+// the first size to the maximum size
+#define OFFSETS_FIRST_POOL_CHUNK    4096
+#define OFFSETS_MAX_POOL_CHUNK      (1024 * 1024)
+
+// encodings of the positions in a block
+#define OFFSETS_DELTA               0	// varint deltas
+#define OFFSETS_BITMAP              1	// bit per byte from the first position
+#define OFFSETS_RAW                 2	// 8-byte positions, if out of order
+
+// OffsetBlock.length for blocks that store a length per entry
+#define OFFSETS_VARIABLE_LENGTH     ((size_t)-1)
+
+typedef struct OffsetBlock {
+  unsigned long long first;	// position of the block's first entry
+  unsigned char *data;		// encoded positions of the remaining
+				// entries, then varint lengths, if any;
+				// 0 once the block has been spilled
+  unsigned long long spillpos;	// position of the data in the spill file
+  size_t size;			// bytes of encoded data
+  size_t length;		// length of every entry in the block, or
+				// OFFSETS_VARIABLE_LENGTH
+  int encoding;			// OFFSETS_DELTA, OFFSETS_BITMAP, OFFSETS_RAW
+} OffsetBlock;
+
+// a chunk of memory holding encoded blocks
+typedef struct OffsetPoolChunk {
+  struct OffsetPoolChunk *next;
+  size_t size;
+  size_t used;
+} OffsetPoolChunk;
+
+// blocks of a list spilled to the spill file together.  The data of
+// the blocks is followed by their directory.
+typedef struct OffsetRun {
+  unsigned long long firstblock;	// index of the run's first block
+  size_t numblocks;
+  unsigned long long directory;	// position of the run's block directory
+				// in the spill file
+} OffsetRun;
+
+// temporary file holding spilled runs for the offset lists of an image
+typedef struct OffsetSpill {
+  struct scalpelState *state;
+  FILE *file;
+  char *filename;
+} OffsetSpill;
+
+// decoded copies of recently read blocks
+typedef struct OffsetCache {
+  unsigned long long block[OFFSETS_CACHED_BLOCKS];	// block numbers, or
+						// ULLONG_MAX if empty
+  unsigned long long positions[OFFSETS_CACHED_BLOCKS][OFFSETS_BLOCK_ENTRIES];
+  size_t lengths[OFFSETS_CACHED_BLOCKS][OFFSETS_BLOCK_ENTRIES];
+  int next;			// slot to replace on the next miss
+  unsigned char data[OFFSETS_MAX_BLOCK_BYTES];	// spilled block being read
+} OffsetCache;
+
+typedef struct OffsetList {
+  unsigned long long count;	// # stored entries
+  unsigned long long storage;	// bytes allocated for the list
+  unsigned long long spilledblocks;	// # blocks in runs in the spill file
+  OffsetBlock *blocks;		// encoded blocks in memory, which follow
+  size_t numblocks;		// the spilled blocks
+  size_t blockstorage;		// space allocated for this many blocks
+  OffsetPoolChunk *pool;	// chunks holding encoded blocks, newest first
+  OffsetSpill *spill;		// spill file holding the list's runs, or 0
+  OffsetRun *runs;		// runs in the spill file, in order
+  size_t numruns;
+  size_t runstorage;		// space allocated for this many runs
+  OffsetBlock *rundirectory;	// block directory of the run last read
+  size_t loadedrun;		// index of that run
+  unsigned long long *tailpositions;	// entries not yet encoded
+  size_t *taillengths;
+  OffsetCache *cache;		// allocated with the first encoded block
+} OffsetList;
+
+struct scalpelState;
+
+void offsets_init (OffsetList * list);
+int offsets_append (struct scalpelState *state, OffsetList * list,
+		    unsigned long long position, size_t length);
+unsigned long long offsets_position (OffsetList * list, unsigned long long i);
+size_t offsets_length (OffsetList * list, unsigned long long i);
+int offsets_spill (OffsetSpill * spill, OffsetList * list);
+void offsets_destroy (OffsetList * list);
+
+#endif // OFFSETS_H
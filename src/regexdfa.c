@@ -0,0 +1,1069 @@
+// Scalpel Copyright (C) 2005-11 by Golden G. Richard III and
+// 2007-11 by Vico Marziale.
+// Written by Golden G. Richard III and Vico Marziale.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+//
+// Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+// on Foremost.  Foremost 0.69 was used as the starting point for
+// Scalpel, in 2005.
+
+// DFA-based streaming search for regular expression headers and
+// footers.  See regexdfa.h.
+
+#include "scalpel.h"
+
+// node types of a parsed regular expression
+#define REGEXNODE_EMPTY       0
+#define REGEXNODE_SET         1
+#define REGEXNODE_CONCAT      2
+#define REGEXNODE_ALTERNATE   3
+#define REGEXNODE_REPEAT      4
+
+typedef struct RegexNode {
+  int type;
+  int left, right;		// operands (only left for REGEXNODE_REPEAT)
+  size_t min, max;		// repetition counts, max may be REGEX_UNBOUNDED
+  unsigned char set[32];	// bytes matched by a REGEXNODE_SET
+} RegexNode;
+
+typedef struct RegexParse {
+  struct scalpelState *state;
+  char *re;
+  size_t len;
+  size_t pos;
+  int casesensitive;
+  RegexNode *nodes;
+  int numnodes;
+  int nodestorage;
+} RegexParse;
+
+// Thompson NFA built from the parse tree.  Edges labelled with a
+// REGEXNODE_SET node consume a byte in the node's set; edges labelled -1
+// consume nothing.
+typedef struct RegexNFAEdge {
+  int from, to;
+  int node;
+} RegexNFAEdge;
+
+typedef struct RegexNFA {
+  int numstates;
+  RegexNFAEdge *edges;
+  int numedges;
+  int edgestorage;
+} RegexNFA;
+
+// state of the subset construction of a DFA from an NFA
+typedef struct RegexDFABuild {
+  struct scalpelState *state;
+  RegexNFA *nfa;
+  int reverse;			// follow the NFA's edges backwards?
+  int accept;			// NFA state marking a match
+  int *first, *adjacent;	// edges leaving each NFA state
+  unsigned int *mark;		// generation at which NFA states were seen
+  unsigned int generation;
+  int *stack;
+  int *members;			// NFA states in each DFA state, sorted
+  size_t nummembers, memberstorage;
+  size_t *setstart, *setlength;
+  unsigned char *accepting;
+  unsigned int *delta;
+  unsigned int numdfa, storage, numclasses;
+  int *hash;			// DFA states by their NFA states
+  unsigned int hashsize;
+} RegexDFABuild;
+
+static int newRegexNode(RegexParse * p, int type, int left, int right);
+static void addRegexChar(RegexParse * p, unsigned char *set, int c,
+			 int fold);
+static int parseRegexClass(RegexParse * p, unsigned char *set);
+static int parseRegexBracket(RegexParse * p, unsigned char *set);
+static int parseRegexAtom(RegexParse * p);
+static int parseRegexRepeat(RegexParse * p);
+static int parseRegexConcat(RegexParse * p);
+static int parseRegexAlternate(RegexParse * p);
+static int regexNodeIsNullable(RegexParse * p, int node);
+static int newNFAState(RegexNFA * nfa);
+static int addNFAEdge(struct scalpelState *state, RegexNFA * nfa, int from,
+		      int to, int node);
+static int compileRegexNode(struct scalpelState *state, RegexParse * p,
+			    RegexNFA * nfa, int node, int *start, int *end);
+static int closeDFAState(RegexDFABuild * b, int top);
+static unsigned int *buildDFA(struct scalpelState *state, RegexParse * p,
+			      RegexNFA * nfa, RegexDFA * dfa,
+			      unsigned char *classrep, int reverse,
+			      int start, int accept, unsigned int *numstates);
+static void reportPending(struct scalpelState *state, RegexStream * stream,
+			  unsigned long long limit, MultiSearchHits * hits);
+static void findMatchStarts(RegexStream * stream, char *buf,
+			    unsigned long long offset,
+			    unsigned long long historyend,
+			    unsigned long long end);
+
+
+#define SET_HAS(set, c)  ((set)[(c) >> 3] & (1 << ((c) & 7)))
+#define SET_ADD(set, c)  ((set)[(c) >> 3] |= (1 << ((c) & 7)))
+
+
+static int newRegexNode(RegexParse * p, int type, int left, int right) {
+
+  RegexNode *n;
+
+  if(p->numnodes == p->nodestorage) {
+    p->nodestorage = p->nodestorage ? p->nodestorage * 2 : 64;
+    p->nodes = (RegexNode *)
+      realloc(p->nodes, p->nodestorage * sizeof(RegexNode));
+    checkMemoryAllocation(p->state, p->nodes, __LINE__, __FILE__,
+			  "regular expression nodes");
+  }
+  n = &(p->nodes[p->numnodes]);
+  memset(n, 0, sizeof(RegexNode));
+  n->type = type;
+  n->left = left;
+  n->right = right;
+  n->min = n->max = 1;
+  return p->numnodes++;
+}
+
+
+// add a character to a set, along with its opposite-case counterpart if
+// fold is set and the regular expression is case-insensitive.  Tre
+// doesn't fold escaped characters.
+static void addRegexChar(RegexParse * p, unsigned char *set, int c,
+			 int fold) {
+
+  SET_ADD(set, c);
+  if(fold && !p->casesensitive && (isupper(c) || islower(c))) {
+    SET_ADD(set, toupper(c));
+    SET_ADD(set, tolower(c));
+  }
+}
+
+
+// parse a character class name, "[:name:]", inside a bracket expression
+static int parseRegexClass(RegexParse * p, unsigned char *set) {
+
+  static const struct {
+    const char *name;
+    int (*isclass) (int);
+  } classes[] = {
+    {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+    {"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+    {"lower", islower}, {"print", isprint}, {"punct", ispunct},
+    {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+    {0, 0}
+  };
+  size_t start = p->pos + 2, end;
+  int i, c;
+
+  for(end = start; end + 1 < p->len; end++) {
+    if(p->re[end] == ':' && p->re[end + 1] == ']') {
+      break;
+    }
+  }
+  if(end + 1 >= p->len) {
+    return FALSE;
+  }
+
+  for(i = 0; classes[i].name; i++) {
+    if(strlen(classes[i].name) == end - start &&
+       !strncmp(classes[i].name, p->re + start, end - start)) {
+      break;
+    }
+  }
+  if(!classes[i].name) {
+    return FALSE;
+  }
+
+  // like Tre, a case-insensitive class also matches the opposite case
+  // of its members
+  for(c = 0; c < 256; c++) {
+    if(classes[i].isclass(c) ||
+       (!p->casesensitive &&
+	(classes[i].isclass(tolower(c)) || classes[i].isclass(toupper(c))))) {
+      SET_ADD(set, c);
+    }
+  }
+  p->pos = end + 2;
+  return TRUE;
+}
+
+
+// parse a bracket expression.  Negated bracket expressions aren't
+// handled for case-insensitive regular expressions, since Tre's
+// treatment of them is intricate.
+static int parseRegexBracket(RegexParse * p, unsigned char *set) {
+
+  int negate = FALSE, first = TRUE, lo, hi, c;
+
+  p->pos++;
+  if(p->pos < p->len && p->re[p->pos] == '^') {
+    negate = TRUE;
+    p->pos++;
+    if(!p->casesensitive) {
+      return FALSE;
+    }
+  }
+
+  while (p->pos < p->len && (first || p->re[p->pos] != ']')) {
+    first = FALSE;
+    if(p->re[p->pos] == '[' && p->pos + 1 < p->len &&
+       p->re[p->pos + 1] == ':') {
+      if(!parseRegexClass(p, set)) {
+	return FALSE;
+      }
+      continue;
+    }
+    if(p->re[p->pos] == '[' && p->pos + 1 < p->len &&
+       (p->re[p->pos + 1] == '=' || p->re[p->pos + 1] == '.')) {
+      // equivalence classes and collating symbols
+      return FALSE;
+    }
+    lo = hi = (unsigned char)p->re[p->pos++];
+    if(p->pos + 1 < p->len && p->re[p->pos] == '-' &&
+       p->re[p->pos + 1] != ']') {
+      hi = (unsigned char)p->re[p->pos + 1];
+      p->pos += 2;
+      if(hi == '[' || hi < lo) {
+	return FALSE;
+      }
+    }
+    for(c = lo; c <= hi; c++) {
+      addRegexChar(p, set, c, TRUE);
+    }
+  }
+  if(p->pos >= p->len) {
+    return FALSE;
+  }
+  p->pos++;
+
+  if(negate) {
+    for(c = 0; c < 32; c++) {
+      set[c] = ~set[c];
+    }
+  }
+  return TRUE;
+}
+
+
+// parse a single atom: a character, bracket expression, escape or
+// parenthesized subexpression.  Returns the node, or -1 if the atom
+// can't be handled.
+static int parseRegexAtom(RegexParse * p) {
+
+  unsigned char *set;
+  char hex[3], *close;
+  int node, c, i;
+
+  if(p->re[p->pos] == '(') {
+    p->pos++;
+    if(p->pos < p->len && p->re[p->pos] == '?') {
+      return -1;
+    }
+    node = parseRegexAlternate(p);
+    if(node < 0 || p->pos >= p->len || p->re[p->pos] != ')') {
+      return -1;
+    }
+    p->pos++;
+    return node;
+  }
+
+  node = newRegexNode(p, REGEXNODE_SET, -1, -1);
+  set = p->nodes[node].set;
+
+  switch (p->re[p->pos]) {
+  case '[':
+    if(!parseRegexBracket(p, set)) {
+      return -1;
+    }
+    return node;
+  case '.':
+    memset(set, 0xff, 32);
+    p->pos++;
+    return node;
+  case '\\':
+    p->pos++;
+    if(p->pos >= p->len) {
+      return -1;
+    }
+    c = (unsigned char)p->re[p->pos++];
+    switch (c) {
+    case 't':
+      SET_ADD(set, '\t');
+      return node;
+    case 'n':
+      SET_ADD(set, '\n');
+      return node;
+    case 'r':
+      SET_ADD(set, '\r');
+      return node;
+    case 'f':
+      SET_ADD(set, '\f');
+      return node;
+    case 'a':
+      SET_ADD(set, '\a');
+      return node;
+    case 'e':
+      SET_ADD(set, 033);
+      return node;
+    case 'w':
+    case 'W':
+    case 's':
+    case 'S':
+    case 'd':
+    case 'D':
+      // these classes are the same whether or not case is ignored
+      for(i = 0; i < 256; i++) {
+	if((tolower(c) == 'w' && (isalnum(i) || i == '_')) ||
+	   (tolower(c) == 's' && isspace(i)) ||
+	   (tolower(c) == 'd' && isdigit(i))) {
+	  SET_ADD(set, i);
+	}
+      }
+      if(isupper(c)) {
+	for(i = 0; i < 32; i++) {
+	  set[i] = ~set[i];
+	}
+      }
+      return node;
+    case 'x':
+      memset(hex, 0, sizeof(hex));
+      if(p->pos < p->len && p->re[p->pos] == '{') {
+	close = (char *)memchr(p->re + p->pos, '}', p->len - p->pos);
+	if(!close || close - (p->re + p->pos) > 3) {
+	  return -1;
+	}
+	memcpy(hex, p->re + p->pos + 1, close - (p->re + p->pos) - 1);
+	p->pos = close - p->re + 1;
+      }
+      else {
+	for(i = 0; i < 2 && p->pos < p->len &&
+	    isxdigit((unsigned char)p->re[p->pos]); i++) {
+	  hex[i] = p->re[p->pos++];
+	}
+      }
+      SET_ADD(set, (int)strtoul(hex, 0, 16));
+      return node;
+    default:
+      // back references, assertions and Tre's "\Q"
+      if(isalnum(c) || c == '<' || c == '>') {
+	return -1;
+      }
+      SET_ADD(set, c);
+      return node;
+    }
+  case '^':
+  case '$':
+  case '*':
+  case '+':
+  case '?':
+  case '{':
+  case '|':
+  case ')':
+    return -1;
+  default:
+    addRegexChar(p, set, (unsigned char)p->re[p->pos++], TRUE);
+    return node;
+  }
+}
+
+
+// parse an atom and any repetition operator following it
+static int parseRegexRepeat(RegexParse * p) {
+
+  int atom, node;
+  size_t min = 1, max = 1;
+  char *end;
+
+  if((atom = parseRegexAtom(p)) < 0) {
+    return -1;
+  }
+  if(p->pos >= p->len) {
+    return atom;
+  }
+
+  switch (p->re[p->pos]) {
+  case '*':
+    min = 0;
+    max = REGEX_UNBOUNDED;
+    p->pos++;
+    break;
+  case '+':
+    max = REGEX_UNBOUNDED;
+    p->pos++;
+    break;
+  case '?':
+    min = 0;
+    p->pos++;
+    break;
+  case '{':
+    p->pos++;
+    if(p->pos >= p->len || !isdigit((unsigned char)p->re[p->pos])) {
+      return -1;
+    }
+    min = max = strtoul(p->re + p->pos, &end, 10);
+    p->pos = end - p->re;
+    if(p->pos < p->len && p->re[p->pos] == ',') {
+      p->pos++;
+      max = REGEX_UNBOUNDED;
+      if(p->pos < p->len && isdigit((unsigned char)p->re[p->pos])) {
+	max = strtoul(p->re + p->pos, &end, 10);
+	p->pos = end - p->re;
+      }
+    }
+    if(p->pos >= p->len || p->re[p->pos] != '}' || max < min) {
+      return -1;
+    }
+    p->pos++;
+    break;
+  default:
+    return atom;
+  }
+
+  // minimal repetition reports the shortest match, which the DFAs can't
+  // do, and stacked repetition operators aren't worth handling
+  if(p->pos < p->len && (p->re[p->pos] == '*' || p->re[p->pos] == '+' ||
+			 p->re[p->pos] == '?' || p->re[p->pos] == '{')) {
+    return -1;
+  }
+
+  node = newRegexNode(p, REGEXNODE_REPEAT, atom, -1);
+  p->nodes[node].min = min;
+  p->nodes[node].max = max;
+  return node;
+}
+
+
+static int parseRegexConcat(RegexParse * p) {
+
+  int node = -1, next;
+
+  while (p->pos < p->len && p->re[p->pos] != '|' && p->re[p->pos] != ')') {
+    if((next = parseRegexRepeat(p)) < 0) {
+      return -1;
+    }
+    node = node < 0 ? next : newRegexNode(p, REGEXNODE_CONCAT, node, next);
+  }
+  return node < 0 ? newRegexNode(p, REGEXNODE_EMPTY, -1, -1) : node;
+}
+
+
+static int parseRegexAlternate(RegexParse * p) {
+
+  int node, next;
+
+  if((node = parseRegexConcat(p)) < 0) {
+    return -1;
+  }
+  while (p->pos < p->len && p->re[p->pos] == '|') {
+    p->pos++;
+    if((next = parseRegexConcat(p)) < 0) {
+      return -1;
+    }
+    node = newRegexNode(p, REGEXNODE_ALTERNATE, node, next);
+  }
+  return node;
+}
+
+
+// can a parse tree node match the empty string?
+static int regexNodeIsNullable(RegexParse * p, int node) {
+
+  RegexNode *n = &(p->nodes[node]);
+
+  switch (n->type) {
+  case REGEXNODE_SET:
+    return FALSE;
+  case REGEXNODE_CONCAT:
+    return regexNodeIsNullable(p, n->left) &&
+      regexNodeIsNullable(p, n->right);
+  case REGEXNODE_ALTERNATE:
+    return regexNodeIsNullable(p, n->left) ||
+      regexNodeIsNullable(p, n->right);
+  case REGEXNODE_REPEAT:
+    return n->min == 0 || regexNodeIsNullable(p, n->left);
+  }
+  return TRUE;
+}
+
+
+static int newNFAState(RegexNFA * nfa) {
+
+  return nfa->numstates++;
+}
+
+
+static int
+addNFAEdge(struct scalpelState *state, RegexNFA * nfa, int from, int to,
+	   int node) {
+
+  if(nfa->numedges == nfa->edgestorage) {
+    nfa->edgestorage = nfa->edgestorage ? nfa->edgestorage * 2 : 256;
+    nfa->edges = (RegexNFAEdge *)
+      realloc(nfa->edges, nfa->edgestorage * sizeof(RegexNFAEdge));
+    checkMemoryAllocation(state, nfa->edges, __LINE__, __FILE__,
+			  "regular expression NFA");
+  }
+  nfa->edges[nfa->numedges].from = from;
+  nfa->edges[nfa->numedges].to = to;
+  nfa->edges[nfa->numedges].node = node;
+  nfa->numedges++;
+  return TRUE;
+}
+
+
+// add the NFA fragment for a parse tree node, returning its entry and
+// exit states.  Bounded repetitions are expanded into copies of their
+// operand.  Returns FALSE if the NFA grows too large.
+static int
+compileRegexNode(struct scalpelState *state, RegexParse * p, RegexNFA * nfa,
+		 int node, int *start, int *end) {
+
+  RegexNode *n = &(p->nodes[node]);
+  int s1, e1, s2, e2, loop;
+  size_t i;
+
+  if(nfa->numstates > REGEXDFA_MAX_NFA_STATES) {
+    return FALSE;
+  }
+
+  switch (n->type) {
+  case REGEXNODE_EMPTY:
+    *start = *end = newNFAState(nfa);
+    return TRUE;
+  case REGEXNODE_SET:
+    *start = newNFAState(nfa);
+    *end = newNFAState(nfa);
+    return addNFAEdge(state, nfa, *start, *end, node);
+  case REGEXNODE_CONCAT:
+    if(!compileRegexNode(state, p, nfa, n->left, &s1, &e1) ||
+       !compileRegexNode(state, p, nfa, n->right, &s2, &e2)) {
+      return FALSE;
+    }
+    addNFAEdge(state, nfa, e1, s2, -1);
+    *start = s1;
+    *end = e2;
+    return TRUE;
+  case REGEXNODE_ALTERNATE:
+    if(!compileRegexNode(state, p, nfa, n->left, &s1, &e1) ||
+       !compileRegexNode(state, p, nfa, n->right, &s2, &e2)) {
+      return FALSE;
+    }
+    *start = newNFAState(nfa);
+    *end = newNFAState(nfa);
+    addNFAEdge(state, nfa, *start, s1, -1);
+    addNFAEdge(state, nfa, *start, s2, -1);
+    addNFAEdge(state, nfa, e1, *end, -1);
+    addNFAEdge(state, nfa, e2, *end, -1);
+    return TRUE;
+  case REGEXNODE_REPEAT:
+    *start = *end = newNFAState(nfa);
+    // required copies
+    for(i = 0; i < n->min; i++) {
+      if(!compileRegexNode(state, p, nfa, n->left, &s1, &e1)) {
+	return FALSE;
+      }
+      addNFAEdge(state, nfa, *end, s1, -1);
+      *end = e1;
+    }
+    if(n->max == REGEX_UNBOUNDED) {
+      // any number of further copies
+      if(!compileRegexNode(state, p, nfa, n->left, &s1, &e1)) {
+	return FALSE;
+      }
+      loop = newNFAState(nfa);
+      addNFAEdge(state, nfa, *end, loop, -1);
+      addNFAEdge(state, nfa, loop, s1, -1);
+      addNFAEdge(state, nfa, e1, loop, -1);
+      *end = loop;
+    }
+    else {
+      // optional copies
+      for(; i < n->max; i++) {
+	if(!compileRegexNode(state, p, nfa, n->left, &s1, &e1)) {
+	  return FALSE;
+	}
+	loop = newNFAState(nfa);
+	addNFAEdge(state, nfa, *end, s1, -1);
+	addNFAEdge(state, nfa, *end, loop, -1);
+	addNFAEdge(state, nfa, e1, loop, -1);
+	*end = loop;
+      }
+    }
+    return nfa->numstates <= REGEXDFA_MAX_NFA_STATES;
+  }
+  return FALSE;
+}
+
+
+// find the DFA state for the epsilon closure of the NFA states on the
+// construction stack, adding a new DFA state if needed.  Returns -1 if
+// there would be too many states.
+static int closeDFAState(RegexDFABuild * b, int top) {
+
+  unsigned int h, n;
+  int i, j, q, to, count = 0;
+
+  if(b->nummembers + b->nfa->numstates > b->memberstorage) {
+    b->memberstorage = 2 * (b->nummembers + b->nfa->numstates);
+    b->members = (int *)realloc(b->members, b->memberstorage * sizeof(int));
+    checkMemoryAllocation(b->state, b->members, __LINE__, __FILE__,
+			  "regular expression DFA");
+  }
+
+  // collect the closure after the existing sets' members
+  b->generation++;
+  for(i = 0; i < top; i++) {
+    b->mark[b->stack[i]] = b->generation;
+  }
+  while (top > 0) {
+    q = b->stack[--top];
+    b->members[b->nummembers + count++] = q;
+    for(j = b->first[q]; j < b->first[q + 1]; j++) {
+      i = b->adjacent[j];
+      to = b->reverse ? b->nfa->edges[i].from : b->nfa->edges[i].to;
+      if(b->nfa->edges[i].node < 0 && b->mark[to] != b->generation) {
+	b->mark[to] = b->generation;
+	b->stack[top++] = to;
+      }
+    }
+  }
+  if(count == 0) {
+    return 0;
+  }
+
+  // sort into canonical order for lookup
+  for(i = 1; i < count; i++) {
+    q = b->members[b->nummembers + i];
+    for(j = i; j > 0 && b->members[b->nummembers + j - 1] > q; j--) {
+      b->members[b->nummembers + j] = b->members[b->nummembers + j - 1];
+    }
+    b->members[b->nummembers + j] = q;
+  }
+  h = count;
+  for(i = 0; i < count; i++) {
+    h = h * 31 + b->members[b->nummembers + i];
+  }
+
+  for(h %= b->hashsize; b->hash[h] >= 0; h = (h + 1) % b->hashsize) {
+    n = b->hash[h];
+    if(b->setlength[n] == (size_t)count &&
+       !memcmp(b->members + b->setstart[n], b->members + b->nummembers,
+	       count * sizeof(int))) {
+      return n;
+    }
+  }
+
+  if(b->numdfa == REGEXDFA_MAX_STATES) {
+    return -1;
+  }
+  if(b->numdfa == b->storage) {
+    b->storage *= 2;
+    b->setstart = (size_t *)realloc(b->setstart,
+				    b->storage * sizeof(size_t));
+    b->setlength = (size_t *)realloc(b->setlength,
+				     b->storage * sizeof(size_t));
+    b->accepting = (unsigned char *)realloc(b->accepting, b->storage);
+    b->delta = (unsigned int *)
+      realloc(b->delta, b->storage * b->numclasses * sizeof(unsigned int));
+    if(!b->setstart || !b->setlength || !b->accepting || !b->delta) {
+      checkMemoryAllocation(b->state, 0, __LINE__, __FILE__,
+			    "regular expression DFA");
+    }
+  }
+  n = b->numdfa++;
+  b->hash[h] = n;
+  b->setstart[n] = b->nummembers;
+  b->setlength[n] = count;
+  b->accepting[n] = b->mark[b->accept] == b->generation;
+  b->nummembers += count;
+  return n;
+}
+
+
+// subset construction of a DFA from the NFA, or from the NFA with its
+// edges reversed.  A forward automaton is unanchored: the NFA's start
+// state is added to every DFA state, so that matches may begin anywhere.
+// DFA state 0 is the empty set and state 1 the start state.  Returns
+// the premultiplied transition table, or NULL if there are too many
+// states.
+static unsigned int *
+buildDFA(struct scalpelState *state, RegexParse * p, RegexNFA * nfa,
+	 RegexDFA * dfa, unsigned char *classrep, int reverse, int start,
+	 int accept, unsigned int *numstates) {
+
+  RegexDFABuild b;
+  unsigned int c, d, n, nc = dfa->numclasses;
+  unsigned int *delta = 0;
+  int i, j, q, to, top;
+
+  memset(&b, 0, sizeof(b));
+  b.state = state;
+  b.nfa = nfa;
+  b.reverse = reverse;
+  b.accept = accept;
+  b.numclasses = nc;
+  b.storage = 64;
+  b.hashsize = 2 * REGEXDFA_MAX_STATES;
+  b.memberstorage = 1024;
+
+  b.first = (int *)calloc(nfa->numstates + 1, sizeof(int));
+  b.adjacent = (int *)malloc((nfa->numedges + 1) * sizeof(int));
+  b.mark = (unsigned int *)calloc(nfa->numstates, sizeof(unsigned int));
+  b.stack = (int *)malloc((nfa->numstates + 1) * sizeof(int));
+  b.hash = (int *)malloc(b.hashsize * sizeof(int));
+  b.members = (int *)malloc(b.memberstorage * sizeof(int));
+  b.setstart = (size_t *)malloc(b.storage * sizeof(size_t));
+  b.setlength = (size_t *)malloc(b.storage * sizeof(size_t));
+  b.accepting = (unsigned char *)malloc(b.storage);
+  b.delta = (unsigned int *)malloc(b.storage * nc * sizeof(unsigned int));
+  if(!b.first || !b.adjacent || !b.mark || !b.stack || !b.hash ||
+     !b.members || !b.setstart || !b.setlength || !b.accepting || !b.delta) {
+    checkMemoryAllocation(state, 0, __LINE__, __FILE__,
+			  "regular expression DFA");
+  }
+
+  // adjacency lists of the (possibly reversed) NFA
+  for(i = 0; i < nfa->numedges; i++) {
+    b.first[(reverse ? nfa->edges[i].to : nfa->edges[i].from) + 1]++;
+  }
+  for(i = 0; i < nfa->numstates; i++) {
+    b.first[i + 1] += b.first[i];
+  }
+  for(i = 0; i < nfa->numedges; i++) {
+    q = reverse ? nfa->edges[i].to : nfa->edges[i].from;
+    b.adjacent[b.first[q] + b.mark[q]++] = i;
+  }
+  memset(b.mark, 0, nfa->numstates * sizeof(unsigned int));
+  for(n = 0; n < b.hashsize; n++) {
+    b.hash[n] = -1;
+  }
+
+  // the empty set, then the start state
+  b.setstart[0] = b.setlength[0] = 0;
+  b.accepting[0] = FALSE;
+  b.numdfa = 1;
+  b.stack[0] = start;
+  closeDFAState(&b, 1);
+
+  for(d = 0; d < b.numdfa; d++) {
+    for(c = 0; c < nc; c++) {
+      // NFA states reachable from DFA state d on the class's bytes
+      b.generation++;
+      top = 0;
+      for(n = 0; n < b.setlength[d]; n++) {
+	q = b.members[b.setstart[d] + n];
+	for(j = b.first[q]; j < b.first[q + 1]; j++) {
+	  i = b.adjacent[j];
+	  to = reverse ? nfa->edges[i].from : nfa->edges[i].to;
+	  if(nfa->edges[i].node >= 0 &&
+	     SET_HAS(p->nodes[nfa->edges[i].node].set, classrep[c]) &&
+	     b.mark[to] != b.generation) {
+	    b.mark[to] = b.generation;
+	    b.stack[top++] = to;
+	  }
+	}
+      }
+      if(!reverse && b.mark[start] != b.generation) {
+	b.stack[top++] = start;
+      }
+      if((to = closeDFAState(&b, top)) < 0) {
+	goto done;
+      }
+      b.delta[d * nc + c] = to;
+    }
+  }
+
+  // premultiply transitions by the row width and flag accepting states
+  for(n = 0; n < b.numdfa * nc; n++) {
+    d = b.delta[n];
+    b.delta[n] = d * nc | (b.accepting[d] ? REGEXDFA_ACCEPT : 0);
+  }
+  delta = b.delta;
+  b.delta = 0;
+  *numstates = b.numdfa;
+
+ done:
+  free(b.first);
+  free(b.adjacent);
+  free(b.mark);
+  free(b.stack);
+  free(b.hash);
+  free(b.members);
+  free(b.setstart);
+  free(b.setlength);
+  free(b.accepting);
+  free(b.delta);
+  return delta;
+}
+
+
+// compile a regular expression (without its enclosing '/'s) into the
+// automata for a streaming search.  Returns NULL if the regular
+// expression can't be handled, or can match the empty string.
+RegexDFA *regexdfa_compile(struct scalpelState *state, char *re, size_t len,
+			   int casesensitive) {
+
+  RegexParse p;
+  RegexNFA nfa;
+  RegexDFA *dfa = 0;
+  unsigned char classrep[256];
+  int root, start, accept, split[2][256], *cls, i, ok;
+  unsigned int c, nc;
+
+  memset(&p, 0, sizeof(p));
+  memset(&nfa, 0, sizeof(nfa));
+  p.state = state;
+  p.re = re;
+  p.len = len;
+  p.casesensitive = casesensitive;
+
+  // an empty match would be found at every position
+  root = parseRegexAlternate(&p);
+  ok = root >= 0 && p.pos == len && !regexNodeIsNullable(&p, root) &&
+    compileRegexNode(state, &p, &nfa, root, &start, &accept);
+
+  if(ok) {
+    dfa = (RegexDFA *) calloc(1, sizeof(RegexDFA));
+    checkMemoryAllocation(state, dfa, __LINE__, __FILE__,
+			  "regular expression DFA");
+
+    // bytes that are in exactly the same sets share an equivalence
+    // class; refine the partition one set at a time
+    memset(dfa->classmap, 0, sizeof(dfa->classmap));
+    nc = 1;
+    for(i = 0; i < p.numnodes; i++) {
+      if(p.nodes[i].type != REGEXNODE_SET) {
+	continue;
+      }
+      memset(split, -1, sizeof(split));
+      nc = 0;
+      for(c = 0; c < 256; c++) {
+	cls = &(split[SET_HAS(p.nodes[i].set, c) ? 1 : 0][dfa->classmap[c]]);
+	if(*cls < 0) {
+	  *cls = nc++;
+	}
+	dfa->classmap[c] = *cls;
+      }
+    }
+    dfa->numclasses = nc;
+    for(c = 256; c-- > 0;) {
+      classrep[dfa->classmap[c]] = c;
+    }
+
+    dfa->forward = buildDFA(state, &p, &nfa, dfa, classrep, FALSE, start,
+			    accept, &(dfa->numforward));
+    dfa->reverse = buildDFA(state, &p, &nfa, dfa, classrep, TRUE, accept,
+			    start, &(dfa->numreverse));
+
+    if(!dfa->forward || !dfa->reverse) {
+      regexdfa_destroy(dfa);
+      dfa = 0;
+    }
+  }
+
+  free(p.nodes);
+  free(nfa.edges);
+  return dfa;
+}
+
+
+void regexdfa_destroy(RegexDFA * dfa) {
+
+  if(dfa) {
+    free(dfa->forward);
+    free(dfa->reverse);
+    free(dfa);
+  }
+}
+
+
+// prepare to search an image for a regular expression
+void
+regexdfa_stream_init(struct scalpelState *state, RegexStream * stream,
+		     RegexDFA * dfa, int rule, int kind, size_t window) {
+
+  memset(stream, 0, sizeof(RegexStream));
+  stream->dfa = dfa;
+  stream->rule = rule;
+  stream->kind = kind;
+  stream->window = window;
+  stream->history = (char *)malloc(window);
+  checkMemoryAllocation(state, stream->history, __LINE__, __FILE__,
+			"regular expression history");
+  stream->pending = (size_t *)calloc(window + 1, sizeof(size_t));
+  checkMemoryAllocation(state, stream->pending, __LINE__, __FILE__,
+			"regular expression matches");
+}
+
+
+void regexdfa_stream_destroy(RegexStream * stream) {
+
+  free(stream->history);
+  free(stream->pending);
+  stream->history = 0;
+  stream->pending = 0;
+}
+
+
+// report, in order, the pending matches starting before limit
+static void
+reportPending(struct scalpelState *state, RegexStream * stream,
+	      unsigned long long limit, MultiSearchHits * hits) {
+
+  size_t *length;
+
+  while (stream->numpending > 0 && stream->sweep < limit) {
+    length = &(stream->pending[stream->sweep % (stream->window + 1)]);
+    if(*length) {
+      multisearch_hits_add(state, hits, stream->rule, stream->kind,
+			   stream->sweep - stream->origin, *length);
+      *length = 0;
+      stream->numpending--;
+    }
+    stream->sweep++;
+  }
+  if(stream->numpending == 0 && stream->sweep < limit) {
+    stream->sweep = limit;
+  }
+}
+
+
+// run the reverse automaton backwards from end, the end of a match, to
+// find every position within the window where a match ending there
+// starts.  Since ends are found in order, the latest end found for a
+// start gives its longest match.  Bytes before the buffer are taken from
+// the stream's history, which ends at historyend.
+static void
+findMatchStarts(RegexStream * stream, char *buf, unsigned long long offset,
+		unsigned long long historyend, unsigned long long end) {
+
+  RegexDFA *dfa = stream->dfa;
+  unsigned long long pos, lowest, historybegin;
+  unsigned int s = dfa->numclasses;
+  unsigned char c;
+  size_t *length;
+
+  lowest = end > stream->window ? end - stream->window : 0;
+  historybegin = historyend - stream->historylen;
+  if(stream->numpending == 0 && stream->sweep < lowest) {
+    // keep the pending matches' positions within one window of sweep
+    stream->sweep = lowest;
+  }
+  for(pos = end; pos > lowest;) {
+    pos--;
+    if(pos >= offset) {
+      c = (unsigned char)buf[pos - offset];
+    }
+    else if(pos >= historybegin) {
+      c = (unsigned char)stream->history[pos - historybegin];
+    }
+    else {
+      break;
+    }
+    s = dfa->reverse[s + dfa->classmap[c]];
+    if(s & REGEXDFA_ACCEPT) {
+      s &= ~REGEXDFA_ACCEPT;
+      length = &(stream->pending[pos % (stream->window + 1)]);
+      if(!*length) {
+	stream->numpending++;
+      }
+      *length = end - pos;
+    }
+    if(s == 0) {
+      break;
+    }
+  }
+}
+
+
+// search a buffer of the image, which begins at image position offset.
+// The search picks up where the previous buffer's search left off, so
+// bytes the buffer shares with the previous one aren't searched again;
+// if the buffer doesn't follow on from the previous one, the search
+// starts afresh.  Matches whose longest length is known are appended to
+// hits, with positions relative to stream->origin.
+void
+regexdfa_scan(struct scalpelState *state, RegexStream * stream, char *buf,
+	      size_t buflen, unsigned long long offset,
+	      MultiSearchHits * hits) {
+
+  RegexDFA *dfa = stream->dfa;
+  unsigned long long end, historyend;
+  unsigned int s, t;
+  size_t i, keep;
+
+  // every match reported by this call starts at or after origin
+  end = stream->started && stream->position < offset ?
+    stream->position : offset;
+  stream->origin = end > stream->window ? end - stream->window : 0;
+
+  if(!stream->started || stream->position < offset ||
+     stream->position > offset + buflen) {
+    reportPending(state, stream, (unsigned long long)-1, hits);
+    stream->started = TRUE;
+    stream->state = dfa->numclasses;
+    stream->position = offset;
+    stream->historylen = 0;
+    stream->sweep = offset;
+  }
+
+  historyend = stream->position;
+  s = stream->state;
+  for(i = stream->position - offset; i < buflen; i++) {
+    t = dfa->forward[s + dfa->classmap[(unsigned char)buf[i]]];
+    s = t & ~REGEXDFA_ACCEPT;
+    end = offset + i + 1;
+    if(t & REGEXDFA_ACCEPT) {
+      findMatchStarts(stream, buf, offset, historyend, end);
+    }
+    // matches can't extend more than a window past their start
+    if(stream->numpending > 0 && end >= stream->window) {
+      reportPending(state, stream, end - stream->window + 1, hits);
+    }
+  }
+  stream->state = s;
+  stream->position = offset + buflen;
+
+  // keep the last window bytes for finding the starts of matches in the
+  // next buffer
+  if(buflen >= stream->window) {
+    memcpy(stream->history, buf + buflen - stream->window, stream->window);
+    stream->historylen = stream->window;
+  }
+  else {
+    keep = historyend - stream->historylen < offset ?
+      offset - (historyend - stream->historylen) : 0;
+    if(keep > stream->window - buflen) {
+      keep = stream->window - buflen;
+    }
+    memmove(stream->history,
+	    stream->history + (offset - keep - (historyend -
+						 stream->historylen)), keep);
+    memcpy(stream->history + keep, buf, buflen);
+    stream->historylen = keep + buflen;
+  }
+}
+
+
+// report the remaining matches at the end of the image
+void
+regexdfa_flush(struct scalpelState *state, RegexStream * stream,
+	       MultiSearchHits * hits) {
+
+  stream->origin = stream->sweep;
+  reportPending(state, stream, (unsigned long long)-1, hits);
+}
@@ -0,0 +1,108 @@
+// Scalpel Copyright (C) 2005-11 by Golden G. Richard III and
+// 2007-11 by Vico Marziale.
+// Written by Golden G. Richard III and Vico Marziale.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+//
+// Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+// on Foremost.  Foremost 0.69 was used as the starting point for
+// Scalpel, in 2005.
+
+// Streaming matcher for regular expression headers and footers.  A
+// regular expression is compiled into two DFAs: a forward automaton
+// that finds the positions where matches end, and an automaton for the
+// reversed regular expression, which is run backwards from each end to
+// find where those matches start.  The forward automaton's state and
+// the last few bytes of each buffer are carried over to the next buffer
+// of the image, so matches spanning buffers are found without searching
+// any part of the image twice.
+//
+// As with Tre, a match is reported for every position where a match
+// starts, with the length of the longest match starting there.  Matches
+// are limited to a window of bytes (LARGEST_REGEXP_OVERLAP in Scalpel).
+//
+// Regular expressions using constructs the DFAs can't express (anchors,
+// assertions, back references, Tre extensions) or needing too many
+// states aren't compiled, and are left to Tre.
+
+#ifndef REGEXDFA_H
+#define REGEXDFA_H
+
+#include <stddef.h>
+#include "multisearch.h"
+
+// compilation is abandoned for regular expressions needing more states
+// than these
+#define REGEXDFA_MAX_NFA_STATES    4096
+#define REGEXDFA_MAX_STATES        4096
+
+// high bit of a transition marks an accepting target state
+#define REGEXDFA_ACCEPT            0x80000000U
+
+typedef struct RegexDFA {
+  // input bytes are mapped to equivalence classes; transitions hold the
+  // premultiplied row offset of the target state, with REGEXDFA_ACCEPT
+  // set when the target state is accepting
+  unsigned char classmap[256];
+  unsigned int numclasses;
+
+  // forward automaton for the regular expression preceded by anything;
+  // accepting states mark the end of a match.  Row 1 is the start state.
+  unsigned int numforward;
+  unsigned int *forward;
+
+  // anchored automaton for the reversed regular expression; accepting
+  // states mark the start of a match.  Row 0 is the dead state and row 1
+  // the start state.
+  unsigned int numreverse;
+  unsigned int *reverse;
+} RegexDFA;
+
+// progress of the search for one regular expression needle through an
+// image
+typedef struct RegexStream {
+  RegexDFA *dfa;
+  int rule;			// index of the file type in the SearchSpec array
+  int kind;			// MULTISEARCH_HEADER or MULTISEARCH_FOOTER
+  size_t window;		// maximum length of a match
+  int started;			// has any of the image been searched?
+  unsigned int state;		// forward automaton state (premultiplied)
+  unsigned long long position;	// image position of the next byte to search
+  char *history;		// up to window bytes of the image preceding
+  size_t historylen;		// position, for finding starts of matches
+  size_t *pending;		// length of the longest match found so far at
+				// each start position in the window, or 0
+  size_t numpending;
+  unsigned long long sweep;	// matches starting before sweep are reported
+  unsigned long long origin;	// reported positions are relative to origin
+} RegexStream;
+
+struct scalpelState;
+
+RegexDFA *regexdfa_compile (struct scalpelState *state, char *re,
+			    size_t len, int casesensitive);
+void regexdfa_destroy (RegexDFA * dfa);
+
+void regexdfa_stream_init (struct scalpelState *state, RegexStream * stream,
+			   RegexDFA * dfa, int rule, int kind, size_t window);
+void regexdfa_scan (struct scalpelState *state, RegexStream * stream,
+		    char *buf, size_t buflen, unsigned long long offset,
+		    MultiSearchHits * hits);
+void regexdfa_flush (struct scalpelState *state, RegexStream * stream,
+		     MultiSearchHits * hits);
+void regexdfa_stream_destroy (RegexStream * stream);
+
+#endif // REGEXDFA_H
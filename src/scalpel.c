@@ -50,7 +50,14 @@ void usage() {
 	 /*	 "[-s] [-m <blockmap file>] [-M <blocksize>] [-n] [-o <outputdir>]\n" */
 	 /*	 "[-O] [-p] [-q <clustersize>] [-r] [-s <num>] [-u <blockmap file>]\n" */
 
-	 "[-v] [-V] <imgfile> [<imgfile>] ...\n\n"
+	 "[-v] [-V] [--threads <num>] [--regex-dfa] [--hfd-memory-limit <MB>]\n"
+	 "[--defer-footers] [--single-pass] [--retention-window <MB>]\n"
+	 "[--buffer-size <KB>] [--queue-length <num>] [--max-open-files <num>]\n"
+	 "[--auto-tune <MB>] [--mmap] [--async-reads <num>] [--direct-io]\n"
+	 "[--split-image] <imgfile> [<imgfile>] ...\n\n"
+
+	 "An <imgfile> of - reads the image from standard input.  Images read\n"
+	 "from standard input or a pipe are carved in a single pass.\n\n"
 
 
 
@@ -103,7 +110,8 @@ void usage() {
 	 "    indexing file or data fragment locations or supporting in-place file\n"
 	 "    carving.\n"
 
-	 "-q  Carve only when header is cluster-aligned.\n"
+	 "-q  Carve only when header is cluster-aligned.  Headers are only\n"
+	 "    searched for at cluster boundaries.\n"
   
 	 "-r  Find only first of overlapping headers/footers [foremost 0.69 compat mode].\n"
 
@@ -122,6 +130,52 @@ void usage() {
 	 "-V  Print copyright information and exit.\n"
 
 	 "-v  Verbose mode.\n"
+
+	 "--threads  Set number of threads used to search for headers and footers.\n"
+	 "    Default is one per CPU.\n"
+
+	 "--regex-dfa  Search for regular expression headers and footers with\n"
+	 "    streaming DFAs, which avoids searching any part of the image twice.\n"
+	 "    Regular expressions the DFAs can't handle are searched for as usual.\n"
+
+	 "--hfd-memory-limit  Keep at most this many megabytes of the header/footer\n"
+	 "    database in memory.  Beyond that, it's spilled to a temporary file in\n"
+	 "    the output directory.\n"
+
+	 "--defer-footers  Don't search for footers in pass 1.  While carving,\n"
+	 "    search only the parts of the image within the maximum carve size\n"
+	 "    of each header.  Can't be used with -d.\n"
+
+	 "--single-pass  Write carved files while the image is searched, instead\n"
+	 "    of in a second pass over the image.\n"
+
+	 "--retention-window  With --single-pass, keep this many megabytes of\n"
+	 "    recently read image data in memory (default 256).  Parts of files\n"
+	 "    that can't be carved yet when their data leaves the window are\n"
+	 "    written early.\n"
+
+	 "--buffer-size  Read the image this many kilobytes at a time (default\n"
+	 "    10240).\n"
+
+	 "--queue-length  Number of read buffers, so reads run ahead of searches\n"
+	 "    (default 20).\n"
+
+	 "--max-open-files  Number of carved files kept open at once in pass 2.\n"
+
+	 "--auto-tune  Time reads from the first image to choose the buffer size\n"
+	 "    and queue length, using at most this many megabytes for buffers.\n"
+
+	 "--mmap  Search and carve image files through memory-mapped windows\n"
+	 "    instead of reading them into buffers.  Devices are still read.\n"
+
+	 "--async-reads  Keep this many reads of the image in flight at once,\n"
+	 "    for devices that need a deep queue to reach full speed.\n"
+
+	 "--direct-io  With --async-reads, read around the page cache.\n"
+
+	 "--split-image  Read an <imgfile> such as image.001 together with the\n"
+	 "    numbered segments that follow it, as one image.  Later segments\n"
+	 "    named after it are skipped.\n"
 	  );
 }
 
@@ -154,6 +208,9 @@ extractSearchSpecData(struct scalpelState *state,
   //     token[3] = begintag
   //     token[4] = endtag
   //     token[5] = search type (optional)
+  //
+  // An ALIGN=<bytes> keyword may also follow the header; it's removed
+  // by processSearchSpecLine().
 
   s->suffix = (char *)malloc(MAX_SUFFIX_LENGTH * sizeof(char));
   checkMemoryAllocation(state, s->suffix, __LINE__, __FILE__, "s->suffix");
@@ -165,6 +222,10 @@ extractSearchSpecData(struct scalpelState *state,
   checkMemoryAllocation(state, s->begintext, __LINE__, __FILE__, "s->begintext");
   s->endtext = (char *)malloc(MAX_STRING_LENGTH * sizeof(char));
   checkMemoryAllocation(state, s->endtext, __LINE__, __FILE__, "s->endtext");
+  s->beginliteral = 0;
+  s->endliteral = 0;
+  s->begindfa = 0;
+  s->enddfa = 0;
 
   if(!strncasecmp(tokenarray[0],
 		  SCALPEL_NOEXTENSION_SUFFIX,
@@ -239,6 +300,17 @@ extractSearchSpecData(struct scalpelState *state,
     if (err) {
       return SCALPEL_ERROR_BAD_HEADER_REGEX;
     }
+    // find a literal that every match must contain, to quickly rule out
+    // most of each buffer during the search
+    s->beginliteral = extractRegexLiteral(state, s->begin + 1,
+					  s->beginlength - 2, s->casesensitive);
+    if(state->useRegexDFA &&
+       !(s->begindfa = regexdfa_compile(state, s->begin + 1,
+					s->beginlength - 2,
+					s->casesensitive))) {
+      fprintf(stdout, "Regular expression %s can't be searched for "
+	      "with a DFA; using Tre.\n", s->begintext);
+    }
   }
   else {
     // non-regular expression header
@@ -248,6 +320,8 @@ extractSearchSpecData(struct scalpelState *state,
     memcpy(s->begin, tokenarray[3], s->beginlength);
     init_bm_table(s->begin, s->beginstate.bm_table, s->beginlength,
 		  s->casesensitive);
+    init_needle_verifier(state, &(s->beginverifier), s->begin,
+			 s->beginlength, s->casesensitive);
   }
 
   if(isRegularExpression(tokenarray[4])) {
@@ -272,6 +346,14 @@ extractSearchSpecData(struct scalpelState *state,
     if(err) {
       return SCALPEL_ERROR_BAD_FOOTER_REGEX;
     }
+    s->endliteral = extractRegexLiteral(state, s->end + 1, s->endlength - 2,
+					s->casesensitive);
+    if(state->useRegexDFA &&
+       !(s->enddfa = regexdfa_compile(state, s->end + 1, s->endlength - 2,
+				      s->casesensitive))) {
+      fprintf(stdout, "Regular expression %s can't be searched for "
+	      "with a DFA; using Tre.\n", s->endtext);
+    }
   }
   else {
     s->endisRE = 0;
@@ -292,6 +374,8 @@ int processSearchSpecLine(struct scalpelState *state, char *buffer, int lineNumb
   char *token;
   char **tokenarray = (char **)malloc(6 * sizeof(char[MAX_STRING_LENGTH + 1]));
   int i = 0, err = 0, len = strlen(buffer);
+  unsigned long alignment = 0;
+  char *end;
 
   checkMemoryAllocation(state, tokenarray, __LINE__, __FILE__, "tokenarray");
 
@@ -333,9 +417,21 @@ int processSearchSpecLine(struct scalpelState *state, char *buffer, int lineNumb
     return SCALPEL_OK;
   }
 
-  while (token && (i < NUM_SEARCH_SPEC_ELEMENTS)) {
-    tokenarray[i] = token;
-    i++;
+  while (token) {
+    // per-type header alignment may appear anywhere after the header
+    if(i > 3 && !strncasecmp(token, "ALIGN=", 6)) {
+      alignment = strtoul(token + 6, &end, 10);
+      if(alignment == 0 || *end) {
+	fprintf(stderr,
+		"\nERROR: In line %d of the configuration file, bad alignment"
+		" \"%s\".\n", lineNumber, token + 6);
+	return SCALPEL_ERROR_NO_SEARCH_SPEC;
+      }
+    }
+    else if(i < NUM_SEARCH_SPEC_ELEMENTS) {
+      tokenarray[i] = token;
+      i++;
+    }
     token = strtok(NULL, " \t\n");
   }
 
@@ -380,11 +476,78 @@ int processSearchSpecLine(struct scalpelState *state, char *buffer, int lineNumb
 	      lineNumber);
     }
   }
+
+  // a type's own alignment overrides "-q"
+  if(!alignment && state->blockAlignedOnly) {
+    alignment = state->alignedblocksize;
+  }
+  state->SearchSpec[state->specLines].alignment = alignment;
   state->specLines++;
   return SCALPEL_OK;
 }
 
 
+// compile all fixed-string (non-regular expression) headers and
+// footers into a single multi-pattern automaton, so that pass 1
+// examines each buffer of the image only once for all of them.  Footers
+// are left out if they're searched for while carving instead.
+void buildLiteralSearch(struct scalpelState *state) {
+
+  struct SearchSpecLine *s;
+  int i;
+
+  multisearch_init(&(state->literalsearch));
+  for(i = 0; i < state->specLines; i++) {
+    s = &(state->SearchSpec[i]);
+    // aligned headers are tested directly at aligned offsets
+    if(!s->beginisRE && s->beginlength > 0 && !s->alignment) {
+      multisearch_add(state, &(state->literalsearch), s->begin,
+		      s->beginlength, s->beginstate.bm_table,
+		      s->casesensitive, i, MULTISEARCH_HEADER);
+    }
+    if(!s->endisRE && s->endlength > 0 && !state->deferFooters) {
+      multisearch_add(state, &(state->literalsearch), s->end,
+		      s->endlength, s->endstate.bm_table,
+		      s->casesensitive, i, MULTISEARCH_FOOTER);
+    }
+  }
+  multisearch_compile(state, &(state->literalsearch));
+}
+
+
+// make room for at least one more file type, plus the empty marker at
+// the end of the SearchSpec array.  There's no limit on the number of
+// file types.
+static void growSearchSpec(struct scalpelState *state) {
+
+  int i, storage;
+
+  if(state->specLines + 1 < state->specLineStorage) {
+    return;
+  }
+
+  storage = state->specLineStorage ? state->specLineStorage * 2 :
+    INITIAL_FILE_TYPES;
+  state->SearchSpec = (struct SearchSpecLine *)
+    realloc(state->SearchSpec, storage * sizeof(struct SearchSpecLine));
+  checkMemoryAllocation(state, state->SearchSpec, __LINE__, __FILE__,
+			"state->SearchSpec");
+
+  // GGRIII: initialize header/footer offset data, carved file count,
+  // et al.  The header/footer database is re-initialized in "dig.c"
+  // after each image file is processed (numfilestocarve and
+  // organizeDirNum are not). Storage for the header/footer offsets
+  // will be allocated as needed.
+  for(i = state->specLineStorage; i < storage; i++) {
+    offsets_init(&(state->SearchSpec[i].offsets.headers));
+    offsets_init(&(state->SearchSpec[i].offsets.footers));
+    state->SearchSpec[i].numfilestocarve = 0;
+    state->SearchSpec[i].organizeDirNum = 0;
+  }
+  state->specLineStorage = storage;
+}
+
+
 // process configuration file
 int readSearchSpecFile(struct scalpelState *state) {
 
@@ -408,15 +571,7 @@ int readSearchSpecFile(struct scalpelState *state) {
   while (fgets(buffer, NUM_SEARCH_SPEC_ELEMENTS * MAX_STRING_LENGTH, f)) {
     lineNumber++;
 
-    if(state->specLines > MAX_FILE_TYPES) {
-      fprintf(stderr, "Your conf file contains too many file types.\n");
-      fprintf(stderr,
-	      "This version was compiled with MAX_FILE_TYPES == %d.\n",
-	      MAX_FILE_TYPES);
-      fprintf(stderr, "Increase MAX_FILE_TYPES, recompile, and try again.\n");
-      free(buffer);
-      return SCALPEL_ERROR_TOO_MANY_TYPES;
-    }
+    growSearchSpec(state);
 
     if((status =
 	processSearchSpecLine(state, buffer, lineNumber)) != SCALPEL_OK) {
@@ -440,6 +595,8 @@ int readSearchSpecFile(struct scalpelState *state) {
 
   fclose(f);
   free(buffer);
+
+  buildLiteralSearch(state);
   return SCALPEL_OK;
 }
 
@@ -469,8 +626,6 @@ void registerSignalHandlers() {
 void initializeState(char **argv, struct scalpelState *state) {
 
   char **argvcopy = argv;
-  int sss;
-  int i;
 
   // Allocate memory for state 
   state->imagefile = (char *)malloc(MAX_STRING_LENGTH * sizeof(char));
@@ -491,32 +646,15 @@ void initializeState(char **argv, struct scalpelState *state) {
 
   // GGRIII: memory allocation made more sane, because we're storing
   // more information in Scalpel than foremost had to, for each file
-  // type.
-  sss = (MAX_FILE_TYPES + 1) * sizeof(struct SearchSpecLine);
-  state->SearchSpec = (struct SearchSpecLine *)malloc(sss);
-  checkMemoryAllocation(state, state->SearchSpec, __LINE__, __FILE__,
-			"state->SearchSpec");
+  // type.  The SearchSpec array grows as the configuration file is read.
+  state->SearchSpec = 0;
   state->specLines = 0;
-
-  // GGRIII: initialize header/footer offset data, carved file count,
-  // et al.  The header/footer database is re-initialized in "dig.c"
-  // after each image file is processed (numfilestocarve and
-  // organizeDirNum are not). Storage for the header/footer offsets
-  // will be reallocated as needed.
-
-  for(i = 0; i < MAX_FILE_TYPES; i++) {
-    state->SearchSpec[i].offsets.headers = 0;
-    state->SearchSpec[i].offsets.footers = 0;
-    state->SearchSpec[i].offsets.numheaders = 0;
-    state->SearchSpec[i].offsets.numfooters = 0;
-    state->SearchSpec[i].offsets.headerstorage = 0;
-    state->SearchSpec[i].offsets.footerstorage = 0;
-    state->SearchSpec[i].numfilestocarve = 0;
-    state->SearchSpec[i].organizeDirNum = 0;
-  }
+  state->specLineStorage = 0;
+  growSearchSpec(state);
 
   state->fileswritten = 0;
   state->skip = 0;
+  state->imageSegments = 0;
   state->organizeMaxFilesPerSub = MAX_FILES_PER_SUBDIRECTORY;
   state->modeVerbose = FALSE;
   state->modeNoSuffix = FALSE;
@@ -530,6 +668,22 @@ void initializeState(char **argv, struct scalpelState *state) {
   state->blockAlignedOnly = FALSE;
   state->organizeSubdirectories = TRUE;
   state->previewMode = FALSE;
+  state->numthreads = 0;
+  state->useRegexDFA = FALSE;
+  state->hfdMemoryLimit = 0;
+  state->deferFooters = FALSE;
+  state->singlePass = FALSE;
+  state->retentionWindow = DEFAULT_RETENTION_WINDOW;
+  state->bufferSize = DEFAULT_SIZE_OF_BUFFER;
+  state->queueLength = DEFAULT_QUEUELEN;
+  state->maxFilesToOpen = DEFAULT_MAX_FILES_TO_OPEN;
+  state->autoTuneMemory = 0;
+  state->useMmap = FALSE;
+  state->asyncReads = 0;
+  state->directIO = FALSE;
+  state->splitImages = FALSE;
+  state->segmentsRead = 0;
+  state->numSegmentsRead = 0;
   state->handleEmbedded = FALSE;
   state->auditFile = NULL;
 
@@ -553,15 +707,52 @@ void initializeState(char **argv, struct scalpelState *state) {
   }
   while (*argvcopy);
 
+  init_string_search();
   registerSignalHandlers();
 }
 
+// long options without a single character equivalent
+#define OPTION_THREADS  256
+#define OPTION_REGEX_DFA  257
+#define OPTION_HFD_MEMORY_LIMIT  258
+#define OPTION_DEFER_FOOTERS  259
+#define OPTION_SINGLE_PASS  260
+#define OPTION_RETENTION_WINDOW  261
+#define OPTION_BUFFER_SIZE  262
+#define OPTION_QUEUE_LENGTH  263
+#define OPTION_MAX_OPEN_FILES  264
+#define OPTION_AUTO_TUNE  265
+#define OPTION_MMAP  266
+#define OPTION_ASYNC_READS  267
+#define OPTION_DIRECT_IO  268
+#define OPTION_SPLIT_IMAGE  269
+
+static struct option longopts[] = {
+  {"threads", required_argument, 0, OPTION_THREADS},
+  {"regex-dfa", no_argument, 0, OPTION_REGEX_DFA},
+  {"hfd-memory-limit", required_argument, 0, OPTION_HFD_MEMORY_LIMIT},
+  {"defer-footers", no_argument, 0, OPTION_DEFER_FOOTERS},
+  {"single-pass", no_argument, 0, OPTION_SINGLE_PASS},
+  {"retention-window", required_argument, 0, OPTION_RETENTION_WINDOW},
+  {"buffer-size", required_argument, 0, OPTION_BUFFER_SIZE},
+  {"queue-length", required_argument, 0, OPTION_QUEUE_LENGTH},
+  {"max-open-files", required_argument, 0, OPTION_MAX_OPEN_FILES},
+  {"auto-tune", required_argument, 0, OPTION_AUTO_TUNE},
+  {"mmap", no_argument, 0, OPTION_MMAP},
+  {"async-reads", required_argument, 0, OPTION_ASYNC_READS},
+  {"direct-io", no_argument, 0, OPTION_DIRECT_IO},
+  {"split-image", no_argument, 0, OPTION_SPLIT_IMAGE},
+  {0, 0, 0, 0}
+};
+
 // parse command line arguments
 void processCommandLineArgs(int argc, char **argv, struct scalpelState *state) {
-  char i;
+  int i;
   int numopts = 1;
+  int buffersgiven = FALSE;	// --buffer-size or --queue-length given?
 
-  while ((i = getopt(argc, argv, "behvVu:ndpq:rc:o:s:i:m:M:O")) != -1) {
+  while ((i = getopt_long(argc, argv, "behvVu:ndpq:rc:o:s:i:m:M:O",
+			  longopts, NULL)) != -1) {
     numopts++;
     switch (i) {
 
@@ -673,6 +864,118 @@ void processCommandLineArgs(int argc, char **argv, struct scalpelState *state) {
       state->modeVerbose = TRUE;
       break;
 
+    case OPTION_THREADS:
+      numopts++;
+      state->numthreads = atoi(optarg);
+      if(state->numthreads <= 0) {
+	fprintf(stderr,
+		"\nERROR: Invalid number of threads for --threads option.\n");
+	exit(1);
+      }
+      break;
+
+    case OPTION_REGEX_DFA:
+      state->useRegexDFA = TRUE;
+      break;
+
+    case OPTION_HFD_MEMORY_LIMIT:
+      numopts++;
+      state->hfdMemoryLimit = strtoull(optarg, NULL, 10) * 1024 * 1024;
+      if(state->hfdMemoryLimit == 0) {
+	fprintf(stderr,
+		"\nERROR: Invalid size for --hfd-memory-limit option.\n");
+	exit(1);
+      }
+      break;
+
+    case OPTION_DEFER_FOOTERS:
+      state->deferFooters = TRUE;
+      break;
+
+    case OPTION_SINGLE_PASS:
+      state->singlePass = TRUE;
+      break;
+
+    case OPTION_RETENTION_WINDOW:
+      numopts++;
+      state->retentionWindow = strtoull(optarg, NULL, 10) * 1024 * 1024;
+      break;
+
+    case OPTION_BUFFER_SIZE:
+      numopts++;
+      buffersgiven = TRUE;
+      state->bufferSize = strtoull(optarg, NULL, 10) * KILOBYTE;
+      if(state->bufferSize < MIN_SIZE_OF_BUFFER) {
+	fprintf(stderr,
+		"\nERROR: --buffer-size must be at least %d kilobytes.\n",
+		MIN_SIZE_OF_BUFFER / KILOBYTE);
+	exit(1);
+      }
+      break;
+
+    case OPTION_QUEUE_LENGTH:
+      numopts++;
+      buffersgiven = TRUE;
+      state->queueLength = atoi(optarg);
+      if(state->queueLength <= SEARCH_BUFFERS_IN_FLIGHT) {
+	fprintf(stderr,
+		"\nERROR: --queue-length must be greater than %d.\n",
+		SEARCH_BUFFERS_IN_FLIGHT);
+	exit(1);
+      }
+      break;
+
+    case OPTION_MAX_OPEN_FILES:
+      numopts++;
+      state->maxFilesToOpen = atoi(optarg);
+      if(state->maxFilesToOpen <= 0) {
+	fprintf(stderr,
+		"\nERROR: Invalid number for --max-open-files option.\n");
+	exit(1);
+      }
+      break;
+
+    case OPTION_AUTO_TUNE:
+      numopts++;
+      state->autoTuneMemory = strtoull(optarg, NULL, 10) * MEGABYTE;
+      if(state->autoTuneMemory == 0) {
+	fprintf(stderr, "\nERROR: Invalid size for --auto-tune option.\n");
+	exit(1);
+      }
+      break;
+
+    case OPTION_MMAP:
+#if defined(_WIN32) || defined(GPU_THREADING)
+      fprintf(stderr, "\nERROR: --mmap isn't supported by this build.\n");
+      exit(1);
+#endif
+      state->useMmap = TRUE;
+      break;
+
+    case OPTION_ASYNC_READS:
+      numopts++;
+#if defined(_WIN32) || defined(GPU_THREADING)
+      fprintf(stderr,
+	      "\nERROR: --async-reads isn't supported by this build.\n");
+      exit(1);
+#endif
+      state->asyncReads = atoi(optarg);
+      if(state->asyncReads < 1 || state->asyncReads > ASYNCREAD_MAX_DEPTH) {
+	fprintf(stderr,
+		"\nERROR: --async-reads must be between 1 and %d.\n",
+		ASYNCREAD_MAX_DEPTH);
+	exit(1);
+      }
+      break;
+
+    case OPTION_DIRECT_IO:
+      state->directIO = TRUE;
+      break;
+
+    case OPTION_SPLIT_IMAGE:
+      state->splitImages = TRUE;
+      break;
+
     default:
       exit(1);
     }
@@ -691,6 +994,57 @@ void processCommandLineArgs(int argc, char **argv, struct scalpelState *state) {
 	    "specified on the command line.\n");
     exit(1);
   }
+
+  if(state->deferFooters && state->generateHeaderFooterDatabase) {
+    fprintf(stderr,
+	    "\nFooters can't be deferred when a header/footer database is being\n"
+	    "generated, since it must hold all of the footers.\n");
+    exit(1);
+  }
+
+  if(state->autoTuneMemory && buffersgiven) {
+    fprintf(stderr,
+	    "\n--auto-tune chooses the buffer size and queue length, so they\n"
+	    "can't be given on the command line, too.\n");
+    exit(1);
+  }
+
+  // auto-tuning keeps the retention window at least two buffers long
+  if(state->singlePass && !state->autoTuneMemory &&
+     state->retentionWindow < 2 * state->bufferSize) {
+    fprintf(stderr,
+	    "\nERROR: --retention-window must hold at least two buffers.\n");
+    exit(1);
+  }
+
+  if(state->useMmap &&
+     (state->updateCoverageBlockmap || state->useCoverageBlockmap)) {
+    fprintf(stderr,
+	    "\nImages can't be mapped when a coverage blockmap is used, since\n"
+	    "the blockmap decides which parts of the image are read.\n");
+    exit(1);
+  }
+
+  if(state->asyncReads &&
+     (state->useMmap || state->updateCoverageBlockmap ||
+      state->useCoverageBlockmap)) {
+    fprintf(stderr,
+	    "\n--async-reads can't be combined with --mmap or a coverage\n"
+	    "blockmap, which decide how the image is read.\n");
+    exit(1);
+  }
+
+  if(state->directIO && !state->asyncReads) {
+    fprintf(stderr, "\n--direct-io needs --async-reads.\n");
+    exit(1);
+  }
+
+  if(state->singlePass && state->deferFooters) {
+    fprintf(stderr,
+	    "\nFooters can't be deferred in single-pass mode, since files are\n"
+	    "carved before the image has been read again.\n");
+    exit(1);
+  }
 }
 
 // full pathnames for all files used
@@ -754,6 +1108,11 @@ void digAllFiles(char **argv, struct scalpelState *state) {
       // GGRIII: this function now *only* builds the header/footer
       // database.  Carving is handled afterward, in carveImageFile().
 
+      if(segmentAlreadyRead(state, state->imagefile)) {
+	scalpelLog(state, "\n%s was read as a segment of a split image.\n"
+		   "Skipping...\n", state->imagefile);
+	continue;
+      }
       if((i = digImageFile(state)) != SCALPEL_OK) {
 	handleError(state, i);
 		continue;
@@ -778,7 +1137,11 @@ void digAllFiles(char **argv, struct scalpelState *state) {
       // GGRIII: this function now *only* builds the header/footer
       // database.  Carving is handled afterward, in carveImageFile().
 
-      if((i = digImageFile(state))) {
+      if(segmentAlreadyRead(state, state->imagefile)) {
+	scalpelLog(state, "\n%s was read as a segment of a split image.\n"
+		   "Skipping...\n", state->imagefile);
+      }
+      else if((i = digImageFile(state))) {
 	handleError(state, i);
 	continue;
       }
@@ -810,7 +1173,7 @@ int main(int argc, char **argv) {
   ///////// END JUST  A TEST FOR WIN32 TSK LINKAGE ///////////
 
 
-  if(ldiv(SIZE_OF_BUFFER, SCALPEL_BLOCK_SIZE).rem != 0) {
+  if(ldiv(DEFAULT_SIZE_OF_BUFFER, SCALPEL_BLOCK_SIZE).rem != 0) {
     fprintf(stderr, SCALPEL_SIZEOFBUFFER_PANIC_STRING);
     exit(-1);
   }
@@ -844,8 +1207,13 @@ int main(int argc, char **argv) {
       exit(-1);
     }
     
+  	// Choose the size and number of read buffers, if asked to.
+  	if(state.autoTuneMemory) {
+  	  autoTuneBuffers(&state, argv);
+  	}
+
   	// Initialize the backing store of buffer to read-in, process image data.
-  	init_store();
+  	init_store(&state);
 
   	// Initialize threading model for cpu or gpu search.
   	init_threading_model(&state);
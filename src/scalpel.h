@@ -29,6 +29,11 @@
 #define MULTICORE_THREADING
 #define USE_FAST_STRING_SEARCH
 
+// string search implementations selectable at runtime
+#define STRING_SEARCH_SCALAR        0
+#define STRING_SEARCH_SSE2          1
+#define STRING_SEARCH_AVX2          2
+
 #define _USE_LARGEFILE              1
 #define _USE_FILEOFFSET64           1
 #define _USE_LARGEFILE64            1
@@ -41,6 +46,7 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <ctype.h>
 #include <sys/stat.h>
 #include <time.h>
@@ -59,6 +65,12 @@
 #include "base_name.h"
 #include "prioque.h"
 #include "syncqueue.h"
+#include "multisearch.h"
+#include "regexdfa.h"
+#include "offsets.h"
+#include "asyncread.h"
+#include "segments.h"
+#include "workpool.h"
 #include "common.h"
 
 
@@ -108,6 +120,7 @@ int getopt (int argc, char *const argv[], const char *optstring);
 #endif
 #else // ! defined(WIN32)
 #include <sys/mount.h>
+#include <sys/mman.h>
 #define gettimeofday_t struct timeval
 #endif // ! defined(WIN32)
 
@@ -116,25 +129,62 @@ int getopt (int argc, char *const argv[], const char *optstring);
 #define SEARCHTYPE_FORWARD_NEXT 2
 
 // LARGEST_REGEXP_OVERLAP specifies the largest regular expression overlap
-// across the boundaries of SIZE_OF_BUFFER-sized chunks of the disk image.
+// across the boundaries of buffer-sized chunks of the disk image.
 //  This is also used internally as the maximum "size" of a regular expression
 // and affects the mininum disk image size that can be processed.  Large
 // values will have negative impacts on performance.
 #define LARGEST_REGEXP_OVERLAP    1024
 
 #define SCALPEL_SIZEOFBUFFER_PANIC_STRING \
-"PANIC: SIZE_OF_BUFFER has been incorrectly configured.\n"
+"PANIC: DEFAULT_SIZE_OF_BUFFER has been incorrectly configured.\n"
 
 #define SCALPEL_BLOCK_SIZE            512
 #define MAX_STRING_LENGTH            4096
 #define MAX_NEEDLES                   254
 #define NUM_SEARCH_SPEC_ELEMENTS        6
 #define MAX_SUFFIX_LENGTH               8
-#define MAX_FILE_TYPES                100
-#define MAX_MATCHES_PER_BUFFER        (SIZE_OF_BUFFER / 10)	// BUG: MUST ERROR OUT PROPERLY ON OVERFLOW (check)
-
-// Length of the queues used to tranfer data / results blocks to workers.
-#define QUEUELEN 20
+#define INITIAL_FILE_TYPES            100
+
+// Length of the queues used to tranfer data / results blocks to workers,
+// unless --queue-length or --auto-tune is given.
+#define DEFAULT_QUEUELEN 20
+
+// Smallest buffer size accepted by --buffer-size and tried by --auto-tune
+#define MIN_SIZE_OF_BUFFER            (64 * KILOBYTE)
+
+// --auto-tune times reads of each buffer size from MIN_SIZE_OF_BUFFER up
+// to MAX_AUTO_TUNE_BUFFER, in steps of a factor of AUTO_TUNE_STEP, for
+// about AUTO_TUNE_PROBE_BYTES or AUTO_TUNE_PROBE_TIME seconds each.  The
+// smallest size within AUTO_TUNE_TOLERANCE percent of the best
+// throughput is used, with as many buffers as fit in the memory cap, up
+// to MAX_AUTO_TUNE_QUEUELEN.
+#define MAX_AUTO_TUNE_BUFFER          (64 * MEGABYTE)
+#define AUTO_TUNE_STEP                4
+#define AUTO_TUNE_PROBE_BYTES         (16 * MEGABYTE)
+#define AUTO_TUNE_PROBE_TIME          0.5
+#define AUTO_TUNE_TOLERANCE           10
+#define MAX_AUTO_TUNE_QUEUELEN        64
+
+// Pass 1 searches split each buffer into slices, so that the search
+// threads stay busy even when only a few file types are being carved.
+#define SEARCH_SLICES_PER_THREAD        4
+#define MIN_SEARCH_SLICE_SIZE         (256 * KILOBYTE)
+
+// Number of buffers searched by the thread pool at once.  Must be less
+// than the queue length, so the reader always has a buffer to read into.
+#define SEARCH_BUFFERS_IN_FLIGHT        4
+
+// With --defer-footers, windows of the image searched for footers
+// during carving are read together if they're at most this far apart
+#define MAX_DEFERRED_FOOTER_GAP       (32 * KILOBYTE)
+
+// Holes in sparse image files at least this long are filled with zeroes
+// instead of being read
+#define MIN_SKIPPED_HOLE              (64 * KILOBYTE)
+
+// With --single-pass, bytes of recently read image data kept in memory
+// for carving, unless --retention-window is given
+#define DEFAULT_RETENTION_WINDOW      (256 * MEGABYTE)
 
 #define MAX_FILES_PER_SUBDIRECTORY    1000
 
@@ -191,6 +241,9 @@ extern double totalwrites;	// # of seconds spent in pass # 2 for writing carved
 
 #define SCALPEL_DEFAULT_OUTPUT_DIR     "scalpel-output"
 
+// image name for reading the image from standard input
+#define SCALPEL_STDIN_IMAGE            "-"
+
 #define SCALPEL_BANNER_STRING \
 "Scalpel version %s\n"\
 "Written by Golden G. Richard III and Lodovico Marziale.\n", SCALPEL_VERSION
@@ -228,9 +281,31 @@ typedef struct CarveInfo {
   char chopped;			// is carved file's length constrained
   // by max file size for type? (i.e., could
   // the file actually be longer?
+  char *partfilename;		// in single-pass mode, file the carve
+				// was written to during pass 1, or 0
 } CarveInfo;
 
 
+// a window of an image file mapped by mapImageWindow().  Windows are
+// mapped one buffer at a time, so images larger than the address space
+// can be mapped, too.
+typedef struct MappedWindow {
+  void *mapping;		// start of the mapping, on a page boundary
+  size_t length;		// length of the mapping, 0 if none
+  char *data;			// first byte of the window
+} MappedWindow;
+
+
+// the holes in a sparse image file, found by findImageHoles(), as
+// sorted, disjoint ranges [start, end) of file offsets
+typedef struct ImageHoles {
+  long long *start;
+  long long *end;
+  int count;
+  int storage;			// ranges allocated
+} ImageHoles;
+
+
 // Each struct SearchSpecLine defines a particular file type,
 // including header and footer information.  The following structure,
 // SearchSpecOffsets, defines the absolute locations of all matching
@@ -240,22 +315,17 @@ typedef struct CarveInfo {
 // ascending order.
 
 typedef struct SearchSpecOffsets {
-  unsigned long long *headers;	// positions of discovered headers
-  size_t *headerlens;		// lengths of discovered headers
-  unsigned long long headerstorage;	// space allocated for this many header offsets
-  unsigned long long numheaders;	// # stored header positions
-  unsigned long long *footers;	// positions of discovered footers
-  size_t *footerlens;		// lengths of discovered footers
-  unsigned long long footerstorage;	// space allocated for this many footer offsets
-  unsigned long long numfooters;	// # stored footer positions
+  OffsetList headers;		// positions and lengths of discovered headers
+  OffsetList footers;		// positions and lengths of discovered footers
 } SearchSpecOffsets;
 
-// max files to open at once during carving--modify if you get
-// a "too many files open" error message during the second carving phase.
+// max files to open at once during carving, unless --max-open-files is
+// given--lower it if you get a "too many files open" error message during
+// the second carving phase.
 #ifdef _WIN32
-#define MAX_FILES_TO_OPEN            20
+#define DEFAULT_MAX_FILES_TO_OPEN    20
 #else
-#define MAX_FILES_TO_OPEN            512
+#define DEFAULT_MAX_FILES_TO_OPEN    512
 #endif
 
 
@@ -264,6 +334,24 @@ typedef union SearchState {
   regex_t re;
 } SearchState;
 
+// marks a regular expression (or part of one) whose matches have no
+// upper bound on their length
+#define REGEX_UNBOUNDED ((size_t)-1)
+
+// a literal string that every match of a regular expression needle
+// must contain.  Candidate positions are found with the fast string
+// search, and the regular expression is only run on a window around
+// each candidate.
+typedef struct RegexLiteral {
+  char literal[MAX_STRING_LENGTH];
+  size_t length;
+  size_t before;		// max # of bytes matched before the literal
+  size_t width;			// max # of bytes matched by the regular expression
+  int casesensitive;
+  size_t table[UCHAR_MAX + 1];	// Boyer-Moore jump table for the literal
+  NeedleVerifier verifier;	// full comparison for the literal
+} RegexLiteral;
+
 typedef struct SearchSpecLine {
   char *suffix;
   int casesensitive;
@@ -274,12 +362,19 @@ typedef struct SearchSpecLine {
   int beginlength;
   int beginisRE;
   SearchState beginstate;
+  RegexLiteral *beginliteral;	// required literal for regex header, or NULL
+  RegexDFA *begindfa;		// streaming matcher for regex header, or NULL
+  NeedleVerifier beginverifier;	// full comparison for fixed-string header
   char *end;            // translate()-d footer
   char *endtext;        // textual version of footer for humans
   int endlength;
   int endisRE;
   SearchState endstate;
+  RegexLiteral *endliteral;	// required literal for regex footer, or NULL
+  RegexDFA *enddfa;		// streaming matcher for regex footer, or NULL
   int searchtype;		// FORWARD, NEXT, REVERSE search type for footer
+  unsigned int alignment;	// headers are only searched for at multiples
+				// of this image offset, or 0 for anywhere
   struct SearchSpecOffsets offsets;
   unsigned long long numfilestocarve;	// # files to carve of this type
   unsigned long organizeDirNum;	// subdirectory # for organization 
@@ -290,9 +385,11 @@ typedef struct SearchSpecLine {
 typedef struct scalpelState {
   char *imagefile;
   FILE *infile;
+  int imageSegments;		// segments of a split image, or 0
   char *conffile;
   char *outputdirectory;
   int specLines;
+  int specLineStorage;		// SearchSpec entries allocated
   struct SearchSpecLine *SearchSpec;
   unsigned long long fileswritten;
   int modeVerbose;
@@ -318,6 +415,30 @@ typedef struct scalpelState {
   int blockAlignedOnly;
   unsigned int alignedblocksize;
   int previewMode;
+  MultiSearch literalsearch;	// automaton for all fixed-string needles
+  int numthreads;		// size of search thread pool, 0 = one per CPU
+  int useRegexDFA;		// search for regexes with streaming DFAs?
+  unsigned long long hfdMemoryLimit;	// bytes of header/footer database
+					// kept in memory, 0 = no limit
+  int deferFooters;		// search for footers while carving, near
+				// headers, instead of in pass 1?
+  int singlePass;		// write carved files during pass 1?
+  unsigned long long retentionWindow;	// with singlePass, bytes of image
+					// data kept in memory for carving
+  unsigned long long bufferSize;	// bytes of the image read at a time
+  int queueLength;		// number of read buffers
+  int maxFilesToOpen;		// carved files kept open at once in pass 2
+  unsigned long long autoTuneMemory;	// with --auto-tune, memory for read
+					// buffers, 0 = no auto-tuning
+  int useMmap;			// read regular image files through
+				// memory-mapped windows?
+  int asyncReads;		// reads of the image kept in flight, 0 =
+				// one blocking read at a time
+  int directIO;			// with asyncReads, bypass the page cache?
+  int splitImages;		// read numbered segments as one image?
+  char **segmentsRead;		// real paths of the segments read as part
+				// of split images so far
+  int numSegmentsRead;
 } scalpelState;
 
 
@@ -334,14 +455,14 @@ typedef struct Fragment {
 int init_threading_model (struct scalpelState *state);
 int digImageFile (struct scalpelState *state);
 int carveImageFile (struct scalpelState *state);
-void init_store ();  // return int for error??
+void init_store (struct scalpelState *state);  // return int for error??
 
 // prototypes for visible helpers.c functions
 
-// LMIII fix me
-#ifndef _WIN32
+#ifdef _WIN32
+double elapsed (LARGE_INTEGER A, LARGE_INTEGER B);
+#else
 double elapsed (struct timeval A, struct timeval B);
-//double elapsed(gettimeofday_t a, gettimeofday_t b);
 #endif
 int isRegularExpression (char *s);
 void checkMemoryAllocation (struct scalpelState *state, void *ptr, int line,
@@ -352,14 +473,27 @@ void handleError (struct scalpelState *s, int error);
 int memwildcardcmp (const void *s1, const void *s2,
 		    size_t n, int caseSensitive);
 void setProgramName (char *s);
+int find_needle_fragment (char *needle, size_t len, int casesensitive,
+			  size_t * offset, size_t * length);
 void init_bm_table (char *needle, size_t table[UCHAR_MAX + 1],
 		    size_t len, int casesensitive);
+void init_needle_verifier (struct scalpelState *state, NeedleVerifier * v,
+			   char *needle, size_t len, int casesensitive);
+void destroy_needle_verifier (NeedleVerifier * v);
 int findLongestNeedle (struct SearchSpecLine *SearchSpec);
-regmatch_t *re_needleinhaystack (regex_t * needle,
-				 char *haystack, size_t haystack_len);
-char *bm_needleinhaystack (char *needle, size_t needle_len,
+int re_needleinhaystack (regex_t * needle, char *haystack,
+			 size_t haystack_len, regmatch_t * match);
+RegexLiteral *extractRegexLiteral (struct scalpelState *state, char *re,
+				   size_t len, int casesensitive);
+void init_string_search (void);
+int string_search_level (void);
+char *bm_needleinhaystack_skipnchars (const NeedleVerifier * needle,
+				      char *haystack, size_t haystack_len,
+				      size_t table[UCHAR_MAX + 1],
+				      int start_pos);
+char *bm_needleinhaystack (const NeedleVerifier * needle,
 			   char *haystack, size_t haystack_len,
-			   size_t table[UCHAR_MAX + 1], int casesensitive);
+			   size_t table[UCHAR_MAX + 1]);
 int translate (char *str);
 char *skipWhiteSpace (char *str);
 void setttywidth ();
@@ -368,6 +502,20 @@ void setttywidth ();
 long long measureOpenFile (FILE * f, struct scalpelState *state);
 int openAuditFile (struct scalpelState *state);
 int closeAuditFile (FILE * f);
+void autoTuneBuffers (struct scalpelState *state, char **argv);
+int useMappedImage (struct scalpelState *state, FILE * f);
+int isStreamedImage (char *imagefile, FILE * f);
+FILE *openImageFile (struct scalpelState *state);
+void recordSegmentsRead (struct scalpelState *state);
+int segmentAlreadyRead (struct scalpelState *state, char *imagefile);
+void findImageHoles (struct scalpelState *state, FILE * f,
+		     ImageHoles * holes);
+int isImageHole (ImageHoles * holes, long long start, long long length);
+size_t readImageData (ImageHoles * holes, char *buf, size_t length,
+		      FILE * f);
+char *mapImageWindow (FILE * f, off64_t offset, size_t length,
+		      MappedWindow * w);
+void unmapImageWindow (MappedWindow * w);
 
 //// prototypes for visible dig.cu functions
 int gpuSearchBuffer (char *readbuffer, int size_of_buffer, char *gpuresults,
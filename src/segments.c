@@ -0,0 +1,387 @@
+// Scalpel Copyright (C) 2005-11 by Golden G. Richard III and
+// 2007-11 by Vico Marziale.
+// Written by Golden G. Richard III and Vico Marziale.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+//
+// Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+// on Foremost.  Foremost 0.69 was used as the starting point for
+// Scalpel, in 2005.
+
+
+// Split raw images read as one stream.  See segments.h.
+
+// for fopencookie()
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#define _LARGEFILE_SOURCE           1
+#define _LARGEFILE64_SOURCE         1
+#define _FILE_OFFSET_BITS           64
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "segments.h"
+
+#if defined(__GLIBC__)
+#define USE_FOPENCOOKIE
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) \
+  || defined(__OpenBSD__) || defined(__DragonFly__)
+#define USE_FUNOPEN
+#endif
+
+#if defined(USE_FOPENCOOKIE) || defined(USE_FUNOPEN)
+#include <fcntl.h>
+#include <unistd.h>
+
+// an open set of segments
+typedef struct SegmentSet {
+  int count;
+  char **names;
+  long long *start;		// image offset of each segment; start[count]
+				// is the size of the image
+  int current;			// segment open on fd, or -1
+  int fd;
+  long long position;		// image offset of the next read
+} SegmentSet;
+
+static int findSegment(SegmentSet * set, long long position);
+static int openSegment(SegmentSet * set, int segment);
+static long long readSegments(SegmentSet * set, char *buf, size_t size);
+static int seekSegments(SegmentSet * set, long long *offset, int whence);
+static int closeSegments(SegmentSet * set);
+#endif
+
+static long segmentNumber(const char *path, size_t * prefix, int *digits);
+
+
+int segments_supported(void) {
+
+#if defined(USE_FOPENCOOKIE) || defined(USE_FUNOPEN)
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+
+int segments_count(const char *path) {
+
+  char name[FILENAME_MAX];
+  struct stat info;
+  long number = segmentNumber(path, NULL, NULL);
+  int count;
+
+  if(number < 0 || number > 1 ||
+     stat(path, &info) || !S_ISREG(info.st_mode)) {
+    return 0;
+  }
+  for(count = 1; segments_name(path, count, name, sizeof(name)) == 0 &&
+      stat(name, &info) == 0 && S_ISREG(info.st_mode); count++) {
+  }
+  return count > 1 ? count : 0;
+}
+
+
+int segments_name(const char *first, int index, char *name, size_t size) {
+
+  size_t prefix;
+  int digits, n;
+  long number = segmentNumber(first, &prefix, &digits);
+
+  if(number < 0) {
+    return -1;
+  }
+  n = snprintf(name, size, "%.*s%0*ld", (int)prefix, first, digits,
+	       number + index);
+  return n < 0 || (size_t)n >= size ? -1 : 0;
+}
+
+
+#if defined(USE_FOPENCOOKIE)
+
+static ssize_t cookieRead(void *cookie, char *buf, size_t size) {
+  return (ssize_t)readSegments((SegmentSet *) cookie, buf, size);
+}
+
+static int cookieSeek(void *cookie, off64_t * offset, int whence) {
+
+  long long position = *offset;
+
+  if(seekSegments((SegmentSet *) cookie, &position, whence)) {
+    return -1;
+  }
+  *offset = position;
+  return 0;
+}
+
+static int cookieClose(void *cookie) {
+  return closeSegments((SegmentSet *) cookie);
+}
+
+#elif defined(USE_FUNOPEN)
+
+static int funRead(void *cookie, char *buf, int size) {
+  return (int)readSegments((SegmentSet *) cookie, buf, (size_t)size);
+}
+
+static fpos_t funSeek(void *cookie, fpos_t offset, int whence) {
+
+  long long position = offset;
+
+  if(seekSegments((SegmentSet *) cookie, &position, whence)) {
+    return -1;
+  }
+  return (fpos_t)position;
+}
+
+static int funClose(void *cookie) {
+  return closeSegments((SegmentSet *) cookie);
+}
+
+#endif
+
+
+#if defined(USE_FOPENCOOKIE) || defined(USE_FUNOPEN)
+
+FILE *segments_open(const char *first, int count) {
+
+  SegmentSet *set;
+  char name[FILENAME_MAX];
+  struct stat info;
+  FILE *f;
+  int i;
+#ifdef USE_FOPENCOOKIE
+  cookie_io_functions_t functions;
+#endif
+
+  if(count < 1) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if((set = (SegmentSet *)calloc(1, sizeof(SegmentSet))) == NULL) {
+    return NULL;
+  }
+  set->names = (char **)calloc(count, sizeof(char *));
+  set->start = (long long *)calloc(count + 1, sizeof(long long));
+  set->count = count;
+  set->current = -1;
+  set->fd = -1;
+  if(set->names == NULL || set->start == NULL) {
+    closeSegments(set);
+    return NULL;
+  }
+
+  // the segments' sizes place them in the image
+  for(i = 0; i < count; i++) {
+    if(segments_name(first, i, name, sizeof(name))) {
+      closeSegments(set);
+      errno = ENAMETOOLONG;
+      return NULL;
+    }
+    if(stat(name, &info)) {
+      closeSegments(set);
+      return NULL;
+    }
+    if((set->names[i] = strdup(name)) == NULL) {
+      closeSegments(set);
+      return NULL;
+    }
+    set->start[i + 1] = set->start[i] + (long long)info.st_size;
+  }
+
+#ifdef USE_FOPENCOOKIE
+  functions.read = cookieRead;
+  functions.write = NULL;
+  functions.seek = cookieSeek;
+  functions.close = cookieClose;
+  f = fopencookie(set, "rb", functions);
+#else
+  f = funopen(set, funRead, NULL, funSeek, funClose);
+#endif
+  if(f == NULL) {
+    closeSegments(set);
+  }
+  return f;
+}
+
+
+// Return the segment holding the byte at an image offset: the last
+// segment that starts at or before it, skipping any empty segments.
+static int findSegment(SegmentSet * set, long long position) {
+
+  int low = 0, high = set->count - 1, mid;
+
+  if(set->current >= 0 && position >= set->start[set->current] &&
+     position < set->start[set->current + 1]) {
+    return set->current;
+  }
+  while (low < high) {
+    mid = (low + high + 1) / 2;
+    if(set->start[mid] <= position) {
+      low = mid;
+    }
+    else {
+      high = mid - 1;
+    }
+  }
+  return low;
+}
+
+
+// make 'segment' the open segment
+static int openSegment(SegmentSet * set, int segment) {
+
+  if(set->current == segment) {
+    return 0;
+  }
+  if(set->fd >= 0) {
+    close(set->fd);
+    set->fd = -1;
+    set->current = -1;
+  }
+  if((set->fd = open(set->names[segment], O_RDONLY)) < 0) {
+    return -1;
+  }
+  set->current = segment;
+#if defined(POSIX_FADV_SEQUENTIAL)
+  posix_fadvise(set->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  return 0;
+}
+
+
+// Read up to 'size' bytes at the current image offset, crossing from
+// segment to segment as needed.  Returns the number of bytes read, which
+// is short only at the end of the image, or -1 if nothing could be read.
+static long long readSegments(SegmentSet * set, char *buf, size_t size) {
+
+  size_t total = 0;
+  long long want, n;
+  int segment;
+
+  while (total < size && set->position < set->start[set->count]) {
+    segment = findSegment(set, set->position);
+    if(openSegment(set, segment)) {
+      break;
+    }
+    want = set->start[segment + 1] - set->position;
+    if(want > (long long)(size - total)) {
+      want = (long long)(size - total);
+    }
+    n = pread(set->fd, buf + total, (size_t)want,
+	      set->position - set->start[segment]);
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      // an error, or a segment that has shrunk since the set was opened
+      break;
+    }
+    total += (size_t)n;
+    set->position += n;
+  }
+  if(total == 0 && size > 0 && set->position < set->start[set->count]) {
+    return -1;
+  }
+  return (long long)total;
+}
+
+
+static int seekSegments(SegmentSet * set, long long *offset, int whence) {
+
+  long long base;
+
+  switch (whence) {
+  case SEEK_SET:
+    base = 0;
+    break;
+  case SEEK_CUR:
+    base = set->position;
+    break;
+  case SEEK_END:
+    base = set->start[set->count];
+    break;
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+  if(base + *offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  set->position = base + *offset;
+  *offset = set->position;
+  return 0;
+}
+
+
+static int closeSegments(SegmentSet * set) {
+
+  int i, err = 0;
+
+  if(set->fd >= 0) {
+    err = close(set->fd);
+  }
+  if(set->names) {
+    for(i = 0; i < set->count; i++) {
+      free(set->names[i]);
+    }
+  }
+  free(set->names);
+  free(set->start);
+  free(set);
+  return err;
+}
+
+#else // no cookie streams
+
+FILE *segments_open(const char *first, int count) {
+  errno = ENOSYS;
+  return NULL;
+}
+
+#endif
+
+
+// Return the number at the end of a segment's name, or -1 if the name
+// doesn't end in a dot and SEGMENTS_MIN_DIGITS or more digits.  The
+// length of the name up to the number and the number of digits are
+// returned through 'prefix' and 'digits', if they aren't NULL.
+static long segmentNumber(const char *path, size_t * prefix, int *digits) {
+
+  const char *dot = strrchr(path, '.');
+  size_t length;
+
+  if(dot == NULL) {
+    return -1;
+  }
+  length = strlen(dot + 1);
+  if(length < SEGMENTS_MIN_DIGITS || length > 9 ||
+     strspn(dot + 1, "0123456789") != length) {
+    return -1;
+  }
+  if(prefix) {
+    *prefix = (size_t)(dot + 1 - path);
+  }
+  if(digits) {
+    *digits = (int)length;
+  }
+  return strtol(dot + 1, NULL, 10);
+}
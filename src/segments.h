@@ -0,0 +1,68 @@
+// Scalpel Copyright (C) 2005-11 by Golden G. Richard III and
+// 2007-11 by Vico Marziale.
+// Written by Golden G. Richard III and Vico Marziale.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+//
+// Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+// on Foremost.  Foremost 0.69 was used as the starting point for
+// Scalpel, in 2005.
+
+
+// Split raw images.  Acquisition tools often write a raw image as a set
+// of numbered segments, image.001, image.002, ..., each holding the next
+// part of the image.  segments_open() opens such a set as one stream
+// that reads the segments back to back, so that the image can be
+// searched and carved as a whole without first concatenating it, and
+// offsets in the stream are offsets in the whole image.
+//
+// A set is named by its first segment, whose name ends in a dot and a
+// number of at least three digits, with a value of 0 or 1 (image.000 or
+// image.001).  The set runs through each consecutively numbered segment
+// that exists, and the numbers may outgrow their width (image.999 is
+// followed by image.1000).
+//
+// The stream is built with fopencookie() on glibc and funopen() on BSD
+// and Mac OS X.  Elsewhere, segments_supported() returns 0 and
+// segments_open() fails.
+
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <stdio.h>
+
+// fewest digits in a segment number
+#define SEGMENTS_MIN_DIGITS         3
+
+// Return nonzero if segment sets can be opened as one stream on this
+// system.
+int segments_supported(void);
+
+// If 'path' names the first segment of a split image of two or more
+// segments, return the number of segments, or else 0.
+int segments_count(const char *path);
+
+// Write the name of segment 'index' (0 is the first) of the set whose
+// first segment is 'first' to 'name', which holds 'size' bytes.  Returns
+// 0, or -1 if the name doesn't fit.
+int segments_name(const char *first, int index, char *name, size_t size);
+
+// Open the 'count' segments of the set whose first segment is 'first' as
+// one stream, opened for reading.  Only one segment is open at a time.
+// Returns NULL, with errno set, on error.
+FILE *segments_open(const char *first, int count);
+
+#endif // SEGMENTS_H
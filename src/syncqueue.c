@@ -44,6 +44,23 @@ void *get(syncqueue_t * queue) {
 }
 
 
+// synchronized wrapper for getting out of queue without blocking.
+// Returns NULL if the queue is empty.
+void *tryget(syncqueue_t * queue) {
+
+  void *elem = NULL;
+  pthread_mutex_lock(queue->mut);
+  if(!queue->empty) {
+    elem = dequeue(queue);
+  }
+  pthread_mutex_unlock(queue->mut);
+  if(elem) {
+    pthread_cond_signal(queue->notFull);
+  }
+  return elem;
+}
+
+
 // synchronized wrapper for putting into queue.
 void put(syncqueue_t * queue, void *elem) {
 
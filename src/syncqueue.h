@@ -47,6 +47,7 @@ typedef struct
 
 // public queue.c functions
 void *get (syncqueue_t * queue);
+void *tryget (syncqueue_t * queue);
 void put (syncqueue_t * queue, void *elem);
 void enqueue (syncqueue_t * q, void *elem);
 syncqueue_t *syncqueue_init (const char *qname, unsigned long queuesize);
@@ -0,0 +1,262 @@
+// Scalpel Copyright (C) 2005-11 by Golden G. Richard III and
+// 2007-11 by Vico Marziale.
+// Written by Golden G. Richard III and Vico Marziale.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+//
+// Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+// on Foremost.  Foremost 0.69 was used as the starting point for
+// Scalpel, in 2005.
+
+// A fixed-size pool of worker threads with work stealing.  Submitted
+// tasks are spread across the workers' queues; a worker that empties its
+// own queue steals tasks from the others, so all workers stay busy as
+// long as there's work.  Tasks are submitted in groups, and
+// workpool_wait() waits for the tasks in one group to complete, so
+// callers can keep several groups in flight at once.
+
+#include "workpool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef struct
+{
+  workpool_t *pool;
+  int id;
+} workpool_worker_t;
+
+static void *worker(void *arg);
+static int takeTask(workpool_t * pool, int id, workpool_task_t * task);
+
+
+// thread body for pool workers
+static void *worker(void *arg) {
+
+  workpool_t *pool = ((workpool_worker_t *) arg)->pool;
+  int id = ((workpool_worker_t *) arg)->id;
+  workpool_task_t task;
+
+  free(arg);
+
+  pthread_mutex_lock(pool->mut);
+  while (1) {
+    while (pool->queued == 0 && !pool->shutdown) {
+      pthread_cond_wait(pool->workAvailable, pool->mut);
+    }
+    if(pool->shutdown) {
+      break;
+    }
+    pthread_mutex_unlock(pool->mut);
+
+    while (takeTask(pool, id, &task)) {
+      task.fn(task.arg, id);
+      pthread_mutex_lock(pool->mut);
+      if(--task.group->pending == 0) {
+	pthread_cond_broadcast(pool->workComplete);
+      }
+      pthread_mutex_unlock(pool->mut);
+    }
+
+    pthread_mutex_lock(pool->mut);
+  }
+  pthread_mutex_unlock(pool->mut);
+  return NULL;
+}
+
+
+// take the oldest task from the worker's own queue or, failing that,
+// steal the oldest task from another worker.  Returns FALSE if no
+// tasks are left.
+static int takeTask(workpool_t * pool, int id, workpool_task_t * task) {
+
+  workpool_queue_t *q;
+  int i, found = FALSE;
+
+  for(i = 0; i < pool->numworkers && !found; i++) {
+    q = &(pool->slots[(id + i) % pool->numworkers].queue);
+    pthread_mutex_lock(&(q->mut));
+    if(q->head < q->tail) {
+      *task = q->tasks[q->head++];
+      found = TRUE;
+    }
+    pthread_mutex_unlock(&(q->mut));
+  }
+
+  if(found) {
+    pthread_mutex_lock(pool->mut);
+    pool->queued--;
+    pthread_mutex_unlock(pool->mut);
+  }
+  return found;
+}
+
+
+// create a pool with the specified number of worker threads
+workpool_t *workpool_init(int numworkers) {
+
+  workpool_t *pool;
+  workpool_worker_t *w;
+  int i;
+
+  if(numworkers < 1) {
+    numworkers = 1;
+  }
+
+  pool = (workpool_t *) calloc(1, sizeof(workpool_t));
+  if(pool == NULL) {
+    printf("Couldn't create thread pool! Aborting.");
+    exit(1);
+  }
+  pool->numworkers = numworkers;
+  pool->threads = (pthread_t *) malloc(numworkers * sizeof(pthread_t));
+  pool->slots =
+    (workpool_slot_t *) calloc(numworkers, sizeof(workpool_slot_t));
+  pool->mut = (pthread_mutex_t *) malloc(sizeof(pthread_mutex_t));
+  pool->workAvailable = (pthread_cond_t *) malloc(sizeof(pthread_cond_t));
+  pool->workComplete = (pthread_cond_t *) malloc(sizeof(pthread_cond_t));
+  if(!pool->threads || !pool->slots || !pool->mut || !pool->workAvailable
+     || !pool->workComplete) {
+    printf("Couldn't create thread pool! Aborting.");
+    exit(1);
+  }
+  pthread_mutex_init(pool->mut, NULL);
+  pthread_cond_init(pool->workAvailable, NULL);
+  pthread_cond_init(pool->workComplete, NULL);
+
+  for(i = 0; i < numworkers; i++) {
+    pthread_mutex_init(&(pool->slots[i].queue.mut), NULL);
+  }
+
+  for(i = 0; i < numworkers; i++) {
+    w = (workpool_worker_t *) malloc(sizeof(workpool_worker_t));
+    if(w == NULL) {
+      printf("Couldn't create thread pool! Aborting.");
+      exit(1);
+    }
+    w->pool = pool;
+    w->id = i;
+    if(pthread_create(&(pool->threads[i]), NULL, worker, w)) {
+      fprintf(stderr, "COULDN'T CREATE THREAD\n");
+      exit(1);
+    }
+  }
+
+  return pool;
+}
+
+
+void workpool_group_init(workpool_group_t * group) {
+
+  group->pending = 0;
+}
+
+
+// add a task to a group and make it available to the workers
+void
+workpool_submit(workpool_t * pool, workpool_group_t * group,
+		workpool_fn fn, void *arg) {
+
+  workpool_queue_t *q = &(pool->slots[pool->nextslot].queue);
+
+  pool->nextslot = (pool->nextslot + 1) % pool->numworkers;
+
+  // the task is counted and queued atomically with respect to the
+  // workers' bookkeeping, which is done under the pool mutex
+  pthread_mutex_lock(pool->mut);
+  group->pending++;
+  pool->queued++;
+
+  pthread_mutex_lock(&(q->mut));
+  if(q->head == q->tail) {
+    q->head = q->tail = 0;
+  }
+  if(q->tail == q->size) {
+    q->size = q->size ? q->size * 2 : 64;
+    q->tasks =
+      (workpool_task_t *) realloc(q->tasks, q->size * sizeof(workpool_task_t));
+    if(q->tasks == NULL) {
+      printf("Couldn't grow thread pool queue! Aborting.");
+      exit(1);
+    }
+  }
+  q->tasks[q->tail].fn = fn;
+  q->tasks[q->tail].arg = arg;
+  q->tasks[q->tail].group = group;
+  q->tail++;
+  pthread_mutex_unlock(&(q->mut));
+
+  pthread_cond_signal(pool->workAvailable);
+  pthread_mutex_unlock(pool->mut);
+}
+
+
+// wait for all tasks submitted to a group to complete
+void workpool_wait(workpool_t * pool, workpool_group_t * group) {
+
+  pthread_mutex_lock(pool->mut);
+  while (group->pending > 0) {
+    pthread_cond_wait(pool->workComplete, pool->mut);
+  }
+  pthread_mutex_unlock(pool->mut);
+}
+
+
+// stop the workers and release the pool
+void workpool_destroy(workpool_t * pool) {
+
+  int i;
+
+  pthread_mutex_lock(pool->mut);
+  pool->shutdown = TRUE;
+  pthread_cond_broadcast(pool->workAvailable);
+  pthread_mutex_unlock(pool->mut);
+
+  for(i = 0; i < pool->numworkers; i++) {
+    pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&(pool->slots[i].queue.mut));
+    free(pool->slots[i].queue.tasks);
+  }
+
+  pthread_mutex_destroy(pool->mut);
+  pthread_cond_destroy(pool->workAvailable);
+  pthread_cond_destroy(pool->workComplete);
+  free(pool->mut);
+  free(pool->workAvailable);
+  free(pool->workComplete);
+  free(pool->threads);
+  free(pool->slots);
+  free(pool);
+}
+
+
+// number of online processors, used as the default pool size
+int workpool_cpus(void) {
+
+#ifdef _WIN32
+  SYSTEM_INFO info;
+
+  GetSystemInfo(&info);
+  return (int)info.dwNumberOfProcessors;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return n > 0 ? (int)n : 1;
+#endif
+}
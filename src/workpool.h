@@ -0,0 +1,100 @@
+// Scalpel Copyright (C) 2005-11 by Golden G. Richard III and
+// 2007-11 by Vico Marziale.
+// Written by Golden G. Richard III and Vico Marziale.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+//
+// Thanks to Kris Kendall, Jesse Kornblum, et al for their work
+// on Foremost.  Foremost 0.69 was used as the starting point for
+// Scalpel, in 2005.
+
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifndef TRUE
+#define TRUE 	1
+#define FALSE 	0
+#endif
+
+// task queues are padded to this size so that workers taking tasks
+// from their own queues don't contend for cache lines
+#define WORKPOOL_CACHE_LINE 64
+
+
+// a task is run as fn(arg, worker), where worker is the index of the
+// thread running it, in [0, numworkers)
+typedef void (*workpool_fn) (void *arg, int worker);
+
+// tasks are submitted as part of a group, and workpool_wait() waits
+// for all tasks in a group to complete
+typedef struct
+{
+  unsigned long pending;	// tasks submitted but not yet completed
+} workpool_group_t;
+
+typedef struct
+{
+  workpool_fn fn;
+  void *arg;
+  workpool_group_t *group;
+} workpool_task_t;
+
+// tasks held by one worker, in [head, tail), in submission order.
+// Idle workers steal from the other workers' queues.
+typedef struct
+{
+  pthread_mutex_t mut;
+  workpool_task_t *tasks;
+  unsigned long head, tail;
+  unsigned long size;
+} workpool_queue_t;
+
+typedef union
+{
+  workpool_queue_t queue;
+  char pad[((sizeof (workpool_queue_t) + WORKPOOL_CACHE_LINE - 1) /
+	    WORKPOOL_CACHE_LINE) * WORKPOOL_CACHE_LINE];
+} workpool_slot_t;
+
+typedef struct
+{
+  int numworkers;
+  pthread_t *threads;
+  workpool_slot_t *slots;
+  pthread_mutex_t *mut;
+  pthread_cond_t *workAvailable, *workComplete;
+  unsigned long queued;		// tasks submitted but not yet taken
+  int nextslot;			// queue receiving the next submitted task
+  int shutdown;
+} workpool_t;
+
+
+// public workpool.c functions
+workpool_t *workpool_init (int numworkers);
+void workpool_group_init (workpool_group_t * group);
+void workpool_submit (workpool_t * pool, workpool_group_t * group,
+		      workpool_fn fn, void *arg);
+void workpool_wait (workpool_t * pool, workpool_group_t * group);
+void workpool_destroy (workpool_t * pool);
+int workpool_cpus (void);
+
+
+#endif // WORKPOOL_H